@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <limits>
+#include <algorithm>
+#include "Ray3D.h"
+#include "RayPacket.h"
+#include "RenderStats.h"
+
+// Axis-aligned bounding box. Starts out empty (min = +inf, max = -inf) so that expanding it by any point works
+struct AABB {
+	rvec3 min = rvec3(std::numeric_limits<Real>::max());
+	rvec3 max = rvec3(-std::numeric_limits<Real>::max());
+
+	AABB() = default;
+	AABB(const rvec3& _min, const rvec3& _max) : min(_min), max(_max) {}
+
+	void Expand(const rvec3& point) {
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+	void Expand(const AABB& other) {
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+	}
+
+	bool IsValid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+	rvec3 Centroid() const { return Real(0.5) * (min + max); }
+	Real SurfaceArea() const {
+		if (!IsValid()) return 0;
+		rvec3 size = max - min;
+		return Real(2.0) * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	// Slab test against the ray, using the ray's cached inverse direction
+	// Returns true if the ray overlaps the box within [tMin, tMax], and stores the entry distance in tEntry
+	bool IntersectRay(const Ray3D& ray, Real tMin, Real tMax, Real& tEntry) const {
+		RENDER_STAT(RenderStats::Local().boxTests++);
+		for (int axis = 0; axis < 3; axis++) {
+			Real t0 = (min[axis] - ray.start[axis]) * ray.invDir[axis];
+			Real t1 = (max[axis] - ray.start[axis]) * ray.invDir[axis];
+			// Swap near/far when the ray is travelling in the negative direction on this axis
+			if (ray.sign[axis] < 0) std::swap(t0, t1);
+			tMin = std::max(tMin, t0);
+			tMax = std::min(tMax, t1);
+			if (tMax < tMin) {
+				RENDER_STAT(RenderStats::Local().boxRejects++);
+				return false;
+			}
+		}
+		tEntry = tMin;
+		return true;
+	}
+
+	// Slab test against every active ray of a packet at once. Returns a mask of the lanes whose ray overlaps the box within
+	// [tMin, tMax[lane]], and stores each lane's entry distance in tEntry
+	int IntersectPacket(const RayPacket& packet, int activeMask, Real tMin, const Real (&tMax)[packetSize],
+		Real (&tEntry)[packetSize]) const {
+		SimdReal nearT = SimdReal::Broadcast(tMin);
+		SimdReal farT = SimdReal::Load(tMax);
+		for (int axis = 0; axis < 3; axis++) {
+			SimdReal start = SimdReal::Load(packet.start[axis]);
+			SimdReal invDir = SimdReal::Load(packet.invDir[axis]);
+			SimdReal t0 = (SimdReal::Broadcast(min[axis]) - start) * invDir;
+			SimdReal t1 = (SimdReal::Broadcast(max[axis]) - start) * invDir;
+			// Min/Max pick the near/far side without needing the sign of each lane's direction
+			// (the running nearT/farT are the second operand, so they are kept if a slab produces NaN)
+			nearT = Max(Min(t0, t1), nearT);
+			farT = Min(Max(t0, t1), farT);
+		}
+		nearT.Store(tEntry);
+		int hitMask = MoveMask(CmpLe(nearT, farT)) & activeMask;
+		RENDER_STAT(RenderStats::Local().boxTests += RenderStats::CountLanes(activeMask));
+		RENDER_STAT(RenderStats::Local().boxRejects += RenderStats::CountLanes(activeMask & ~hitMask));
+		return hitMask;
+	}
+};
@@ -0,0 +1,172 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "AccumulationBuffer.h"
+
+using namespace std;
+using namespace glm;
+
+// Identifies checkpoint files, and lets the format change without misreading old files
+static const char checkpointMagic[4] = { 'M', 'L', 'R', 'C' };
+static const uint32_t checkpointVersion = 4;
+
+void AccumulationBuffer::Reset(int _width, int _height, int _firstRow) {
+	width = _width;
+	height = _height;
+	firstRow = _firstRow;
+	sums.assign((size_t)width * height, dvec3(0));
+	lumSqrSums.assign((size_t)width * height, 0.0);
+	counts.assign((size_t)width * height, 0);
+	albedoSums.assign((size_t)width * height, vec3(0));
+	normalSums.assign((size_t)width * height, vec3(0));
+}
+
+double AccumulationBuffer::GetVariance(int row, int col) const {
+	size_t idx = GetIndex(row, col);
+	double n = counts[idx];
+	if (n < 1) return 0;
+	double mean = Luminance(sums[idx]) / n;
+	if (n < 2) return mean * mean;
+	// Unbiased sample variance, from the running sums. Rounding can make it slightly negative when it should be 0
+	double variance = std::max(0.0, (lumSqrSums[idx] / n - mean * mean) * n / (n - 1));
+	return variance / n;
+}
+
+double AccumulationBuffer::GetRelativeError(int row, int col) const {
+	size_t idx = GetIndex(row, col);
+	double n = counts[idx];
+	if (n < 2) return std::numeric_limits<double>::infinity();
+	double mean = Luminance(sums[idx]) / n;
+	// Add a small offset to the mean, so that nearly-black pixels don't need an enormous number of samples
+	return std::sqrt(GetVariance(row, col)) / (mean + 0.01);
+}
+
+int AccumulationBuffer::GetMinSampleCount() const {
+	if (counts.empty()) return 0;
+	return (int)*std::min_element(counts.begin(), counts.end());
+}
+
+int AccumulationBuffer::GetMaxSampleCount() const {
+	if (counts.empty()) return 0;
+	return (int)*std::max_element(counts.begin(), counts.end());
+}
+
+long long AccumulationBuffer::GetTotalSampleCount() const {
+	long long total = 0;
+	for (uint32_t count : counts) total += count;
+	return total;
+}
+
+vector<dvec3> AccumulationBuffer::GetMeans() const {
+	vector<dvec3> means(sums.size());
+	for (int row = 0; row < height; row++) {
+		for (int col = 0; col < width; col++) {
+			means[(size_t)row * width + col] = GetMean(firstRow + row, col);
+		}
+	}
+	return means;
+}
+
+bool AccumulationBuffer::SaveCheckpoint(const std::string& filename, const CheckpointInfo& info) const {
+	string tempFilename = filename + ".tmp";
+	{
+		ofstream file(tempFilename, ios::binary);
+		if (!file.good()) {
+			cerr << "ERROR: Unable to open " << tempFilename << " for writing" << endl;
+			return false;
+		}
+		// Header, followed by the sums, squared luminance sums, counts, albedo sums and normal sums as raw arrays
+		int32_t dims[2] = { width, height };
+		file.write(checkpointMagic, sizeof(checkpointMagic));
+		file.write(reinterpret_cast<const char*>(&checkpointVersion), sizeof(checkpointVersion));
+		file.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+		file.write(reinterpret_cast<const char*>(&info), sizeof(CheckpointInfo));
+		file.write(reinterpret_cast<const char*>(sums.data()), sums.size() * sizeof(dvec3));
+		file.write(reinterpret_cast<const char*>(lumSqrSums.data()), lumSqrSums.size() * sizeof(double));
+		file.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(uint32_t));
+		file.write(reinterpret_cast<const char*>(albedoSums.data()), albedoSums.size() * sizeof(vec3));
+		file.write(reinterpret_cast<const char*>(normalSums.data()), normalSums.size() * sizeof(vec3));
+		if (!file.good()) {
+			cerr << "ERROR: Failed to write checkpoint " << tempFilename << endl;
+			return false;
+		}
+	}
+	// std::rename won't replace an existing file on every platform, so remove the old checkpoint first
+	std::remove(filename.c_str());
+	if (std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+		cerr << "ERROR: Unable to move " << tempFilename << " to " << filename << endl;
+		return false;
+	}
+	return true;
+}
+
+bool AccumulationBuffer::LoadCheckpoint(const std::string& filename, CheckpointInfo& outInfo) {
+	ifstream file(filename, ios::binary);
+	if (!file.good()) {
+		cerr << "ERROR: Unable to find checkpoint file " << filename << endl;
+		return false;
+	}
+	char magic[4];
+	uint32_t version;
+	int32_t dims[2];
+	CheckpointInfo info;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char*>(&version), sizeof(version));
+	if (!file.good() || !std::equal(magic, magic + 4, checkpointMagic)) {
+		cerr << "ERROR: " << filename << " is not a valid checkpoint file" << endl;
+		return false;
+	}
+	if (version != checkpointVersion) {
+		cerr << "ERROR: " << filename << " was saved by a different version of the renderer" << endl;
+		return false;
+	}
+	file.read(reinterpret_cast<char*>(dims), sizeof(dims));
+	file.read(reinterpret_cast<char*>(&info), sizeof(CheckpointInfo));
+	if (!file.good() || dims[0] <= 0 || dims[1] <= 0 || info.numSamples < 0 || info.shardCount < 1 ||
+		info.shardIndex < 0 || info.shardIndex >= info.shardCount) {
+		cerr << "ERROR: " << filename << " is not a valid checkpoint file" << endl;
+		return false;
+	}
+	// Make sure the file really holds every pixel before allocating them, so a damaged size fails here instead of
+	// running out of memory
+	const uint64_t pixelSize = sizeof(dvec3) + sizeof(double) + sizeof(uint32_t) + 2 * sizeof(vec3);
+	streamoff dataStart = file.tellg();
+	file.seekg(0, ios::end);
+	uint64_t dataSize = (uint64_t)(file.tellg() - dataStart);
+	file.seekg(dataStart);
+	if ((uint64_t)dims[0] * (uint64_t)dims[1] > dataSize / pixelSize) {
+		cerr << "ERROR: Checkpoint file " << filename << " is truncated" << endl;
+		return false;
+	}
+
+	AccumulationBuffer loaded;
+	loaded.Reset(dims[0], dims[1]);
+	file.read(reinterpret_cast<char*>(loaded.sums.data()), loaded.sums.size() * sizeof(dvec3));
+	file.read(reinterpret_cast<char*>(loaded.lumSqrSums.data()), loaded.lumSqrSums.size() * sizeof(double));
+	file.read(reinterpret_cast<char*>(loaded.counts.data()), loaded.counts.size() * sizeof(uint32_t));
+	file.read(reinterpret_cast<char*>(loaded.albedoSums.data()), loaded.albedoSums.size() * sizeof(vec3));
+	file.read(reinterpret_cast<char*>(loaded.normalSums.data()), loaded.normalSums.size() * sizeof(vec3));
+	if (!file.good()) {
+		cerr << "ERROR: Checkpoint file " << filename << " is truncated" << endl;
+		return false;
+	}
+	*this = std::move(loaded);
+	outInfo = info;
+	return true;
+}
+
+bool AccumulationBuffer::Merge(const AccumulationBuffer& other) {
+	if (other.width != width || other.height != height || other.firstRow != firstRow) return false;
+	for (size_t i = 0; i < sums.size(); i++) {
+		sums[i] += other.sums[i];
+		lumSqrSums[i] += other.lumSqrSums[i];
+		counts[i] += other.counts[i];
+		albedoSums[i] += other.albedoSums[i];
+		normalSums[i] += other.normalSums[i];
+	}
+	return true;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// How the samples in a checkpoint were rendered. Its samples only line up with renders that continue the same sample
+// sequences, so it can only be resumed or merged with checkpoints that used the same settings
+struct CheckpointInfo {
+	uint32_t seed = 0;
+	// SamplerType
+	uint32_t samplerType = 0;
+	int32_t numSamples = 0;
+	// Which part of a sharded render the checkpoint holds (see RenderSettings::shardCount). shardMode is a ShardMode, and
+	// is always 0 (tiles) for unsharded renders
+	uint32_t shardMode = 0;
+	int32_t shardIndex = 0;
+	int32_t shardCount = 1;
+
+	// Whether both checkpoints come from the same render, ignoring which shard they are
+	bool IsSameRender(const CheckpointInfo& other) const {
+		return seed == other.seed && samplerType == other.samplerType && numSamples == other.numSamples &&
+			shardMode == other.shardMode && shardCount == other.shardCount;
+	}
+};
+
+// Running per-pixel sums of every sample rendered so far, so an image can be built up over several passes and saved to
+// disk part way through. Squared luminance is also summed, so each pixel's noise level can be estimated for adaptive
+// sampling, along with the albedo and normal of each sample's first hit for the denoiser
+// Pixels are stored row by row, with row 0 at the bottom of the image (same as Image). The buffer can also cover just a
+// band of the image's rows, and is still indexed by image row (i.e. to render a huge image one band at a time)
+class AccumulationBuffer {
+public:
+	AccumulationBuffer() = default;
+
+	// Clear the buffer and set its size. It covers image rows [_firstRow, _firstRow + _height)
+	void Reset(int _width, int _height, int _firstRow = 0);
+
+	// Add a single sample to a pixel, with the albedo and normal of the surface it hit first. Each pixel is only ever
+	// touched by one thread at a time
+	void AddSample(int row, int col, const glm::dvec3& color, const glm::dvec3& albedo = glm::dvec3(0),
+		const glm::dvec3& normal = glm::dvec3(0)) {
+		size_t idx = GetIndex(row, col);
+		double lum = Luminance(color);
+		sums[idx] += color;
+		lumSqrSums[idx] += lum * lum;
+		albedoSums[idx] += glm::vec3(albedo);
+		normalSums[idx] += glm::vec3(normal);
+		counts[idx]++;
+	}
+
+	// Average color of all of the samples in a pixel (black if it has no samples yet)
+	glm::dvec3 GetMean(int row, int col) const {
+		size_t idx = GetIndex(row, col);
+		return (counts[idx] > 0) ? sums[idx] / (double)counts[idx] : glm::dvec3(0);
+	}
+	// Average first-hit albedo and normal of the pixel's samples. Normals aren't renormalized, so they get shorter where
+	// the samples hit surfaces facing different ways
+	glm::vec3 GetMeanAlbedo(int row, int col) const {
+		size_t idx = GetIndex(row, col);
+		return (counts[idx] > 0) ? albedoSums[idx] / (float)counts[idx] : glm::vec3(0);
+	}
+	glm::vec3 GetMeanNormal(int row, int col) const {
+		size_t idx = GetIndex(row, col);
+		return (counts[idx] > 0) ? normalSums[idx] / (float)counts[idx] : glm::vec3(0);
+	}
+	int GetSampleCount(int row, int col) const { return (int)counts[GetIndex(row, col)]; }
+	// Estimated variance of the pixel's mean luminance (the squared standard error). A single sample has no spread to
+	// measure, so it's taken to be as uncertain as its own value. Returns 0 for pixels without samples
+	double GetVariance(int row, int col) const;
+	// Estimated standard error of the pixel's mean luminance, relative to the mean (so bright and dark regions converge
+	// equally). Returns infinity for pixels with fewer than 2 samples
+	double GetRelativeError(int row, int col) const;
+	// Fewest samples in any pixel
+	int GetMinSampleCount() const;
+	// Most samples in any pixel
+	int GetMaxSampleCount() const;
+	// Total number of samples in the whole buffer
+	long long GetTotalSampleCount() const;
+	// Average color of every pixel in the buffer, row by row
+	std::vector<glm::dvec3> GetMeans() const;
+
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+	// First image row in the buffer (0 unless it only covers a band of the image)
+	int GetFirstRow() const { return firstRow; }
+
+	// Save the sums and sample counts, along with how they were rendered, so that the render can be resumed later (only
+	// for buffers of the whole image). The file is written to a temporary name and then moved into place, so an
+	// interrupted save never destroys the previous checkpoint
+	bool SaveCheckpoint(const std::string& filename, const CheckpointInfo& info) const;
+	// Replace the contents of the buffer with a saved checkpoint, and return how it was rendered in outInfo. Returns
+	// false if the file is missing or invalid
+	bool LoadCheckpoint(const std::string& filename, CheckpointInfo& outInfo);
+	// Add every sample of another buffer to this one (i.e. renders of other shards). The sums are added directly, so the
+	// result is the same as if every sample had been rendered into one buffer. Returns false if the sizes don't match
+	bool Merge(const AccumulationBuffer& other);
+
+private:
+	static double Luminance(const glm::dvec3& color) { return 0.2126 * color.r + 0.7152 * color.g + 0.0722 * color.b; }
+	size_t GetIndex(int row, int col) const { return (size_t)(row - firstRow) * width + col; }
+
+	int width = 0;
+	int height = 0;
+	int firstRow = 0;
+	std::vector<glm::dvec3> sums;
+	std::vector<double> lumSqrSums;
+	std::vector<uint32_t> counts;
+	// Floats are plenty for values that are only used to guide the denoiser, and keep the buffer smaller
+	std::vector<glm::vec3> albedoSums;
+	std::vector<glm::vec3> normalSums;
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include "AliasTable.h"
+
+using namespace std;
+
+void AliasTable::Build(const vector<double>& weights) {
+	int count = (int)weights.size();
+	bins.assign(count, Bin());
+	pdfs.assign(count, 0.0);
+	if (count == 0) return;
+
+	double totalWeight = 0;
+	for (double weight : weights) totalWeight += std::max(0.0, weight);
+	for (int i = 0; i < count; i++) {
+		pdfs[i] = (totalWeight > 0) ? std::max(0.0, weights[i]) / totalWeight : 1.0 / count;
+	}
+
+	// Scale the probabilities so the average bin holds 1, then fill every underfull bin with part of an overfull one
+	vector<double> scaled(count);
+	vector<int> small, large;
+	for (int i = 0; i < count; i++) {
+		scaled[i] = pdfs[i] * count;
+		if (scaled[i] < 1.0) small.push_back(i);
+		else large.push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		int smallIdx = small.back();
+		small.pop_back();
+		int largeIdx = large.back();
+		bins[smallIdx].probability = scaled[smallIdx];
+		bins[smallIdx].alias = largeIdx;
+		// The large index gave up the rest of the small bin, so it may have become small itself
+		scaled[largeIdx] -= 1.0 - scaled[smallIdx];
+		if (scaled[largeIdx] < 1.0) {
+			large.pop_back();
+			small.push_back(largeIdx);
+		}
+	}
+	// Whatever is left over is (up to rounding error) exactly full
+	for (int idx : small) bins[idx] = { 1.0, idx };
+	for (int idx : large) bins[idx] = { 1.0, idx };
+}
+
+int AliasTable::Sample(double u, double& outPdf) const {
+	double remainder;
+	return Sample(u, outPdf, remainder);
+}
+
+int AliasTable::Sample(double u, double& outPdf, double& outRemainder) const {
+	// The integer part of u * count picks the bin, and the fractional part decides between the bin and its alias
+	double scaledU = u * bins.size();
+	int binIdx = std::min((int)scaledU, (int)bins.size() - 1);
+	double remainder = scaledU - binIdx;
+	const Bin& bin = bins[binIdx];
+	int idx;
+	if (remainder < bin.probability) {
+		idx = binIdx;
+		outRemainder = remainder / bin.probability;
+	}
+	else {
+		idx = bin.alias;
+		outRemainder = (remainder - bin.probability) / (1.0 - bin.probability);
+	}
+	// Rounding can push the remainder up to 1, keep it in [0, 1) like the input
+	outRemainder = std::min(outRemainder, std::nextafter(1.0, 0.0));
+	outPdf = pdfs[idx];
+	return idx;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+
+// Picks an index with probability proportional to its weight in constant time, no matter how many there are
+// (Walker/Vose alias method: https://www.keithschwarz.com/darts-dice-coins/)
+class AliasTable {
+public:
+	AliasTable() = default;
+
+	// Build the table from non-negative weights. If every weight is 0, all indices are equally likely
+	void Build(const std::vector<double>& weights);
+
+	// Choose an index from a single uniform number in [0, 1), and return the probability of having chosen it
+	int Sample(double u, double& outPdf) const;
+	// Same as Sample, but also return the part of u that wasn't needed to choose the index, rescaled to [0, 1). It's
+	// independent of the choice, so it can be used as another uniform number (i.e. for a position on the chosen item)
+	int Sample(double u, double& outPdf, double& outRemainder) const;
+	double GetPdf(int idx) const { return pdfs[idx]; }
+	int Size() const { return (int)bins.size(); }
+	bool IsEmpty() const { return bins.empty(); }
+
+private:
+	// Each bin is picked uniformly, then keeps its own index with the given probability or switches to its alias
+	struct Bin {
+		double probability = 1;
+		int alias = 0;
+	};
+	std::vector<Bin> bins;
+	// Normalized weight of every index
+	std::vector<double> pdfs;
+};
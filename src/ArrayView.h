@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Read-only view of a contiguous array that lives somewhere else, e.g. in a vector or a memory-mapped file
+// The view doesn't own the memory, so whatever does has to outlive it
+template<class T>
+class ArrayView {
+public:
+	ArrayView() = default;
+	ArrayView(const T* _data, size_t _size) : ptr(_data), count(_size) {}
+	ArrayView(const std::vector<T>& values) : ptr(values.data()), count(values.size()) {}
+
+	const T& operator[](size_t i) const { return ptr[i]; }
+	const T* data() const { return ptr; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T* begin() const { return ptr; }
+	const T* end() const { return ptr + count; }
+
+private:
+	const T* ptr = nullptr;
+	size_t count = 0;
+};
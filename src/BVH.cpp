@@ -0,0 +1,369 @@
+#pragma once
+#include <algorithm>
+#include <numeric>
+#include <thread>
+#include "BVH.h"
+#include "ThreadPool.h"
+
+using namespace std;
+using namespace glm;
+
+// Relative costs of traversing an interior node and of intersecting a single primitive, used by the SAH
+static constexpr double traversalCost = 1.0;
+static constexpr double intersectionCost = 1.0;
+// Number of bins that the SAH sorts each node's centroids into along each axis
+static constexpr int numBins = 16;
+// The top of the tree is split on one thread into about this many subtrees, which are then built in parallel. This
+// doesn't depend on the number of threads, so every thread count builds the same nodes in the same order
+static constexpr int numSubtrees = 256;
+// Smallest subtree that's worth building on another thread
+static constexpr int minSubtreeSize = 1024;
+// Bits of each axis in a Morton code
+static constexpr int mortonBits = 10;
+
+// Scale from a centroid's offset inside the centroid bounds to its bin along the given axis
+static Real GetBinScale(const AABB& centroidBounds, int axis) {
+	return Real(numBins) / (centroidBounds.max[axis] - centroidBounds.min[axis]);
+}
+
+// Bin of a centroid along one axis. The split search and the partition that follows it both use this, so every
+// primitive ends up on the side of the split that it was counted on
+static int GetBin(Real centroid, Real minCentroid, Real binScale) {
+	int bin = (int)((centroid - minCentroid) * binScale);
+	return std::min(std::max(bin, 0), numBins - 1);
+}
+
+// Spread the low 10 bits of v out so there are 2 zero bits between each of them
+static uint32_t SpreadBits(uint32_t v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+void BVH::Build(const vector<AABB>& primBounds, int _maxLeafSize, const BVHBuildSettings& settings) {
+	nodeStorage.clear();
+	primIndexStorage.resize(primBounds.size());
+	std::iota(primIndexStorage.begin(), primIndexStorage.end(), 0);
+	maxLeafSize = std::max(1, _maxLeafSize);
+	if (primBounds.empty()) {
+		UseStorage();
+		return;
+	}
+
+	// Primitives are sorted and split by their centroids, so compute those once up front
+	vector<rvec3> centroids(primBounds.size());
+	for (size_t i = 0; i < primBounds.size(); i++) {
+		centroids[i] = primBounds[i].Centroid();
+	}
+
+	// A binary tree with n leaves has at most 2n - 1 nodes
+	int numPrims = (int)primBounds.size();
+	nodeStorage.reserve(2 * primBounds.size());
+	nodeStorage.emplace_back();
+	if (settings.method == BVHBuildMethod::MORTON) {
+		BuildMorton(primBounds, centroids);
+	}
+	else {
+		// Enough subtrees to keep every thread busy, even if some of them turn out much cheaper than others
+		int subtreeSize = std::max(minSubtreeSize, numPrims / numSubtrees);
+		if (numPrims > subtreeSize) {
+			int numThreads = (settings.numThreads > 0) ? settings.numThreads : (int)std::thread::hardware_concurrency();
+			vector<PendingSubtree> pending;
+			BuildRecursive(nodeStorage, 0, 0, numPrims, 0, primBounds, centroids, &pending, subtreeSize);
+			BuildSubtrees(pending, numThreads, primBounds, centroids);
+		}
+		else {
+			BuildRecursive(nodeStorage, 0, 0, numPrims, 0, primBounds, centroids);
+		}
+	}
+	nodeStorage.shrink_to_fit();
+	UseStorage();
+}
+
+void BVH::AdoptPrimitiveOrder() {
+	// Leaf i now refers to the caller's primitive i directly
+	std::iota(primIndexStorage.begin(), primIndexStorage.end(), 0);
+}
+
+void BVH::Load(ArrayView<BVHNode> _nodes, ArrayView<int> _primIndices) {
+	nodeStorage = vector<BVHNode>();
+	primIndexStorage = vector<int>();
+	nodes = _nodes;
+	primIndices = _primIndices;
+}
+
+bool BVH::IsValidTree(ArrayView<BVHNode> treeNodes, size_t numPrims) {
+	if (treeNodes.empty()) return true;
+	// Walk the tree from the root, the same way traversal does
+	vector<bool> visited(treeNodes.size(), false);
+	vector<pair<int64_t, int>> toVisit = { { 0, 0 } };
+	while (!toVisit.empty()) {
+		int64_t nodeIdx = toVisit.back().first;
+		int depth = toVisit.back().second;
+		toVisit.pop_back();
+		if (nodeIdx < 0 || (size_t)nodeIdx >= treeNodes.size() || visited[nodeIdx] || depth >= maxDepth) return false;
+		visited[nodeIdx] = true;
+
+		const BVHNode& node = treeNodes[nodeIdx];
+		if (node.IsLeaf()) {
+			if (node.leftFirst < 0 || (size_t)node.leftFirst + node.count > numPrims) return false;
+		}
+		else {
+			if (node.count != 0) return false;
+			toVisit.push_back({ (int64_t)node.leftFirst, depth + 1 });
+			toVisit.push_back({ (int64_t)node.leftFirst + 1, depth + 1 });
+		}
+	}
+	return true;
+}
+
+void BVH::Refit(const vector<AABB>& primBounds) {
+	if (nodeStorage.data() != nodes.data()) {
+		nodeStorage.assign(nodes.begin(), nodes.end());
+		primIndexStorage.assign(primIndices.begin(), primIndices.end());
+		UseStorage();
+	}
+	// Children are always stored after their parent, so going backwards updates both children before the parent
+	for (int nodeIdx = (int)nodeStorage.size() - 1; nodeIdx >= 0; nodeIdx--) {
+		BVHNode& node = nodeStorage[nodeIdx];
+		AABB bounds;
+		if (node.IsLeaf()) {
+			for (int i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+				bounds.Expand(primBounds[primIndexStorage[i]]);
+			}
+		}
+		else {
+			bounds.Expand(nodeStorage[node.leftFirst].bounds);
+			bounds.Expand(nodeStorage[node.leftFirst + 1].bounds);
+		}
+		node.bounds = bounds;
+	}
+}
+
+void BVH::UseStorage() {
+	nodes = nodeStorage;
+	primIndices = primIndexStorage;
+}
+
+void BVH::BuildRecursive(vector<BVHNode>& outNodes, int nodeIdx, int first, int count, int depth,
+	const vector<AABB>& primBounds, const vector<rvec3>& centroids, vector<PendingSubtree>* pending, int subtreeSize) {
+	if (pending && count <= subtreeSize) {
+		pending->push_back({ nodeIdx, first, count, depth });
+		return;
+	}
+
+	AABB nodeBounds, centroidBounds;
+	for (int i = first; i < first + count; i++) {
+		nodeBounds.Expand(primBounds[primIndexStorage[i]]);
+		centroidBounds.Expand(centroids[primIndexStorage[i]]);
+	}
+	outNodes[nodeIdx].bounds = nodeBounds;
+
+	int axis, bin;
+	// Stop splitting once the node is small enough, the tree is too deep for the traversal stack, or a split won't pay off
+	if (count <= maxLeafSize || depth >= maxDepth - 1 ||
+		!FindBestSplit(first, count, nodeBounds, centroidBounds, primBounds, centroids, axis, bin)) {
+		outNodes[nodeIdx].leftFirst = first;
+		outNodes[nodeIdx].count = count;
+		return;
+	}
+
+	// Reorder this node's primitives so [first, split) goes left and [split, first + count) goes right
+	vector<int>::iterator begin = primIndexStorage.begin() + first;
+	vector<int>::iterator end = begin + count;
+	int split;
+	if (bin >= 0) {
+		Real minCentroid = centroidBounds.min[axis];
+		Real binScale = GetBinScale(centroidBounds, axis);
+		split = first + (int)(std::partition(begin, end, [&](int primIdx) {
+			return GetBin(centroids[primIdx][axis], minCentroid, binScale) < bin;
+		}) - begin);
+	}
+	else {
+		split = first + count / 2;
+		std::nth_element(begin, primIndexStorage.begin() + split, end,
+			[&centroids, axis](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+	}
+
+	// Allocate both children next to each other. Don't hold a reference to outNodes[nodeIdx] across this, since it can reallocate
+	int leftIdx = (int)outNodes.size();
+	outNodes.emplace_back();
+	outNodes.emplace_back();
+	outNodes[nodeIdx].leftFirst = leftIdx;
+	outNodes[nodeIdx].count = 0;
+
+	BuildRecursive(outNodes, leftIdx, first, split - first, depth + 1, primBounds, centroids, pending, subtreeSize);
+	BuildRecursive(outNodes, leftIdx + 1, split, first + count - split, depth + 1, primBounds, centroids,
+		pending, subtreeSize);
+}
+
+void BVH::BuildSubtrees(const vector<PendingSubtree>& pending, int numThreads,
+	const vector<AABB>& primBounds, const vector<rvec3>& centroids) {
+	// Every subtree owns a separate range of primIndexStorage, so they can be split at the same time
+	vector<vector<BVHNode> > subtreeNodes(pending.size());
+	auto buildSubtree = [&](size_t i) {
+		const PendingSubtree& subtree = pending[i];
+		vector<BVHNode>& localNodes = subtreeNodes[i];
+		localNodes.reserve(2 * subtree.count);
+		localNodes.emplace_back();
+		BuildRecursive(localNodes, 0, subtree.first, subtree.count, subtree.depth, primBounds, centroids);
+	};
+	if (numThreads > 1) {
+		ThreadPool pool(std::min(numThreads, (int)pending.size()));
+		for (size_t i = 0; i < pending.size(); i++) {
+			pool.Submit([&buildSubtree, i]() { buildSubtree(i); });
+		}
+		pool.WaitAll();
+	}
+	else {
+		for (size_t i = 0; i < pending.size(); i++) buildSubtree(i);
+	}
+
+	// The local root replaces the placeholder node, and the rest of each list goes on the end, which is where building
+	// the subtrees in order would've put them. Children still come after their parents, so Refit keeps working
+	for (size_t i = 0; i < pending.size(); i++) {
+		vector<BVHNode>& localNodes = subtreeNodes[i];
+		int offset = (int)nodeStorage.size() - 1;
+		for (BVHNode& node : localNodes) {
+			if (!node.IsLeaf()) node.leftFirst += offset;
+		}
+		nodeStorage[pending[i].nodeIdx] = localNodes[0];
+		nodeStorage.insert(nodeStorage.end(), localNodes.begin() + 1, localNodes.end());
+		localNodes = vector<BVHNode>();
+	}
+}
+
+bool BVH::FindBestSplit(int first, int count, const AABB& nodeBounds, const AABB& centroidBounds,
+	const vector<AABB>& primBounds, const vector<rvec3>& centroids, int& outAxis, int& outBin) const {
+	double parentArea = nodeBounds.SurfaceArea();
+	// Cost of leaving all of the primitives in a single leaf
+	double bestCost = count * intersectionCost;
+	bool foundSplit = false;
+
+	for (int axis = 0; axis < 3; axis++) {
+		// All of the centroids are in the same spot along this axis, so it can't separate them
+		Real minCentroid = centroidBounds.min[axis];
+		if (!(centroidBounds.max[axis] > minCentroid)) continue;
+		Real binScale = GetBinScale(centroidBounds, axis);
+
+		int binCounts[numBins] = {};
+		AABB binBounds[numBins];
+		for (int i = first; i < first + count; i++) {
+			int primIdx = primIndexStorage[i];
+			int bin = GetBin(centroids[primIdx][axis], minCentroid, binScale);
+			binCounts[bin]++;
+			binBounds[bin].Expand(primBounds[primIdx]);
+		}
+
+		// Sweep from the right to find the area and count of every possible right-hand child
+		// rightAreas[b] and rightCounts[b] cover bins [b, numBins)
+		double rightAreas[numBins];
+		int rightCounts[numBins];
+		AABB rightBounds;
+		int rightCount = 0;
+		for (int b = numBins - 1; b > 0; b--) {
+			rightBounds.Expand(binBounds[b]);
+			rightCount += binCounts[b];
+			rightAreas[b] = rightBounds.SurfaceArea();
+			rightCounts[b] = rightCount;
+		}
+
+		// Sweep from the left, evaluating the SAH at every boundary between two bins
+		AABB leftBounds;
+		int leftCount = 0;
+		for (int b = 1; b < numBins; b++) {
+			leftBounds.Expand(binBounds[b - 1]);
+			leftCount += binCounts[b - 1];
+			if (leftCount == 0 || rightCounts[b] == 0) continue;
+			double cost = traversalCost + intersectionCost *
+				(leftBounds.SurfaceArea() * leftCount + rightAreas[b] * rightCounts[b]) / std::max(parentArea, 1e-12);
+			if (cost < bestCost) {
+				bestCost = cost;
+				outAxis = axis;
+				outBin = b;
+				foundSplit = true;
+			}
+		}
+	}
+
+	// Large leaves are very slow to intersect, so always split them even if the SAH says otherwise
+	if (!foundSplit && count > 4 * maxLeafSize) {
+		rvec3 extent = centroidBounds.max - centroidBounds.min;
+		outAxis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+		outBin = -1;
+		foundSplit = true;
+	}
+	return foundSplit;
+}
+
+void BVH::BuildMorton(const vector<AABB>& primBounds, const vector<rvec3>& centroids) {
+	AABB centroidBounds;
+	for (const rvec3& centroid : centroids) {
+		centroidBounds.Expand(centroid);
+	}
+	// Quantize each centroid to a grid over the centroid bounds, and interleave the bits of its cell's coordinates
+	const Real gridSize = Real(1 << mortonBits);
+	rvec3 extent = centroidBounds.max - centroidBounds.min;
+	vector<pair<uint32_t, int> > sortedCodes(centroids.size());
+	for (size_t i = 0; i < centroids.size(); i++) {
+		uint32_t code = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			Real offset = (extent[axis] > 0) ? (centroids[i][axis] - centroidBounds.min[axis]) / extent[axis] : Real(0);
+			uint32_t cell = (uint32_t)std::min(std::max(offset * gridSize, Real(0)), gridSize - 1);
+			code |= SpreadBits(cell) << (2 - axis);
+		}
+		sortedCodes[i] = make_pair(code, (int)i);
+	}
+	// Ties are broken by primitive index, so the order doesn't depend on the sort implementation
+	std::sort(sortedCodes.begin(), sortedCodes.end());
+
+	vector<uint32_t> codes(sortedCodes.size());
+	for (size_t i = 0; i < sortedCodes.size(); i++) {
+		codes[i] = sortedCodes[i].first;
+		primIndexStorage[i] = sortedCodes[i].second;
+	}
+	BuildMortonRecursive(0, 0, (int)codes.size(), 0, primBounds, codes);
+}
+
+void BVH::BuildMortonRecursive(int nodeIdx, int first, int count, int depth,
+	const vector<AABB>& primBounds, const vector<uint32_t>& codes) {
+	if (count <= maxLeafSize || depth >= maxDepth - 1) {
+		AABB bounds;
+		for (int i = first; i < first + count; i++) {
+			bounds.Expand(primBounds[primIndexStorage[i]]);
+		}
+		nodeStorage[nodeIdx].bounds = bounds;
+		nodeStorage[nodeIdx].leftFirst = first;
+		nodeStorage[nodeIdx].count = count;
+		return;
+	}
+
+	// The codes are sorted, so the first and last ones differ on the highest bit that differs anywhere in the range,
+	// and every code with that bit cleared comes before every code with it set
+	uint32_t differentBits = codes[first] ^ codes[first + count - 1];
+	int split;
+	if (differentBits == 0) {
+		// Primitives in the same grid cell can't be told apart, so just split them in half
+		split = first + count / 2;
+	}
+	else {
+		int bit = 31;
+		while (!(differentBits & (1u << bit))) bit--;
+		split = (int)(std::partition_point(codes.begin() + first, codes.begin() + first + count,
+			[bit](uint32_t code) { return !(code & (1u << bit)); }) - codes.begin());
+	}
+
+	int leftIdx = (int)nodeStorage.size();
+	nodeStorage.emplace_back();
+	nodeStorage.emplace_back();
+	nodeStorage[nodeIdx].leftFirst = leftIdx;
+	nodeStorage[nodeIdx].count = 0;
+	BuildMortonRecursive(leftIdx, first, split - first, depth + 1, primBounds, codes);
+	BuildMortonRecursive(leftIdx + 1, split, first + count - split, depth + 1, primBounds, codes);
+
+	AABB bounds = nodeStorage[leftIdx].bounds;
+	bounds.Expand(nodeStorage[leftIdx + 1].bounds);
+	nodeStorage[nodeIdx].bounds = bounds;
+}
@@ -0,0 +1,377 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include "AABB.h"
+#include "ArrayView.h"
+#include "Ray3D.h"
+
+// A node in the flattened hierarchy. Interior nodes store the index of their left child (the right child is always
+// stored directly after it), leaf nodes store a range in the BVH's primitive index list
+struct BVHNode {
+	AABB bounds;
+	// Interior: index of the left child. Leaf: index of the first primitive in primIndices
+	int leftFirst = 0;
+	// Number of primitives in this node (0 for interior nodes)
+	int count = 0;
+	bool IsLeaf() const { return count > 0; }
+};
+
+// Ways of building a BVH
+enum class BVHBuildMethod {
+	// Binned surface area heuristic. Takes the longest to build, but gives the fastest traversal
+	SAH,
+	// Sort the primitives along a Morton curve and split them on its bits (an LBVH). Builds several times faster than the
+	// SAH, but traces slower, i.e. for previews
+	MORTON
+};
+
+// Options for BVH::Build
+struct BVHBuildSettings {
+	BVHBuildMethod method = BVHBuildMethod::SAH;
+	// Threads that the SAH builds independent subtrees on, <= 0 uses one thread per hardware core. The tree comes out
+	// the same for any number of threads
+	int numThreads = 1;
+};
+
+// Bounding volume hierarchy over an arbitrary list of primitives, built with the surface area heuristic (SAH)
+// The BVH only knows about the primitives' bounds, the caller provides the actual intersection tests during traversal
+class BVH {
+public:
+	BVH() = default;
+	// The node and index views may point into this BVH's own storage, which moves along with it but isn't duplicated
+	BVH(const BVH&) = delete;
+	BVH& operator=(const BVH&) = delete;
+	BVH(BVH&&) = default;
+	BVH& operator=(BVH&&) = default;
+
+	// Build the hierarchy from the bounds of each primitive. Primitives are referred to by their index in this list
+	void Build(const std::vector<AABB>& primBounds, int maxLeafSize = 4,
+		const BVHBuildSettings& settings = BVHBuildSettings());
+
+	// Closest-hit traversal. Children are visited front-to-back, and nodes farther than the closest hit so far are skipped.
+	// intersectPrim(int primIdx, Real tMin, Real& tMax) should return true and shrink tMax if it finds a closer hit
+	template<class IntersectFunc>
+	bool TraverseClosest(const Ray3D& ray, Real tMin, Real tMax, IntersectFunc intersectPrim) const;
+
+	// Any-hit traversal for shadow rays, returns as soon as any primitive reports a hit
+	// occludedPrim(int primIdx, Real tMin, Real tMax) should return true if the primitive blocks the ray
+	template<class OccludedFunc>
+	bool TraverseAny(const Ray3D& ray, Real tMin, Real tMax, OccludedFunc occludedPrim) const;
+
+	// Versions of TraverseClosest/TraverseAny that hand whole leaves to the callback instead of one primitive at a time,
+	// so that callers whose primitives are stored in GetPrimitiveIndices() order can test a leaf with one SIMD kernel
+	// intersectLeaf(int first, int count, Real tMin, Real& tMax) covers positions [first, first + count) of that order
+	template<class IntersectLeafFunc>
+	bool TraverseClosestLeaves(const Ray3D& ray, Real tMin, Real tMax, IntersectLeafFunc intersectLeaf) const;
+	// occludedLeaf(int first, int count, Real tMin, Real tMax) should return true if anything in the leaf blocks the ray
+	template<class OccludedLeafFunc>
+	bool TraverseAnyLeaves(const Ray3D& ray, Real tMin, Real tMax, OccludedLeafFunc occludedLeaf) const;
+
+	// Closest-hit traversal for a packet of rays. Nodes are visited while any active lane still overlaps them
+	// intersectPrim(int primIdx, int laneMask) tests the primitive against the lanes in laneMask, and should shrink
+	// tMax[lane] for every lane where it finds a closer hit
+	template<class PacketFunc>
+	void TraversePacket(const RayPacket& packet, int activeMask, Real tMin, Real (&tMax)[packetSize],
+		PacketFunc intersectPrim) const;
+	// Any-hit traversal for a packet of shadow rays. Returns the mask of lanes that were blocked
+	// occludedPrim(int primIdx, int laneMask) should return the mask of lanes that the primitive blocks
+	template<class PacketOccludedFunc>
+	int TraversePacketAny(const RayPacket& packet, int activeMask, Real tMin, const Real (&tMax)[packetSize],
+		PacketOccludedFunc occludedPrim) const;
+
+	// Order of the primitives as they are referenced by the leaves. Callers can store their primitives in this order so that
+	// each leaf's primitives are contiguous in memory, then call AdoptPrimitiveOrder
+	ArrayView<int> GetPrimitiveIndices() const { return primIndices; }
+	// Tell the BVH that the caller's primitives have been reordered to match GetPrimitiveIndices()
+	void AdoptPrimitiveOrder();
+
+	// Flattened nodes, i.e. to save the hierarchy to a file
+	ArrayView<BVHNode> GetNodes() const { return nodes; }
+	// Use a hierarchy saved from GetNodes() and GetPrimitiveIndices() without copying it (e.g. straight out of a
+	// memory-mapped file). The arrays have to stay alive for as long as the BVH is used
+	void Load(ArrayView<BVHNode> _nodes, ArrayView<int> _primIndices);
+	// Check that a hierarchy saved from somewhere untrusted (i.e. a cache file) is safe to traverse: every child and
+	// primitive index is in bounds, no node is reached twice, and no leaf is deeper than the traversal stack allows
+	static bool IsValidTree(ArrayView<BVHNode> treeNodes, size_t numPrims);
+	// Recompute the bounds of every node from new primitive bounds (i.e. after the primitives were moved), keeping the
+	// structure of the tree. A loaded hierarchy is copied into this BVH's own storage first
+	void Refit(const std::vector<AABB>& primBounds);
+
+	bool IsEmpty() const { return nodes.empty(); }
+	const AABB& GetBounds() const { return nodes[0].bounds; }
+	int GetNumNodes() const { return (int)nodes.size(); }
+
+private:
+	// Node whose primitive range BuildRecursive left to be built later, on its own
+	struct PendingSubtree {
+		int nodeIdx, first, count, depth;
+	};
+	// Recursively split the primitives in [first, first + count) and store the result in outNodes[nodeIdx]
+	// If pending isn't null, ranges of at most subtreeSize primitives are added to it instead of being built
+	void BuildRecursive(std::vector<BVHNode>& outNodes, int nodeIdx, int first, int count, int depth,
+		const std::vector<AABB>& primBounds, const std::vector<rvec3>& centroids,
+		std::vector<PendingSubtree>* pending = nullptr, int subtreeSize = 0);
+	// Build the pending subtrees on a pool of threads (or on this one if numThreads is 1), each into its own list of
+	// nodes, then append those lists to nodeStorage in order. This gives the same nodes, in the same order, as building
+	// them one after the other
+	void BuildSubtrees(const std::vector<PendingSubtree>& pending, int numThreads,
+		const std::vector<AABB>& primBounds, const std::vector<rvec3>& centroids);
+	// Find the cheapest SAH split of the given primitive range, by sorting the centroids into bins along each axis of
+	// centroidBounds. Returns false if no split is cheaper than a leaf. outBin is the first bin on the right side of the
+	// split, or -1 to split the range in half along outAxis
+	bool FindBestSplit(int first, int count, const AABB& nodeBounds, const AABB& centroidBounds,
+		const std::vector<AABB>& primBounds, const std::vector<rvec3>& centroids, int& outAxis, int& outBin) const;
+
+	// Build the hierarchy from the primitives' Morton codes instead of the SAH
+	void BuildMorton(const std::vector<AABB>& primBounds, const std::vector<rvec3>& centroids);
+	// Split the primitives in [first, first + count) on the highest bit where their (sorted) Morton codes differ
+	void BuildMortonRecursive(int nodeIdx, int first, int count, int depth,
+		const std::vector<AABB>& primBounds, const std::vector<uint32_t>& codes);
+
+	// Point the node and index views at the arrays that Build filled in
+	void UseStorage();
+
+	// Nodes and primitive indices used by traversal, either owned by this BVH or loaded from elsewhere
+	ArrayView<BVHNode> nodes;
+	// Primitive indices, reordered during the build so that every leaf refers to a contiguous range
+	ArrayView<int> primIndices;
+	// Arrays filled in by Build (empty if the BVH was loaded)
+	std::vector<BVHNode> nodeStorage;
+	std::vector<int> primIndexStorage;
+	int maxLeafSize = 4;
+
+	// Max depth of the tree, which is also the size of the traversal stack
+	static constexpr int maxDepth = 64;
+};
+
+template<class IntersectFunc>
+inline bool BVH::TraverseClosest(const Ray3D& ray, Real tMin, Real tMax, IntersectFunc intersectPrim) const {
+	return TraverseClosestLeaves(ray, tMin, tMax, [&](int first, int count, Real leafTMin, Real& leafTMax) {
+		bool foundHit = false;
+		for (int i = first; i < first + count; i++) {
+			if (intersectPrim(primIndices[i], leafTMin, leafTMax)) {
+				foundHit = true;
+			}
+		}
+		return foundHit;
+	});
+}
+
+template<class OccludedFunc>
+inline bool BVH::TraverseAny(const Ray3D& ray, Real tMin, Real tMax, OccludedFunc occludedPrim) const {
+	return TraverseAnyLeaves(ray, tMin, tMax, [&](int first, int count, Real leafTMin, Real leafTMax) {
+		for (int i = first; i < first + count; i++) {
+			// Any hit is enough to block a shadow ray, no need to find the closest one
+			if (occludedPrim(primIndices[i], leafTMin, leafTMax)) return true;
+		}
+		return false;
+	});
+}
+
+template<class IntersectLeafFunc>
+inline bool BVH::TraverseClosestLeaves(const Ray3D& ray, Real tMin, Real tMax, IntersectLeafFunc intersectLeaf) const {
+	if (nodes.empty()) return false;
+	Real tEntry;
+	if (!nodes[0].bounds.IntersectRay(ray, tMin, tMax, tEntry)) return false;
+
+	bool foundHit = false;
+	int stack[maxDepth + 1];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const BVHNode& node = nodes[stack[--stackSize]];
+		// The closest hit may have moved in front of this node since it was pushed, so re-test it
+		if (!node.bounds.IntersectRay(ray, tMin, tMax, tEntry)) continue;
+
+		if (node.IsLeaf()) {
+			if (intersectLeaf(node.leftFirst, node.count, tMin, tMax)) {
+				foundHit = true;
+			}
+		}
+		else {
+			// Visit the nearer child first, so the closest hit shrinks tMax as early as possible
+			int left = node.leftFirst;
+			int right = node.leftFirst + 1;
+			Real tLeft, tRight;
+			bool hitLeft = nodes[left].bounds.IntersectRay(ray, tMin, tMax, tLeft);
+			bool hitRight = nodes[right].bounds.IntersectRay(ray, tMin, tMax, tRight);
+			if (hitLeft && hitRight) {
+				// Push the far child first so the near child is popped next
+				if (tLeft <= tRight) {
+					stack[stackSize++] = right;
+					stack[stackSize++] = left;
+				}
+				else {
+					stack[stackSize++] = left;
+					stack[stackSize++] = right;
+				}
+			}
+			else if (hitLeft) stack[stackSize++] = left;
+			else if (hitRight) stack[stackSize++] = right;
+		}
+	}
+	return foundHit;
+}
+
+template<class OccludedLeafFunc>
+inline bool BVH::TraverseAnyLeaves(const Ray3D& ray, Real tMin, Real tMax, OccludedLeafFunc occludedLeaf) const {
+	if (nodes.empty()) return false;
+	Real tEntry;
+	if (!nodes[0].bounds.IntersectRay(ray, tMin, tMax, tEntry)) return false;
+
+	// tMax never shrinks during an any-hit query, so children are tested once before they're pushed instead of again
+	// after they're popped, and only the ones that the ray actually overlaps go on the stack
+	int stack[maxDepth + 1];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const BVHNode& node = nodes[stack[--stackSize]];
+		if (node.IsLeaf()) {
+			if (occludedLeaf(node.leftFirst, node.count, tMin, tMax)) return true;
+		}
+		else {
+			// Visit the nearer child first. Occluders near the start of the ray are found without descending into the
+			// far side of the tree, and a ray that's blocked early never tests the rest of it
+			int left = node.leftFirst;
+			int right = node.leftFirst + 1;
+			Real tLeft, tRight;
+			bool hitLeft = nodes[left].bounds.IntersectRay(ray, tMin, tMax, tLeft);
+			bool hitRight = nodes[right].bounds.IntersectRay(ray, tMin, tMax, tRight);
+			if (hitLeft && hitRight) {
+				// Push the far child first so the near child is popped next
+				if (tLeft <= tRight) {
+					stack[stackSize++] = right;
+					stack[stackSize++] = left;
+				}
+				else {
+					stack[stackSize++] = left;
+					stack[stackSize++] = right;
+				}
+			}
+			else if (hitLeft) stack[stackSize++] = left;
+			else if (hitRight) stack[stackSize++] = right;
+		}
+	}
+	return false;
+}
+
+template<class PacketFunc>
+inline void BVH::TraversePacket(const RayPacket& packet, int activeMask, Real tMin, Real (&tMax)[packetSize],
+	PacketFunc intersectPrim) const {
+	if (nodes.empty() || activeMask == 0) return;
+
+	// Each stack entry also remembers which lanes overlapped its parent, since only those lanes can overlap the node
+	int stack[maxDepth + 1];
+	int stackMasks[maxDepth + 1];
+	int stackSize = 0;
+	stack[stackSize] = 0;
+	stackMasks[stackSize++] = activeMask;
+	Real tEntry[packetSize];
+	while (stackSize > 0) {
+		--stackSize;
+		const BVHNode& node = nodes[stack[stackSize]];
+		// Re-test the node, since closer hits may have been found since it was pushed
+		int nodeMask = node.bounds.IntersectPacket(packet, stackMasks[stackSize], tMin, tMax, tEntry);
+		if (nodeMask == 0) continue;
+
+		if (node.IsLeaf()) {
+			for (int i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+				intersectPrim(primIndices[i], nodeMask);
+			}
+		}
+		else {
+			// Order the children by the nearest entry distance of any lane that overlaps them
+			int left = node.leftFirst;
+			int right = node.leftFirst + 1;
+			Real tLeft[packetSize], tRight[packetSize];
+			int leftMask = nodes[left].bounds.IntersectPacket(packet, nodeMask, tMin, tMax, tLeft);
+			int rightMask = nodes[right].bounds.IntersectPacket(packet, nodeMask, tMin, tMax, tRight);
+			Real nearLeft = std::numeric_limits<Real>::max();
+			Real nearRight = std::numeric_limits<Real>::max();
+			for (int lane = 0; lane < packetSize; lane++) {
+				if (leftMask & (1 << lane)) nearLeft = std::min(nearLeft, tLeft[lane]);
+				if (rightMask & (1 << lane)) nearRight = std::min(nearRight, tRight[lane]);
+			}
+			// Push the far child first so the near child is popped next
+			bool leftFirst = nearLeft <= nearRight;
+			int first = leftFirst ? right : left;
+			int firstMask = leftFirst ? rightMask : leftMask;
+			int second = leftFirst ? left : right;
+			int secondMask = leftFirst ? leftMask : rightMask;
+			if (firstMask) {
+				stack[stackSize] = first;
+				stackMasks[stackSize++] = firstMask;
+			}
+			if (secondMask) {
+				stack[stackSize] = second;
+				stackMasks[stackSize++] = secondMask;
+			}
+		}
+	}
+}
+
+template<class PacketOccludedFunc>
+inline int BVH::TraversePacketAny(const RayPacket& packet, int activeMask, Real tMin, const Real (&tMax)[packetSize],
+	PacketOccludedFunc occludedPrim) const {
+	if (nodes.empty() || activeMask == 0) return 0;
+
+	// Like TraverseAnyLeaves, children are tested before they're pushed, and the stored masks are the lanes that
+	// overlap them. Only lanes that were blocked since a node was pushed need to be removed when it's popped
+	Real tEntry[packetSize];
+	int rootMask = nodes[0].bounds.IntersectPacket(packet, activeMask, tMin, tMax, tEntry);
+	if (rootMask == 0) return 0;
+	int blockedMask = 0;
+	int stack[maxDepth + 1];
+	int stackMasks[maxDepth + 1];
+	int stackSize = 0;
+	stack[stackSize] = 0;
+	stackMasks[stackSize++] = rootMask;
+	while (stackSize > 0) {
+		--stackSize;
+		const BVHNode& node = nodes[stack[stackSize]];
+		int nodeMask = stackMasks[stackSize] & ~blockedMask;
+		if (nodeMask == 0) continue;
+
+		if (node.IsLeaf()) {
+			for (int i = node.leftFirst; i < node.leftFirst + node.count && nodeMask != 0; i++) {
+				int primBlocked = occludedPrim(primIndices[i], nodeMask);
+				blockedMask |= primBlocked;
+				nodeMask &= ~primBlocked;
+			}
+			// Every shadow ray is blocked, no need to look any further
+			if ((blockedMask & activeMask) == activeMask) break;
+		}
+		else {
+			// Visit the child that the nearest lane enters first
+			int left = node.leftFirst;
+			int right = node.leftFirst + 1;
+			Real tLeft[packetSize], tRight[packetSize];
+			int leftMask = nodes[left].bounds.IntersectPacket(packet, nodeMask, tMin, tMax, tLeft);
+			int rightMask = nodes[right].bounds.IntersectPacket(packet, nodeMask, tMin, tMax, tRight);
+			Real nearLeft = std::numeric_limits<Real>::max();
+			Real nearRight = std::numeric_limits<Real>::max();
+			for (int lane = 0; lane < packetSize; lane++) {
+				if (leftMask & (1 << lane)) nearLeft = std::min(nearLeft, tLeft[lane]);
+				if (rightMask & (1 << lane)) nearRight = std::min(nearRight, tRight[lane]);
+			}
+			// Push the far child first so the near child is popped next
+			bool leftFirst = nearLeft <= nearRight;
+			int first = leftFirst ? right : left;
+			int firstMask = leftFirst ? rightMask : leftMask;
+			int second = leftFirst ? left : right;
+			int secondMask = leftFirst ? leftMask : rightMask;
+			if (firstMask) {
+				stack[stackSize] = first;
+				stackMasks[stackSize++] = firstMask;
+			}
+			if (secondMask) {
+				stack[stackSize] = second;
+				stackMasks[stackSize++] = secondMask;
+			}
+		}
+	}
+	return blockedMask & activeMask;
+}
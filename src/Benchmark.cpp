@@ -0,0 +1,139 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+#include "nlohmann/json.hpp"
+#include "Benchmark.h"
+#include "Scene.h"
+#include "Camera.h"
+#include "Image.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace glm;
+using json = nlohmann::json;
+
+// Scenes are rendered in this order, so results from different builds line up
+static const char* benchmarkScenes[] = { "bunny", "teapot", "cornell_boxes", "cornell_spheres", "reflections" };
+static const int benchmarkSize = 256;
+static const int benchmarkSamples = 16;
+
+// Largest amount of memory the process has used so far, in bytes
+static size_t GetPeakMemoryBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;
+#else
+	// Linux reports the max resident set size in kilobytes
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static double SecondsSince(chrono::time_point<chrono::steady_clock> startTime) {
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime).count() / 1e6;
+}
+
+bool RunBenchmark(const std::string& outputFile, RenderSettings settings) {
+	settings.width = benchmarkSize;
+	settings.height = benchmarkSize;
+	settings.numSamples = benchmarkSamples;
+
+	json results;
+	results["settings"] = {
+		{ "resolution", { settings.width, settings.height } },
+		{ "samplesPerPixel", settings.numSamples },
+		{ "seed", settings.seed },
+		{ "sampler", Sampler::GetTypeName(settings.samplerType) },
+		{ "threads", settings.numThreads },
+		{ "packets", settings.usePackets },
+		{ "wavefront", settings.useWavefront },
+		{ "lightSamples", settings.lightSamples },
+		{ "flatten", settings.flattenTransforms },
+		{ "fastBVH", settings.fastBVH },
+#ifdef RENDER_STATS
+		{ "detailedStats", true },
+#else
+		{ "detailedStats", false },
+#endif
+		{ "precision", (sizeof(Real) == sizeof(float)) ? "float" : "double" }
+	};
+	results["scenes"] = json::array();
+
+	bool success = true;
+	for (const char* sceneName : benchmarkScenes) {
+		cout << endl << "Benchmarking " << sceneName << endl;
+		auto loadStart = chrono::steady_clock::now();
+		Camera camera(settings.width, settings.height, rvec4(0, 0, -5, 1), rvec3(0, 0, 0), 45, 1.0);
+		Scene scene(dvec3(0, 0, 0));
+		BVHBuildMethod bvhMethod = settings.fastBVH ? BVHBuildMethod::MORTON : BVHBuildMethod::SAH;
+		if (!scene.BuildSceneFromFile("../resources/" + string(sceneName) + ".json", camera, settings.numThreads, bvhMethod)) {
+			success = false;
+			continue;
+		}
+		scene.SetLightSamples(settings.lightSamples);
+		if (settings.flattenTransforms) scene.FlattenTransforms();
+		double loadSeconds = SecondsSince(loadStart);
+
+		Image image(settings.width, settings.height);
+		Renderer renderer(scene, camera, settings);
+		renderer.Render(image);
+
+		const RenderStats& stats = renderer.GetStats();
+		double renderSeconds = renderer.GetRenderSeconds();
+		uint64_t totalRays = stats.GetTotalRays();
+		json sceneResult = {
+			{ "name", sceneName },
+			{ "loadSeconds", loadSeconds },
+			{ "bvhBuildSeconds", scene.GetBVHBuildSeconds() },
+			{ "renderSeconds", renderSeconds },
+			{ "primaryRays", stats.primaryRays },
+			{ "bounceRays", stats.bounceRays },
+			{ "shadowRays", stats.shadowRays },
+			{ "raysPerSecond", totalRays / std::max(renderSeconds, 1e-6) },
+			{ "objectTestsPerRay", stats.objectTests / (double)std::max<uint64_t>(totalRays, 1) },
+			{ "triangleTestsPerRay", stats.triangleTests / (double)std::max<uint64_t>(totalRays, 1) },
+			{ "testsPerRay", stats.GetTotalTests() / (double)std::max<uint64_t>(totalRays, 1) },
+			// The peak only ever grows, so this is the most memory used by any scene up to (and including) this one
+			{ "peakMemoryBytes", GetPeakMemoryBytes() }
+		};
+#ifdef RENDER_STATS
+		json testsByType;
+		for (int i = 0; i < (int)ObjectType::COUNT; i++) {
+			testsByType[GetObjectTypeName((ObjectType)i)] = stats.objectTestsByType[i];
+		}
+		sceneResult["objectTestsByType"] = testsByType;
+		sceneResult["boxTests"] = stats.boxTests;
+		sceneResult["boxRejects"] = stats.boxRejects;
+		sceneResult["rouletteTests"] = stats.rouletteTests;
+		sceneResult["rouletteTerminations"] = stats.rouletteTerminations;
+		sceneResult["pathLengths"] = vector<uint64_t>(stats.pathLengths + 1, stats.pathLengths + RenderStats::maxPathLength + 1);
+#endif
+		results["scenes"].push_back(sceneResult);
+		cout << sceneName << ": " << renderSeconds << " s, " << sceneResult["raysPerSecond"].get<double>() / 1e6;
+		cout << " Mrays/s, " << sceneResult["testsPerRay"].get<double>() << " tests per ray" << endl;
+	}
+
+	ofstream file(outputFile);
+	if (!file.good()) {
+		cerr << "ERROR: Unable to open " << outputFile << " for writing" << endl;
+		return false;
+	}
+	file << setw(2) << results << endl;
+	cout << endl << "Wrote benchmark results to " << outputFile << endl;
+	return success;
+}
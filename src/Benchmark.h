@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+#include "Renderer.h"
+
+// Render every benchmark scene in resources/ with a fixed image size, sample count and seed, and save the wall time,
+// rays/sec, intersection tests per ray and peak memory of each one to a JSON file (i.e. to compare builds or
+// acceleration structures). Other settings (threads, packets, sampler...) are taken from settings
+// Returns false if a scene failed to load or the results couldn't be saved
+bool RunBenchmark(const std::string& outputFile, RenderSettings settings);
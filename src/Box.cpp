@@ -4,25 +4,48 @@
 using namespace std;
 using namespace glm;
 
-bool Box::IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax) {
+Box::Box(std::string _name, Transform _transf, const Material* _mat) :
+	SceneObject(_name, _transf, _mat, ObjectType::BOX) {
+	hasRandomPointMethodDefined = true;
+	UpdateTransformedData();
+}
+
+void Box::UpdateTransformedData() {
+	area = 0;
+	rvec3 extent = bounds.max - bounds.min;
+	for (int axis = 0; axis < 3; axis++) {
+		// The face's two edges, moved to world space. Transforms are affine, so each face stays a parallelogram
+		rvec4 edgeU(0.0), edgeV(0.0);
+		edgeU[(axis + 1) % 3] = extent[(axis + 1) % 3];
+		edgeV[(axis + 2) % 3] = extent[(axis + 2) % 3];
+		faceAreas[axis] = length(cross(dvec3(modelMtx * edgeU), dvec3(modelMtx * edgeV)));
+		area += 2 * faceAreas[axis];
+	}
+	areaPdf = (area > 0) ? 1.0 / area : 0.0;
+}
+
+bool Box::IntersectLocal(Ray3D& ray, HitResult& outHit, Real tMin, Real tMax) {
 	// Optimized ray-box intersection adapted from http://people.csail.mit.edu/amy/papers/box-jgt.pdf
 
-	// Assume box is at the origin, axis-aligned, with bounds from -0.5 to 0.5 in x, y, and z
+	// The box is axis-aligned in the ray's space, with the extent stored in bounds
 	// tvals[0] corresponds to the closer hit, tvals[1] is the farther one
-	double tvals[2];
+	Real tvals[2];
 	// The normals of each the side of the box that each tval corresponds to
-	dvec4 normals[2];
+	rvec4 normals[2];
+
+	// Swap the negative/positive bounds when the ray direction is negative (since far/near sides will be swapped)
+	auto nearSide = [&](int axis) { return (ray.sign[axis] > 0) ? bounds.min[axis] : bounds.max[axis]; };
+	auto farSide = [&](int axis) { return (ray.sign[axis] > 0) ? bounds.max[axis] : bounds.min[axis]; };
 
 	// Start with the t values & normals from x-axis intersections
-	// Flip sign of the negative/positive bounds when the ray direction is negative (since far/near sides will be swapped)
-	tvals[0] = ((-0.5 * ray.sign[0]) - ray.start.x) * ray.invDir.x;
-	tvals[1] = (( 0.5 * ray.sign[0]) - ray.start.x) * ray.invDir.x;
-	normals[0] = (double)ray.sign[0] * dvec4(-1, 0, 0, 0);
-	normals[1] = (double)ray.sign[0] * dvec4( 1, 0, 0, 0);
+	tvals[0] = (nearSide(0) - ray.start.x) * ray.invDir.x;
+	tvals[1] = (farSide(0) - ray.start.x) * ray.invDir.x;
+	normals[0] = (Real)ray.sign[0] * rvec4(-1, 0, 0, 0);
+	normals[1] = (Real)ray.sign[0] * rvec4( 1, 0, 0, 0);
 
 	// Find min/max t in y direction
-	double tymin = ((-0.5 * ray.sign[1]) - ray.start.y) * ray.invDir.y;
-	double tymax = (( 0.5 * ray.sign[1]) - ray.start.y) * ray.invDir.y;
+	Real tymin = (nearSide(1) - ray.start.y) * ray.invDir.y;
+	Real tymax = (farSide(1) - ray.start.y) * ray.invDir.y;
 
 	// If new y min/max are completely outside the current t min/max, return false immediately
 	if ((tvals[0] > tymax) || (tymin > tvals[1])) {
@@ -32,26 +55,26 @@ bool Box::IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax
 	if (tymin > tvals[0]) {
 		tvals[0] = tymin;
 		// If a new tval is found, update the corresponding normal as well
-		normals[0] = (double)ray.sign[1] * dvec4(0, -1, 0, 0);
+		normals[0] = (Real)ray.sign[1] * rvec4(0, -1, 0, 0);
 	}
 	if (tymax < tvals[1]) {
 		tvals[1] = tymax;
-		normals[1] = (double)ray.sign[1] * dvec4(0, 1, 0, 0);
+		normals[1] = (Real)ray.sign[1] * rvec4(0, 1, 0, 0);
 	}
 
 	// Repeat the same process as above, but with the z direction
-	double tzmin = ((-0.5 * ray.sign[2]) - ray.start.z) * ray.invDir.z;
-	double tzmax = (( 0.5 * ray.sign[2]) - ray.start.z) * ray.invDir.z;
+	Real tzmin = (nearSide(2) - ray.start.z) * ray.invDir.z;
+	Real tzmax = (farSide(2) - ray.start.z) * ray.invDir.z;
 	if ((tvals[0] > tzmax) || (tzmin > tvals[1])) {
 		return false;
 	}
 	if (tzmin > tvals[0]) {
 		tvals[0] = tzmin;
-		normals[0] = (double)ray.sign[2] * dvec4(0, 0, -1, 0);
+		normals[0] = (Real)ray.sign[2] * rvec4(0, 0, -1, 0);
 	}
 	if (tzmax < tvals[1]) {
 		tvals[1] = tzmax;
-		normals[1] = (double)ray.sign[2] * dvec4(0, 0, 1, 0);
+		normals[1] = (Real)ray.sign[2] * rvec4(0, 0, 1, 0);
 	}
 
 	// Choose the smallest t value within the valid range, and choose the corresponding normal
@@ -71,11 +94,115 @@ bool Box::IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax
 	return false;
 }
 
-glm::dvec4 Box::GetRandomPointOnSurface(double& pdf, dvec4& normal)
+bool Box::IntersectLocalAny(Ray3D& ray, Real tMin, Real tMax) {
+	// Plain slab test: there's no normal to find, so there's no need to keep track of which face each t value is on
+	Real tNear = -std::numeric_limits<Real>::max();
+	Real tFar = std::numeric_limits<Real>::max();
+	for (int axis = 0; axis < 3; axis++) {
+		Real t0 = (bounds.min[axis] - ray.start[axis]) * ray.invDir[axis];
+		Real t1 = (bounds.max[axis] - ray.start[axis]) * ray.invDir[axis];
+		tNear = std::max(tNear, std::min(t0, t1));
+		tFar = std::min(tFar, std::max(t0, t1));
+	}
+	if (tNear > tFar) return false;
+	return (tNear > tMin && tNear < tMax) || (tFar > tMin && tFar < tMax);
+}
+
+int Box::IntersectLocalPacket(const RayPacket& packet, int activeMask, HitResult* outHits, Real tMin) {
+	SimdReal tNear, tFar;
+	SlabTestPacket(packet, tNear, tFar);
+
+	// Same as SelectSmallestInRange: use the entry point if it's in range, otherwise the exit point (ray starts inside)
+	Real curT[packetSize];
+	for (int lane = 0; lane < packetSize; lane++) curT[lane] = outHits[lane].t;
+	SimdReal tMinVec = SimdReal::Broadcast(tMin);
+	SimdReal tMaxVec = SimdReal::Load(curT);
+	SimdReal nearValid = And(CmpGt(tNear, tMinVec), CmpLt(tNear, tMaxVec));
+	SimdReal farValid = And(CmpGt(tFar, tMinVec), CmpLt(tFar, tMaxVec));
+	SimdReal tHit = Select(nearValid, tNear, tFar);
+	int hitMask = MoveMask(And(CmpLe(tNear, tFar), Or(nearValid, farValid))) & activeMask;
+
+	Real tVals[packetSize];
+	tHit.Store(tVals);
+	for (int lane = 0; lane < packetSize; lane++) {
+		if (!(hitMask & (1 << lane))) continue;
+		outHits[lane].t = tVals[lane];
+		// The face that was hit is the one on the axis where the hit position is farthest from the center, relative to
+		// the size of the box on that axis
+		rvec3 offset = rvec3(packet.GetRay(lane).FindLocAtTime(tVals[lane])) - bounds.Centroid();
+		rvec3 absPos = abs(offset / (bounds.max - bounds.min));
+		int axis = (absPos.x > absPos.y) ? ((absPos.x > absPos.z) ? 0 : 2) : ((absPos.y > absPos.z) ? 1 : 2);
+		rvec4 normal(0.0);
+		normal[axis] = (offset[axis] < 0) ? -1.0 : 1.0;
+		outHits[lane].nor = normal;
+	}
+	return hitMask;
+}
+
+int Box::IntersectLocalAnyPacket(const RayPacket& packet, int activeMask, Real tMin,
+	const Real (&tMax)[packetSize]) {
+	SimdReal tNear, tFar;
+	SlabTestPacket(packet, tNear, tFar);
+	SimdReal tMinVec = SimdReal::Broadcast(tMin);
+	SimdReal tMaxVec = SimdReal::Load(tMax);
+	SimdReal nearValid = And(CmpGt(tNear, tMinVec), CmpLt(tNear, tMaxVec));
+	SimdReal farValid = And(CmpGt(tFar, tMinVec), CmpLt(tFar, tMaxVec));
+	return MoveMask(And(CmpLe(tNear, tFar), Or(nearValid, farValid))) & activeMask;
+}
+
+void Box::SlabTestPacket(const RayPacket& packet, SimdReal& tNear, SimdReal& tFar) const {
+	// Min/Max replace the per-axis sign swaps from IntersectLocal
+	tNear = SimdReal::Broadcast(-std::numeric_limits<Real>::max());
+	tFar = SimdReal::Broadcast(std::numeric_limits<Real>::max());
+	for (int axis = 0; axis < 3; axis++) {
+		SimdReal start = SimdReal::Load(packet.start[axis]);
+		SimdReal invDir = SimdReal::Load(packet.invDir[axis]);
+		SimdReal t0 = (SimdReal::Broadcast(bounds.min[axis]) - start) * invDir;
+		SimdReal t1 = (SimdReal::Broadcast(bounds.max[axis]) - start) * invDir;
+		tNear = Max(Min(t0, t1), tNear);
+		tFar = Min(Max(t0, t1), tFar);
+	}
+}
+
+rvec4 Box::GetRandomPointOnSurface(const rvec4& refPoint, const glm::dvec2& u, double& pdf, rvec4& normal)
 {
-	return transf.translation;
+	pdf = areaPdf;
+	// Walk through the 6 faces until u.x lands in one, then rescale what's left of u.x to [0, 1) for the position on it
+	double faceU = u.x * area;
+	int face = 0;
+	while (face < 5 && faceU >= faceAreas[face / 2]) {
+		faceU -= faceAreas[face / 2];
+		face++;
+	}
+	int axis = face / 2;
+	faceU = std::min(std::max(faceU / faceAreas[axis], 0.0), 1.0);
+
+	// Even faces are on the min side of their axis, odd faces are on the max side
+	rvec4 localPoint(0, 0, 0, 1);
+	localPoint[axis] = (face % 2 == 0) ? bounds.min[axis] : bounds.max[axis];
+	int axisU = (axis + 1) % 3;
+	int axisV = (axis + 2) % 3;
+	localPoint[axisU] = mix(bounds.min[axisU], bounds.max[axisU], Real(faceU));
+	localPoint[axisV] = mix(bounds.min[axisV], bounds.max[axisV], Real(u.y));
+	rvec4 localNormal(0.0);
+	localNormal[axis] = (face % 2 == 0) ? -1.0 : 1.0;
+
+	// The matrices are the identity once the box is flattened
+	normal = invTranspMtx * localNormal;
+	normal.w = 0.0;
+	normal = normalize(normal);
+	return modelMtx * localPoint;
+}
+
+AABB Box::GetLocalBounds() const {
+	return bounds;
 }
 
-bool Box::IsInUnitSquare(const glm::vec4& v) const {
-	return (v.x > -0.5 && v.x < 0.5) && (v.z > -0.5 && v.z < 0.5);
+bool Box::Flatten() {
+	// Rotated boxes keep transforming rays into their local space, where they are still axis-aligned
+	if (transf.rotation != rvec3(0)) return false;
+	// Scales and translations keep the faces axis-aligned, so the local normals are also the world-space ones
+	bounds = GetWorldBounds();
+	UseWorldSpace();
+	return true;
 }
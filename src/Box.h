@@ -10,13 +10,36 @@
 
 class Box : public SceneObject {
 public:
-	// Call parent constructor to create transform matrix and apply material
-	Box(std::string _name, Transform _transf, std::shared_ptr<Material> _mat) : SceneObject(_name, _transf, _mat) {};
+	// Call parent constructor to create transform matrix and apply material, then cache the data used for light sampling
+	Box(std::string _name, Transform _transf, const Material* _mat);
 
-	bool IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax) override;
-	glm::dvec4 GetRandomPointOnSurface(double& pdf, glm::dvec4& normal) override;
+	bool IntersectLocal(Ray3D& ray, HitResult& outHit, Real tMin, Real tMax) override;
+	bool IntersectLocalAny(Ray3D& ray, Real tMin, Real tMax) override;
+	int IntersectLocalPacket(const RayPacket& packet, int activeMask, HitResult* outHits, Real tMin) override;
+	int IntersectLocalAnyPacket(const RayPacket& packet, int activeMask, Real tMin,
+		const Real (&tMax)[packetSize]) override;
+	// Chooses a face in proportion to its world-space area, then a uniform point on it
+	rvec4 GetRandomPointOnSurface(const rvec4& refPoint, const glm::dvec2& u, double& pdf, rvec4& normal) override;
+	// Points are chosen uniformly over the whole surface, so every point has the same density
+	double GetSurfacePdf(const rvec4& refPoint, const rvec4& point) const override { return areaPdf; }
+	double GetSurfaceArea() const override { return area; }
+	AABB GetLocalBounds() const override;
+	// Only boxes without any rotation can be flattened, since they need to stay axis-aligned in world space
+	bool Flatten() override;
 
 private:
-	// Check if the given value is between -0.5 and 0.5
-	bool IsInUnitSquare(const glm::vec4& v) const;
+	// Measure the world-space area of each face
+	void UpdateTransformedData() override;
+	// Slab test for every lane of the packet. Lanes that cross the box have tNear <= tFar
+	void SlabTestPacket(const RayPacket& packet, SimdReal& tNear, SimdReal& tFar) const;
+
+	// Extent of the box in the same space as the rays it's tested against: -0.5 to 0.5 on every axis in local space,
+	// or the world-space bounds once the box has been flattened
+	AABB bounds = AABB(rvec3(-0.5, -0.5, -0.5), rvec3(0.5, 0.5, 0.5));
+	// World-space area of the faces on the min and max side of each axis (both sides have the same area), and their total
+	// Flattening doesn't change the box's world-space shape, so these don't need to be updated
+	double faceAreas[3] = { 0, 0, 0 };
+	double area = 0;
+	// 1 / area, the density of every surface sample
+	double areaPdf = 0;
 };
\ No newline at end of file
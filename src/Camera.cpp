@@ -5,7 +5,7 @@
 using namespace glm;
 using namespace std;
 
-dvec3 Camera::ClampColor(glm::dvec3& color) {
+dvec3 Camera::ClampColor(const glm::dvec3& color) {
 	return dvec3(
 		ClampDouble(color.x, 0.0, 1.0),
 		ClampDouble(color.y, 0.0, 1.0),
@@ -14,10 +14,10 @@ dvec3 Camera::ClampColor(glm::dvec3& color) {
 
 }
 
-Camera::Camera(int imageWidth, int imageHeight, glm::dvec4 _pos, glm::dvec3 _rot, double _fov, double _exposure) :
+Camera::Camera(int imageWidth, int imageHeight, rvec4 _pos, rvec3 _rot, double _fov, double _exposure) :
 	imageWidth(imageWidth),
 	imageHeight(imageHeight),
-	aspect(imageWidth / (double)imageHeight),
+	aspect(Real(imageWidth / (double)imageHeight)),
 	pos(_pos),
 	rot(_rot),
 	exposure(_exposure)
@@ -25,21 +25,21 @@ Camera::Camera(int imageWidth, int imageHeight, glm::dvec4 _pos, glm::dvec3 _rot
 	Setup();
 }
 
-Ray3D Camera::CreateCameraRay(int rowNum, int colNum) {
+Ray3D Camera::CreateCameraRay(int rowNum, int colNum, const glm::dvec2& jitter) const {
 	// u and v are in normalized image coords, -1 to 1
-	double v = (2.0 * ((double)rowNum + (rand() / (double)RAND_MAX)) / (double)imageHeight) - 1.0;
-	double u = (2.0 * ((double)colNum + (rand() / (double)RAND_MAX)) / (double)imageWidth) - 1.0;
-	dvec4 rayDir = normalize(dvec4(u * aspect, v, -1.0 * imagePlaneDist, 0.0f));
+	double v = (2.0 * ((double)rowNum + jitter.y) / (double)imageHeight) - 1.0;
+	double u = (2.0 * ((double)colNum + jitter.x) / (double)imageWidth) - 1.0;
+	rvec4 rayDir = normalize(rvec4(u * aspect, v, -imagePlaneDist, 0));
 	rayDir = rayDir * inv_rotMtx;
 	return Ray3D(pos, rayDir);
 }
 
 void Camera::Setup() {
-	imagePlaneDist = 1.0 / tan(fovY / 2.0);
+	imagePlaneDist = Real(1.0 / tan(fovY / 2.0));
 	inv_rotMtx = inverse(eulerAngleXYZ(rot.x, rot.y, rot.z));
 }
 
-dvec3 Camera::ApplyTonemapping(glm::dvec3& color, Tonemapper tonemapper)
+dvec3 Camera::ApplyTonemapping(const glm::dvec3& color, Tonemapper tonemapper)
 {
 	switch (tonemapper) {
 	case Tonemapper::ACES_APPROX:
@@ -52,7 +52,7 @@ dvec3 Camera::ApplyTonemapping(glm::dvec3& color, Tonemapper tonemapper)
 	}
 }
 
-dvec3 Camera::ColorLinearToSRGB(glm::dvec3& linearColor)
+dvec3 Camera::ColorLinearToSRGB(const glm::dvec3& linearColor)
 {
 	return dvec3(
 		DoubleLinearToSRGB(linearColor.x),
@@ -61,7 +61,7 @@ dvec3 Camera::ColorLinearToSRGB(glm::dvec3& linearColor)
 	);
 }
 
-dvec3 Camera::ColorSRGBToLinear(glm::dvec3& srgbColor)
+dvec3 Camera::ColorSRGBToLinear(const glm::dvec3& srgbColor)
 {
 	return dvec3(
 		DoubleSRGBToLinear(srgbColor.x),
@@ -98,7 +98,7 @@ double Camera::ClampDouble(double num, double min, double max) {
 	return num;
 }
 
-dvec3 Camera::ACESApprox(glm::dvec3& color)
+dvec3 Camera::ACESApprox(const glm::dvec3& color)
 {
 	// Using an approximation of the ACES curve by Krzysztof Narkowicz https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
 	double a = 2.51;
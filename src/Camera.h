@@ -4,6 +4,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/euler_angles.hpp>
 #include <glm/ext/scalar_constants.hpp>
+#include "Real.h"
 #include "Ray3D.h"
 
 class Camera {
@@ -16,43 +17,49 @@ public:
 	
 	// Location, rotation, and fov args are optional, usually set by reading a scene file. FOV is in degrees
 	Camera(int imageWidth, int imageHeight,
-		glm::dvec4 _pos = glm::dvec4(0, 0, 5, 1), 
-		glm::dvec3 _rot = glm::dvec3(0, 0, 0), 
+		rvec4 _pos = rvec4(0, 0, 5, 1), 
+		rvec3 _rot = rvec3(0, 0, 0), 
 		double _fov = 45.0, 
 		double _exposure = 1.0);
 
-	// Create a ray from the camera position to the center of a given pixel
-	Ray3D CreateCameraRay(int rowNum, int colNum);
+	// Create a ray from the camera position through a given pixel. jitter is the position within the pixel, from 0 to 1
+	// (for antialiasing)
+	Ray3D CreateCameraRay(int rowNum, int colNum, const glm::dvec2& jitter) const;
 	
 	// Create a transformation matrix from the pos/rot, and calculate the image plane distance
 	void Setup();
 
 	// Setter functions - NOTE: need to call Setup after running any of these
-	void SetPosition(glm::dvec4& _pos) { pos = _pos; }
-	void SetRotationDegrees(glm::dvec3& _rot) { rot = _rot * glm::pi<double>() / 180.0; }
-	void SetFOVDegrees(double _fov) { fovY = _fov * glm::pi<double>() / 180.0; }
+	void SetPosition(const rvec4& _pos) { pos = _pos; }
+	void SetRotationDegrees(const rvec3& _rot) { rot = _rot * glm::pi<Real>() / Real(180.0); }
+	void SetFOVDegrees(double _fov) { fovY = Real(_fov * glm::pi<double>() / 180.0); }
+	void SetImageSize(int width, int height) {
+		imageWidth = width;
+		imageHeight = height;
+		aspect = Real(width / (double)height);
+	}
 	
-	double GetExposure() { return exposure; }
-	static glm::dvec3 ApplyTonemapping(glm::dvec3& color, Tonemapper tonemapper);
-	static glm::dvec3 ColorLinearToSRGB(glm::dvec3& linearColor);
-	static glm::dvec3 ColorSRGBToLinear(glm::dvec3& srgbColor);
+	double GetExposure() const { return exposure; }
+	static glm::dvec3 ApplyTonemapping(const glm::dvec3& color, Tonemapper tonemapper);
+	static glm::dvec3 ColorLinearToSRGB(const glm::dvec3& linearColor);
+	static glm::dvec3 ColorSRGBToLinear(const glm::dvec3& srgbColor);
 
 private:
 	static double DoubleLinearToSRGB(double val);
 	static double DoubleSRGBToLinear(double val);
 	static double ClampDouble(double num, double min, double max);
-	static glm::dvec3 ACESApprox(glm::dvec3& color);
-	static glm::dvec3 ClampColor(glm::dvec3& color);
+	static glm::dvec3 ACESApprox(const glm::dvec3& color);
+	static glm::dvec3 ClampColor(const glm::dvec3& color);
 
 
-	glm::dvec4 pos;
-	glm::dvec3 rot;
+	rvec4 pos;
+	rvec3 rot;
 	// Don't need to store the whole view mtx, only the inverse mtx for rotations
-	glm::dmat4 inv_rotMtx;
-	double fovY;
-	double aspect;
+	rmat4 inv_rotMtx;
+	Real fovY;
+	Real aspect;
 	int imageWidth;
 	int imageHeight;
-	double imagePlaneDist;
+	Real imagePlaneDist;
 	double exposure;
 };
\ No newline at end of file
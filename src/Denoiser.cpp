@@ -0,0 +1,141 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include "Denoiser.h"
+#include "ThreadPool.h"
+
+using namespace std;
+using namespace glm;
+
+// Albedo channels below this are treated as black, and left out of the demodulation (the pixel's color can only come
+// from emission there, which shouldn't be divided by ~0)
+static constexpr float minAlbedo = 1e-3f;
+// Rows of the image that each filter task works on
+static constexpr int rowsPerTask = 16;
+
+static float Luminance(const vec3& color) {
+	return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+}
+
+// Run rowTask(row) on every row of the image, spread over the pool's threads
+template<typename RowTask>
+static void ForEachRow(ThreadPool& pool, int height, const RowTask& rowTask) {
+	for (int first = 0; first < height; first += rowsPerTask) {
+		int last = std::min(first + rowsPerTask, height);
+		pool.Submit([first, last, &rowTask]() {
+			for (int row = first; row < last; row++) rowTask(row);
+		});
+	}
+	pool.WaitAll();
+}
+
+Image Denoise(const Image& color, const Image& albedo, const Image& normal, const vector<float>& variance,
+	const DenoiseSettings& settings) {
+	int width = color.getWidth();
+	int height = color.getHeight();
+	size_t numPixels = (size_t)width * height;
+	ThreadPool pool(settings.numThreads);
+
+	// Divide out the albedo, so the filter only has to smooth lighting (which varies slowly) instead of surface colors
+	vector<vec3> divisors(numPixels), lighting(numPixels), normals(numPixels);
+	vector<float> lightingVariance(numPixels);
+	ForEachRow(pool, height, [&](int row) {
+		for (int col = 0; col < width; col++) {
+			size_t idx = (size_t)row * width + col;
+			vec3 pixelAlbedo = albedo.getPixel(col, row);
+			vec3 divisor;
+			for (int c = 0; c < 3; c++) divisor[c] = (pixelAlbedo[c] > minAlbedo) ? pixelAlbedo[c] : 1.0f;
+			divisors[idx] = divisor;
+			lighting[idx] = color.getPixel(col, row) / divisor;
+			float lumDivisor = Luminance(divisor);
+			lightingVariance[idx] = variance[idx] / (lumDivisor * lumDivisor);
+			// Averaged normals are shorter than 1, and pixels that only saw the background have none at all
+			vec3 pixelNormal = normal.getPixel(col, row);
+			float len = length(pixelNormal);
+			normals[idx] = (len > 1e-6f) ? pixelNormal / len : vec3(0);
+		}
+	});
+
+	// B3 spline, the 1D weights of the 5x5 a-trous kernel
+	const float kernel[5] = { 1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16 };
+	const float colorSigma = (float)settings.colorSigma;
+	const float normalPower = (float)settings.normalPower;
+	const float invAlbedoSigmaSqr = 1.0f / (float)(settings.albedoSigma * settings.albedoSigma);
+	vector<vec3> nextLighting(numPixels);
+	vector<float> nextVariance(numPixels), blurredVariance(numPixels);
+	for (int iteration = 0; iteration < settings.iterations; iteration++) {
+		int step = 1 << iteration;
+
+		// A single pixel's variance is itself noisy, so judge the color differences by a slightly blurred version of it
+		ForEachRow(pool, height, [&](int row) {
+			for (int col = 0; col < width; col++) {
+				float sum = 0, weightSum = 0;
+				for (int dy = -1; dy <= 1; dy++) {
+					int y = row + dy;
+					if (y < 0 || y >= height) continue;
+					for (int dx = -1; dx <= 1; dx++) {
+						int x = col + dx;
+						if (x < 0 || x >= width) continue;
+						float weight = kernel[2 + dx] * kernel[2 + dy];
+						sum += weight * lightingVariance[(size_t)y * width + x];
+						weightSum += weight;
+					}
+				}
+				blurredVariance[(size_t)row * width + col] = sum / weightSum;
+			}
+		});
+
+		ForEachRow(pool, height, [&](int row) {
+			for (int col = 0; col < width; col++) {
+				size_t idx = (size_t)row * width + col;
+				const vec3& centerNormal = normals[idx];
+				const vec3& centerAlbedo = albedo.getPixel(col, row);
+				float centerLum = Luminance(lighting[idx]);
+				// Differences smaller than the noise get blurred away, larger ones are treated as real detail
+				float lumScale = colorSigma * std::sqrt(std::max(blurredVariance[idx], 0.0f)) + 1e-6f;
+
+				vec3 sum(0);
+				float varianceSum = 0, weightSum = 0;
+				for (int dy = -2; dy <= 2; dy++) {
+					int y = row + dy * step;
+					if (y < 0 || y >= height) continue;
+					for (int dx = -2; dx <= 2; dx++) {
+						int x = col + dx * step;
+						if (x < 0 || x >= width) continue;
+						size_t tapIdx = (size_t)y * width + x;
+
+						const vec3& tapNormal = normals[tapIdx];
+						float normalWeight = 1.0f;
+						// Background pixels only blur with each other
+						if (centerNormal != vec3(0) || tapNormal != vec3(0)) {
+							normalWeight = std::pow(std::max(0.0f, dot(centerNormal, tapNormal)), normalPower);
+						}
+						vec3 albedoDiff = albedo.getPixel(x, y) - centerAlbedo;
+						float albedoWeight = std::exp(-dot(albedoDiff, albedoDiff) * invAlbedoSigmaSqr);
+						float lumWeight = std::exp(-std::abs(Luminance(lighting[tapIdx]) - centerLum) / lumScale);
+
+						float weight = kernel[2 + dx] * kernel[2 + dy] * normalWeight * albedoWeight * lumWeight;
+						sum += weight * lighting[tapIdx];
+						// The filtered value's variance, assuming that the pixels' noise is independent
+						varianceSum += weight * weight * lightingVariance[tapIdx];
+						weightSum += weight;
+					}
+				}
+				// The center tap always has a nonzero weight, so weightSum can't be 0
+				nextLighting[idx] = sum / weightSum;
+				nextVariance[idx] = varianceSum / (weightSum * weightSum);
+			}
+		});
+		lighting.swap(nextLighting);
+		lightingVariance.swap(nextVariance);
+	}
+
+	Image result(width, height);
+	for (int row = 0; row < height; row++) {
+		for (int col = 0; col < width; col++) {
+			size_t idx = (size_t)row * width + col;
+			result.setPixel(col, row, lighting[idx] * divisors[idx]);
+		}
+	}
+	return result;
+}
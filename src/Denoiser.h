@@ -0,0 +1,29 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "Image.h"
+
+// Options for Denoise
+struct DenoiseSettings {
+	// Number of filter passes. Each pass doubles the spacing between the filter's taps, so 5 passes blur over a radius
+	// of about 64 pixels
+	int iterations = 5;
+	// Luminance difference (in standard deviations of the pixels' noise) that stops the blur. Higher = smoother
+	double colorSigma = 4.0;
+	// Exponent on the cosine between two normals: higher values keep the blur from crossing softer creases
+	double normalPower = 128.0;
+	// Albedo difference that stops the blur
+	double albedoSigma = 0.1;
+	// Threads to filter on, <= 0 uses one thread per hardware core
+	int numThreads = 0;
+};
+
+// Remove the noise from a rendered image with an edge-avoiding a-trous wavelet filter (Dammertz et al. 2010,
+// https://jo.dreggn.org/home/2010_atrous.pdf). Pixels are only blurred together if they have similar normals and albedo,
+// and if their colors are within the noise that each pixel's variance predicts (as in SVGF, Schied et al. 2017)
+// The albedo is divided out before filtering and multiplied back in afterwards, so surface colors stay sharp
+// albedo and normal are the per-pixel averages of each sample's first hit, and variance is the variance of each pixel's
+// mean luminance, row by row. Returns the filtered image
+Image Denoise(const Image& color, const Image& albedo, const Image& normal, const std::vector<float>& variance,
+	const DenoiseSettings& settings = DenoiseSettings());
@@ -10,43 +10,29 @@
 class EmissiveLight : public Light {
 public:
 	// Call parent constructor
-	EmissiveLight(std::string _name, double _L, double _Q, double _falloffDistance, std::shared_ptr<SceneObject> _obj) :
+	EmissiveLight(std::string _name, double _L, double _Q, double _falloffDistance, SceneObject* _obj) :
 		Light(_name, _L, _Q, _falloffDistance),
-		obj(_obj),
-		sampledLocation(_obj->GetLocation()) {}
+		obj(_obj) {}
 
-	double RandomizeLocation() override {
-		// initialize pdf as 1.0, in case the obj doesn't have a randomization point method defined
-		double pdf = 1.0;
-		// Store the location and normal of the point that was chosen, used for sampling the light
-		sampledLocation = obj->GetRandomPointOnSurface(pdf, sampledNormal);
-		return pdf;
+	LightType GetType() const override {
+		return LightType::EMISSIVE;
 	}
 
-	glm::dvec4 GetLocation() override {
-		return sampledLocation;
-	}
-
-	glm::dvec3 SampleLight(glm::dvec4 hitLocation) override {
-		glm::dvec4 hitVector = hitLocation - sampledLocation;
-		double distance = glm::length(hitVector);
-		hitVector = glm::normalize(hitVector);
-		// Treat this object as a surface that evenly emits light in all directions, attenuated by the angle btwn the surface normal and ray
-		double orientationAttenuation = std::max(0.0, glm::dot(hitVector, sampledNormal));
-		return GetColor() * orientationAttenuation * GetDistanceAttenuation(distance);
-	}
-
-	std::shared_ptr<SceneObject> GetObject() override {
+	SceneObject* GetObject() const override {
 		return obj;
 	}
 
-	glm::dvec3 GetColor() override {
+	glm::dvec3 GetColor() const override {
 		return obj->GetMaterial()->ke;
 	}
 
+	double GetEmittedPower() const override {
+		// Objects without a sampling method are lit from their origin, so treat them like a point light (area of 1)
+		double area = obj->hasRandomPointMethodDefined ? obj->GetSurfaceArea() : 1.0;
+		return Luminance(GetColor()) * area;
+	}
+
 private:
-	std::shared_ptr<SceneObject> obj = nullptr;
-	// The most recently sampled random location of this light source
-	glm::dvec4 sampledLocation;
-	glm::dvec4 sampledNormal;
+	// Owned by the scene, like the light itself
+	SceneObject* obj = nullptr;
 };
\ No newline at end of file
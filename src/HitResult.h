@@ -2,16 +2,19 @@
 
 #include <glm/glm.hpp>
 #include <memory>
+#include <limits>
+#include "Real.h"
 
 // Forward declare SceneObject since I need to make a ptr to it
 class SceneObject;
 struct HitResult {
-	// Initilialize as largest possible double value
-	double t = std::numeric_limits<double>::max();
-	std::shared_ptr<SceneObject> hitObject = nullptr;
-	glm::dvec4 loc = glm::dvec4(0, 0, 0, 1);
-	glm::dvec4 nor = glm::dvec4(0, 0, 0, 0);
-	bool UpdateTMin(double newT) {
+	// Initilialize as largest possible Real value
+	Real t = std::numeric_limits<Real>::max();
+	// Objects are owned by the scene, which outlives every hit, so this doesn't need to hold a reference
+	SceneObject* hitObject = nullptr;
+	rvec4 loc = rvec4(0, 0, 0, 1);
+	rvec4 nor = rvec4(0, 0, 0, 0);
+	bool UpdateTMin(Real newT) {
 		if (newT < t) {
 			t = newT;
 			return true;
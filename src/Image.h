@@ -2,24 +2,30 @@
 #ifndef _IMAGE_H_
 #define _IMAGE_H_
 
-#include <string>
+#include <glm/glm.hpp>
+#include <cassert>
 #include <vector>
 
+// Linear RGB framebuffer with one float per channel, before exposure and tonemapping (see PostProcess.h)
+// Pixels are stored row by row, with row 0 at the bottom of the image
 class Image
 {
 public:
 	Image(int width, int height);
-	virtual ~Image();
-	void setPixel(int x, int y, unsigned char r, unsigned char g, unsigned char b);
-	void writeToFile(const std::string &filename);
+	void setPixel(int x, int y, const glm::vec3& color) {
+		assert(x >= 0 && x < width && y >= 0 && y < height);
+		pixels[(size_t)y * width + x] = color;
+	}
+	const glm::vec3& getPixel(int x, int y) const { return pixels[(size_t)y * width + x]; }
+	// The red, green and blue floats of every pixel, row by row
+	const float* getData() const { return &pixels[0].x; }
 	int getWidth() const { return width; }
 	int getHeight() const { return height; }
 
 private:
 	int width;
 	int height;
-	int comp;
-	std::vector<unsigned char> pixels;
+	std::vector<glm::vec3> pixels;
 };
 
 #endif
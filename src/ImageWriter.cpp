@@ -0,0 +1,405 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include "ImageWriter.h"
+#include "PFM.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+using namespace std;
+using namespace glm;
+
+ImageFormat GetImageFormat(const std::string& filename) {
+	size_t dot = filename.find_last_of('.');
+	string extension = (dot == string::npos) ? "" : filename.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	if (extension == "hdr") return ImageFormat::HDR;
+	if (extension == "exr") return ImageFormat::EXR;
+	if (extension == "pfm") return ImageFormat::PFM;
+	return ImageFormat::PNG;
+}
+
+// OpenEXR files are always little-endian, regardless of the machine that wrote them
+static void AppendLittleEndian(vector<char>& bytes, uint64_t val, int numBytes) {
+	for (int i = 0; i < numBytes; i++) {
+		bytes.push_back((char)((val >> (8 * i)) & 0xff));
+	}
+}
+
+static void AppendFloat(vector<char>& bytes, float val) {
+	uint32_t bits;
+	std::memcpy(&bits, &val, sizeof(bits));
+	AppendLittleEndian(bytes, bits, 4);
+}
+
+// Header attributes are stored as: name, type name, size in bytes, value
+static void AppendAttribute(vector<char>& bytes, const char* name, const char* type, const vector<char>& value) {
+	bytes.insert(bytes.end(), name, name + strlen(name) + 1);
+	bytes.insert(bytes.end(), type, type + strlen(type) + 1);
+	AppendLittleEndian(bytes, value.size(), 4);
+	bytes.insert(bytes.end(), value.begin(), value.end());
+}
+
+// Header of a minimal single-part scanline OpenEXR file, up to and including the table of scanline offsets
+// (https://openexr.com/en/latest/OpenEXRFileLayout.html). The pixels are uncompressed, so every offset is known up front
+static vector<char> CreateEXRHeader(int width, int height) {
+	vector<char> header = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+
+	// Channels have to be listed (and stored) in alphabetical order
+	const char channelNames[3] = { 'B', 'G', 'R' };
+	vector<char> channels;
+	for (char name : channelNames) {
+		channels.push_back(name);
+		channels.push_back(0);
+		AppendLittleEndian(channels, 2, 4); // FLOAT pixels
+		AppendLittleEndian(channels, 0, 4); // pLinear and reserved bytes
+		AppendLittleEndian(channels, 1, 4); // x sampling
+		AppendLittleEndian(channels, 1, 4); // y sampling
+	}
+	channels.push_back(0);
+	vector<char> window;
+	AppendLittleEndian(window, 0, 4);
+	AppendLittleEndian(window, 0, 4);
+	AppendLittleEndian(window, width - 1, 4);
+	AppendLittleEndian(window, height - 1, 4);
+	vector<char> one, center;
+	AppendFloat(one, 1.0f);
+	AppendFloat(center, 0.0f);
+	AppendFloat(center, 0.0f);
+	AppendAttribute(header, "channels", "chlist", channels);
+	AppendAttribute(header, "compression", "compression", { 0 });
+	AppendAttribute(header, "dataWindow", "box2i", window);
+	AppendAttribute(header, "displayWindow", "box2i", window);
+	AppendAttribute(header, "lineOrder", "lineOrder", { 0 });
+	AppendAttribute(header, "pixelAspectRatio", "float", one);
+	AppendAttribute(header, "screenWindowCenter", "v2f", center);
+	AppendAttribute(header, "screenWindowWidth", "float", one);
+	header.push_back(0);
+
+	// Each scanline is its own block, so the offset table has one entry per row
+	uint64_t blockSize = 8 + 3 * sizeof(float) * (uint64_t)width;
+	uint64_t firstBlock = header.size() + 8 * (uint64_t)height;
+	for (int y = 0; y < height; y++) {
+		AppendLittleEndian(header, firstBlock + y * blockSize, 8);
+	}
+	return header;
+}
+
+// Block of EXR scanline y (counted from the top of the image), holding the given row of the image
+static void AppendEXRScanline(vector<char>& block, const Image& image, int row, int y) {
+	int width = image.getWidth();
+	AppendLittleEndian(block, y, 4);
+	AppendLittleEndian(block, 3 * sizeof(float) * (uint64_t)width, 4);
+	for (int channel = 2; channel >= 0; channel--) {
+		for (int x = 0; x < width; x++) {
+			AppendFloat(block, image.getPixel(x, row)[channel]);
+		}
+	}
+}
+
+static bool WriteEXR(const std::string& filename, const Image& image) {
+	int height = image.getHeight();
+	vector<char> header = CreateEXRHeader(image.getWidth(), height);
+	ofstream file(filename, ios::binary);
+	if (!file.good()) return false;
+	file.write(header.data(), header.size());
+	vector<char> block;
+	for (int y = 0; y < height; y++) {
+		block.clear();
+		// EXR rows go from the top of the image down, and the image's row 0 is at the bottom
+		AppendEXRScanline(block, image, height - y - 1, y);
+		file.write(block.data(), block.size());
+	}
+	return file.good();
+}
+
+bool WriteImage(const std::string& filename, const Image& image, const PostProcessSettings& settings) {
+	int width = image.getWidth();
+	int height = image.getHeight();
+	bool success = false;
+	switch (GetImageFormat(filename)) {
+	case ImageFormat::HDR: {
+		// Radiance files are stored top row first
+		vector<float> flipped((size_t)3 * width * height);
+		for (int y = 0; y < height; y++) {
+			const float* src = image.getData() + (size_t)3 * width * y;
+			std::copy(src, src + 3 * width, flipped.begin() + (size_t)3 * width * (height - y - 1));
+		}
+		success = stbi_write_hdr(filename.c_str(), width, height, 3, flipped.data()) != 0;
+		break;
+	}
+	case ImageFormat::EXR:
+		success = WriteEXR(filename, image);
+		break;
+	case ImageFormat::PFM: {
+		vector<dvec3> pixels((size_t)width * height);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				pixels[(size_t)y * width + x] = dvec3(image.getPixel(x, y));
+			}
+		}
+		success = WritePFM(filename, width, height, pixels);
+		break;
+	}
+	case ImageFormat::PNG:
+	default: {
+		vector<unsigned char> pixels;
+		ApplyPostProcess(image, settings, pixels);
+		// The distance in bytes from the first byte of a row of pixels to the first byte of the next row of pixels
+		int strideInBytes = 3 * width;
+		success = stbi_write_png(filename.c_str(), width, height, 3, pixels.data(), strideInBytes) != 0;
+		break;
+	}
+	}
+	if (success) {
+		cout << "Wrote to " << filename << endl;
+	} else {
+		cerr << "ERROR: Couldn't write to " << filename << endl;
+	}
+	return success;
+}
+
+// A stored deflate block can hold at most this many bytes
+static constexpr size_t maxStoredBlockSize = 65535;
+// Rows of black that are written at a time when a stream is closed early
+static constexpr int fillRows = 16;
+
+static void AppendBigEndian(vector<unsigned char>& bytes, uint32_t val) {
+	for (int i = 3; i >= 0; i--) {
+		bytes.push_back((unsigned char)((val >> (8 * i)) & 0xff));
+	}
+}
+
+// CRC-32 of PNG chunks (https://www.w3.org/TR/png/#D-CRCAppendix)
+static uint32_t UpdateCRC32(uint32_t crc, const unsigned char* data, size_t size) {
+	static const vector<uint32_t> table = [] {
+		vector<uint32_t> entries(256);
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			entries[n] = c;
+		}
+		return entries;
+	}();
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+// Called by stb to write the run-length encoded scanlines of a Radiance file
+static void WriteToStream(void* stream, void* data, int size) {
+	static_cast<ofstream*>(stream)->write(static_cast<const char*>(data), size);
+}
+
+ImageStreamWriter::~ImageStreamWriter() {
+	if (file.is_open()) Close();
+}
+
+bool ImageStreamWriter::Open(const std::string& _filename, int _width, int _height, const PostProcessSettings& _settings) {
+	filename = _filename;
+	format = GetImageFormat(filename);
+	settings = _settings;
+	width = _width;
+	height = _height;
+	rowsWritten = 0;
+	adler = 1;
+	file.open(filename, ios::binary | ios::trunc);
+	if (!file.good()) {
+		cerr << "ERROR: Unable to open " << filename << " for writing" << endl;
+		return false;
+	}
+	switch (format) {
+	case ImageFormat::HDR:
+		file << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << height << " +X " << width << "\n";
+		break;
+	case ImageFormat::EXR: {
+		vector<char> header = CreateEXRHeader(width, height);
+		file.write(header.data(), header.size());
+		break;
+	}
+	case ImageFormat::PFM: {
+		string header = CreatePFMHeader(width, height);
+		pfmHeaderSize = header.size();
+		file << header;
+		break;
+	}
+	case ImageFormat::PNG:
+	default: {
+		const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+		// 8 bits per channel RGB, without interlacing
+		vector<unsigned char> header;
+		AppendBigEndian(header, width);
+		AppendBigEndian(header, height);
+		header.insert(header.end(), { 8, 2, 0, 0, 0 });
+		WritePNGChunk("IHDR", header);
+		// The pixels are one zlib stream spread over every IDAT chunk, starting with its header (no compression)
+		WritePNGChunk("IDAT", { 0x78, 0x01 });
+		break;
+	}
+	}
+	return file.good();
+}
+
+bool ImageStreamWriter::WriteBand(const Image& band) {
+	int bandHeight = band.getHeight();
+	if (!file.is_open() || band.getWidth() != width || rowsWritten + bandHeight > height) return false;
+	switch (format) {
+	case ImageFormat::HDR: {
+		stbi__write_context context;
+		stbi__start_write_callbacks(&context, WriteToStream, &file);
+		vector<unsigned char> scratch((size_t)4 * width);
+		vector<float> scanline((size_t)3 * width);
+		// Radiance files are stored top row first
+		for (int row = bandHeight - 1; row >= 0; row--) {
+			const float* src = band.getData() + (size_t)3 * width * row;
+			std::copy(src, src + 3 * width, scanline.begin());
+			stbiw__write_hdr_scanline(&context, width, 3, scratch.data(), scanline.data());
+		}
+		break;
+	}
+	case ImageFormat::EXR: {
+		vector<char> block;
+		for (int row = bandHeight - 1; row >= 0; row--) {
+			block.clear();
+			AppendEXRScanline(block, band, row, rowsWritten + (bandHeight - row - 1));
+			file.write(block.data(), block.size());
+		}
+		break;
+	}
+	case ImageFormat::PFM: {
+		// PFM rows go from the bottom up like the band's, so the band is one contiguous range that ends where the rows
+		// written so far begin
+		uint64_t rowSize = 3 * sizeof(float) * (uint64_t)width;
+		file.seekp(pfmHeaderSize + (height - rowsWritten - bandHeight) * rowSize);
+		file.write(reinterpret_cast<const char*>(band.getData()), bandHeight * rowSize);
+		break;
+	}
+	case ImageFormat::PNG:
+	default: {
+		vector<unsigned char> pixels;
+		ApplyPostProcess(band, settings, pixels);
+		// Every row starts with its filter type (0 = none)
+		size_t rowLength = (size_t)3 * width;
+		vector<unsigned char> rows;
+		rows.reserve((rowLength + 1) * bandHeight);
+		for (int y = 0; y < bandHeight; y++) {
+			rows.push_back(0);
+			rows.insert(rows.end(), pixels.begin() + y * rowLength, pixels.begin() + (y + 1) * rowLength);
+		}
+		// Adler-32 of the uncompressed data, which ends the zlib stream
+		uint32_t a = adler & 0xffff, b = adler >> 16;
+		for (unsigned char byte : rows) {
+			a = (a + byte) % 65521;
+			b = (b + a) % 65521;
+		}
+		adler = (b << 16) | a;
+		// Split the rows into stored blocks. None of them are the last block of the stream, Close adds an empty one
+		vector<unsigned char> data;
+		data.reserve(rows.size() + 5 * (rows.size() / maxStoredBlockSize + 1));
+		for (size_t first = 0; first < rows.size(); first += maxStoredBlockSize) {
+			uint16_t size = (uint16_t)std::min(maxStoredBlockSize, rows.size() - first);
+			data.insert(data.end(), { 0, (unsigned char)(size & 0xff), (unsigned char)(size >> 8),
+				(unsigned char)(~size & 0xff), (unsigned char)((~size >> 8) & 0xff) });
+			data.insert(data.end(), rows.begin() + first, rows.begin() + first + size);
+		}
+		WritePNGChunk("IDAT", data);
+		break;
+	}
+	}
+	rowsWritten += bandHeight;
+	return file.good();
+}
+
+bool ImageStreamWriter::Close() {
+	if (!file.is_open()) return false;
+	// Rows that a stopped render never reached are left black, so the file still holds a complete image
+	while (rowsWritten < height) {
+		if (!WriteBand(Image(width, std::min(fillRows, height - rowsWritten)))) break;
+	}
+	if (format == ImageFormat::PNG) {
+		// An empty final block ends the zlib stream, followed by its checksum
+		vector<unsigned char> data = { 1, 0, 0, 0xff, 0xff };
+		AppendBigEndian(data, adler);
+		WritePNGChunk("IDAT", data);
+		WritePNGChunk("IEND", {});
+	}
+	bool success = file.good();
+	file.close();
+	if (success) {
+		cout << "Wrote to " << filename << endl;
+	} else {
+		cerr << "ERROR: Couldn't write to " << filename << endl;
+	}
+	return success;
+}
+
+void ImageStreamWriter::WritePNGChunk(const char* type, const std::vector<unsigned char>& data) {
+	vector<unsigned char> header;
+	AppendBigEndian(header, (uint32_t)data.size());
+	header.insert(header.end(), type, type + 4);
+	// The checksum covers the chunk's type and data, but not its length
+	uint32_t crc = UpdateCRC32(0, header.data() + 4, 4);
+	crc = UpdateCRC32(crc, data.data(), data.size());
+	vector<unsigned char> footer;
+	AppendBigEndian(footer, crc);
+	file.write(reinterpret_cast<const char*>(header.data()), header.size());
+	file.write(reinterpret_cast<const char*>(data.data()), data.size());
+	file.write(reinterpret_cast<const char*>(footer.data()), footer.size());
+}
+
+AsyncImageWriter::AsyncImageWriter() {
+	// Started last, once every other member is ready to use
+	writerThread = std::thread(&AsyncImageWriter::WriterLoop, this);
+}
+
+AsyncImageWriter::~AsyncImageWriter() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wakeCondition.notify_one();
+	writerThread.join();
+}
+
+void AsyncImageWriter::Write(const std::string& filename, Image image, const PostProcessSettings& settings) {
+	{
+		lock_guard<mutex> guard(lock);
+		auto queued = std::find_if(jobs.begin(), jobs.end(), [&](const WriteJob& job) { return job.filename == filename; });
+		if (queued != jobs.end()) {
+			queued->image = std::move(image);
+			queued->settings = settings;
+		}
+		else {
+			jobs.push_back({ filename, std::move(image), settings });
+		}
+	}
+	wakeCondition.notify_one();
+}
+
+void AsyncImageWriter::Flush() {
+	unique_lock<mutex> guard(lock);
+	doneCondition.wait(guard, [this] { return jobs.empty() && !writing; });
+}
+
+void AsyncImageWriter::WriterLoop() {
+	unique_lock<mutex> guard(lock);
+	while (true) {
+		wakeCondition.wait(guard, [this] { return stopping || !jobs.empty(); });
+		// Finish the queue before stopping, so nothing that was written is lost
+		if (jobs.empty()) return;
+		WriteJob job = std::move(jobs.front());
+		jobs.pop_front();
+		writing = true;
+		guard.unlock();
+		WriteImage(job.filename, job.image, job.settings);
+		guard.lock();
+		writing = false;
+		doneCondition.notify_all();
+	}
+}
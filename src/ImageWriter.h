@@ -0,0 +1,96 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <vector>
+#include <cstdint>
+#include "Image.h"
+#include "PostProcess.h"
+
+// File formats that images can be saved as
+enum class ImageFormat {
+	// Tonemapped 8-bit sRGB
+	PNG,
+	// Linear floats, for compositing (Radiance RGBE)
+	HDR,
+	// Linear floats, for compositing (uncompressed OpenEXR with 32-bit float channels)
+	EXR,
+	// Linear floats, for comparing renders (see PFM.h)
+	PFM
+};
+
+// Pick the format from a file's extension (.hdr, .exr or .pfm). Anything else is saved as a PNG
+ImageFormat GetImageFormat(const std::string& filename);
+// Save the image in the format matching the filename. The linear formats store the framebuffer as is, only PNG uses the
+// post process settings. Returns false if the file couldn't be written
+bool WriteImage(const std::string& filename, const Image& image, const PostProcessSettings& settings);
+
+// Saves an image a band of rows at a time from the top down, so the whole image never has to be in memory at once (see
+// Renderer::RenderStreaming). Each band is written and can be freed as soon as it's done
+// PNGs are stored without compression, since the zlib stream can't be split into independently compressed bands
+class ImageStreamWriter {
+public:
+	ImageStreamWriter() = default;
+	// Closes the file if it's still open
+	~ImageStreamWriter();
+
+	// Create the file (in the format matching its name, see GetImageFormat) and write its header. Returns false if the
+	// file couldn't be opened
+	bool Open(const std::string& filename, int width, int height, const PostProcessSettings& settings);
+	// Write the rows below the ones that were written so far (band's row 0 is its bottom row, same as Image). Returns
+	// false if the band doesn't fit in the image or couldn't be written
+	bool WriteBand(const Image& band);
+	// Fill the rows that were never written with black, and finish the file. Returns false if any write failed
+	bool Close();
+
+private:
+	// Append a PNG chunk of the given type to the file
+	void WritePNGChunk(const char* type, const std::vector<unsigned char>& data);
+
+	std::string filename;
+	ImageFormat format = ImageFormat::PNG;
+	PostProcessSettings settings;
+	int width = 0;
+	int height = 0;
+	int rowsWritten = 0;
+	std::ofstream file;
+	// Size of the PFM header, where the image's bottom row starts
+	uint64_t pfmHeaderSize = 0;
+	// Running Adler-32 checksum of the PNG's uncompressed pixel data
+	uint32_t adler = 1;
+};
+
+// Saves images on a background thread, so encoding and disk writes don't hold up rendering
+class AsyncImageWriter {
+public:
+	AsyncImageWriter();
+	// Finishes every queued write before returning
+	~AsyncImageWriter();
+
+	// Queue a copy of the image to be saved (see WriteImage). If an older write to the same file hasn't started yet, it's
+	// replaced instead of saving both (i.e. previews that come in faster than they can be written)
+	void Write(const std::string& filename, Image image, const PostProcessSettings& settings);
+	// Block until every queued write has finished
+	void Flush();
+
+private:
+	struct WriteJob {
+		std::string filename;
+		Image image;
+		PostProcessSettings settings;
+	};
+
+	void WriterLoop();
+
+	std::deque<WriteJob> jobs;
+	std::mutex lock;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+	bool writing = false;
+	bool stopping = false;
+	std::thread writerThread;
+};
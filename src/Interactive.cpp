@@ -0,0 +1,254 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include "Interactive.h"
+#include "Scene.h"
+#include "Camera.h"
+#include "Image.h"
+#include "ImageWriter.h"
+
+using namespace std;
+using namespace glm;
+
+// The first frame after an edit is rendered at 1 / previewScale of the full resolution, with a single sample per pixel
+static const int previewScale = 4;
+
+// Lines read from stdin on a background thread, so a render can be cancelled as soon as a command comes in
+// Reading blocks until a line arrives, so the thread is detached and shares the queue with the session
+struct CommandQueue {
+	std::deque<string> lines;
+	bool closed = false;
+	std::mutex lock;
+	std::condition_variable lineCondition;
+	// Set whenever there are unread lines, and used as the renderers' cancel flag
+	std::atomic<bool> pending{ false };
+
+	static void ReadLines(shared_ptr<CommandQueue> queue) {
+		string line;
+		while (std::getline(cin, line)) {
+			lock_guard<mutex> guard(queue->lock);
+			queue->lines.push_back(line);
+			queue->pending = true;
+			queue->lineCondition.notify_one();
+		}
+		// Closing stdin doesn't cancel anything, the last edit is still rendered before the session ends
+		lock_guard<mutex> guard(queue->lock);
+		queue->closed = true;
+		queue->lineCondition.notify_one();
+	}
+
+	// Take the next line, waiting for one if wait is true. Returns false if there isn't one (or stdin was closed)
+	bool Pop(string& outLine, bool wait) {
+		unique_lock<mutex> guard(lock);
+		if (wait) lineCondition.wait(guard, [this] { return closed || !lines.empty(); });
+		if (lines.empty()) return false;
+		outLine = lines.front();
+		lines.pop_front();
+		pending = !lines.empty();
+		return true;
+	}
+
+	bool IsClosed() {
+		lock_guard<mutex> guard(lock);
+		return closed && lines.empty();
+	}
+};
+
+void PrintInteractiveHelp() {
+	cout << "Commands (colors are sRGB from 0 to 1, angles are in degrees, names with spaces go in quotes):" << endl;
+	cout << "  camera position <X> <Y> <Z>" << endl;
+	cout << "  camera rotation <X> <Y> <Z>" << endl;
+	cout << "  camera fov <DEGREES>" << endl;
+	cout << "  material <OBJECT NAME> diffuse <R> <G> <B>" << endl;
+	cout << "  material <OBJECT NAME> specular <R> <G> <B>" << endl;
+	cout << "  material <OBJECT NAME> roughness <VALUE>" << endl;
+	cout << "  material <OBJECT NAME> reflectance <VALUE>" << endl;
+	cout << "  object <OBJECT NAME> position <X> <Y> <Z>" << endl;
+	cout << "  object <OBJECT NAME> rotation <X> <Y> <Z>" << endl;
+	cout << "  object <OBJECT NAME> scale <X> <Y> <Z>" << endl;
+	cout << "  samples <N>        Samples per pixel to refine the image up to" << endl;
+	cout << "  help" << endl;
+	cout << "  quit" << endl;
+}
+
+// Apply one command to the scene/camera. Returns true if the image has to be rendered again
+static bool RunCommand(const string& line, Scene& scene, Camera& camera, RenderSettings& settings, bool& outQuit) {
+	istringstream in(line);
+	string command;
+	if (!(in >> command)) return false;
+	if (command == "quit" || command == "exit") {
+		outQuit = true;
+		return false;
+	}
+	if (command == "help") {
+		PrintInteractiveHelp();
+		return false;
+	}
+
+	bool valid = false;
+	if (command == "camera") {
+		string property;
+		dvec3 val;
+		in >> property;
+		if (property == "fov" && in >> val.x) {
+			camera.SetFOVDegrees(val.x);
+			valid = true;
+		}
+		else if ((property == "position" || property == "rotation") && in >> val.x >> val.y >> val.z) {
+			if (property == "position") camera.SetPosition(rvec4(rvec3(val), 1));
+			else camera.SetRotationDegrees(rvec3(val));
+			valid = true;
+		}
+		if (valid) camera.Setup();
+	}
+	else if (command == "material") {
+		string objectName, property;
+		dvec3 val;
+		in >> std::quoted(objectName) >> property;
+		Material* material = scene.FindMaterial(objectName);
+		if (!in) {
+			// Fall through to the usage error below
+		}
+		else if (!material) {
+			cerr << "ERROR: there's no object named " << objectName << endl;
+			return false;
+		}
+		else if ((property == "diffuse" || property == "specular") && in >> val.x >> val.y >> val.z) {
+			// Same as colors in the scene file
+			dvec3 linearColor = Camera::ColorSRGBToLinear(val);
+			if (property == "diffuse") material->kd = linearColor;
+			else material->ks = linearColor;
+			valid = true;
+		}
+		else if ((property == "roughness" || property == "reflectance") && in >> val.x) {
+			if (property == "roughness") material->roughness = val.x;
+			else material->reflectance = val.x;
+			valid = true;
+		}
+		if (valid) scene.CompileMaterials();
+	}
+	else if (command == "object") {
+		string objectName, property;
+		dvec3 val;
+		in >> std::quoted(objectName) >> property;
+		const SceneObject* object = scene.FindObject(objectName);
+		if (!in) {
+			// Fall through to the usage error below
+		}
+		else if (!object) {
+			cerr << "ERROR: there's no object named " << objectName << endl;
+			return false;
+		}
+		else if ((property == "position" || property == "rotation" || property == "scale") &&
+			in >> val.x >> val.y >> val.z) {
+			Transform transf = object->GetTransform();
+			if (property == "position") transf.translation = rvec4(rvec3(val), 1);
+			// The constructor converts the angles to radians, same as the scene file
+			else if (property == "rotation") transf = Transform(transf.translation, rvec3(val), transf.scale);
+			else transf.scale = rvec3(val);
+			if (!scene.SetObjectTransform(objectName, transf)) {
+				cerr << "ERROR: " << objectName << " was flattened into world space, so it can't be moved" << endl;
+				return false;
+			}
+			valid = true;
+		}
+	}
+	else if (command == "samples") {
+		int samples;
+		if (in >> samples && samples > 0) {
+			settings.numSamples = samples;
+			valid = true;
+		}
+	}
+	if (!valid) {
+		cerr << "ERROR: couldn't read command: " << line << " (type help to list the commands)" << endl;
+	}
+	return valid;
+}
+
+// Render a quick frame at a fraction of the resolution, and stretch it to the full size
+static Image RenderLowResolution(const Scene& scene, const Camera& camera, const RenderSettings& settings,
+	const std::atomic<bool>* cancelFlag) {
+	RenderSettings lowSettings = settings;
+	lowSettings.width = std::max(1, settings.width / previewScale);
+	lowSettings.height = std::max(1, settings.height / previewScale);
+	lowSettings.numSamples = 1;
+	lowSettings.adaptiveThreshold = 0;
+	lowSettings.previewFile.clear();
+	Camera lowCamera = camera;
+	lowCamera.SetImageSize(lowSettings.width, lowSettings.height);
+	lowCamera.Setup();
+
+	Image lowImage(lowSettings.width, lowSettings.height);
+	Renderer renderer(scene, lowCamera, lowSettings);
+	renderer.SetCancelFlag(cancelFlag);
+	renderer.Render(lowImage);
+
+	Image image(settings.width, settings.height);
+	for (int y = 0; y < settings.height; y++) {
+		for (int x = 0; x < settings.width; x++) {
+			int lowX = std::min(x * lowSettings.width / settings.width, lowSettings.width - 1);
+			int lowY = std::min(y * lowSettings.height / settings.height, lowSettings.height - 1);
+			image.setPixel(x, y, lowImage.getPixel(lowX, lowY));
+		}
+	}
+	return image;
+}
+
+bool RunInteractive(const std::string& sceneFile, const std::string& imageFile, RenderSettings settings) {
+	Camera camera(settings.width, settings.height, rvec4(0, 0, -5, 1), rvec3(0, 0, 0), 45, 1.0);
+	Scene scene(dvec3(0, 0, 0));
+	BVHBuildMethod bvhMethod = settings.fastBVH ? BVHBuildMethod::MORTON : BVHBuildMethod::SAH;
+	if (!scene.BuildSceneFromFile(sceneFile, camera, settings.numThreads, bvhMethod)) return false;
+	scene.SetLightSamples(settings.lightSamples);
+	if (settings.flattenTransforms) scene.FlattenTransforms();
+
+	// Every pass of the full resolution render is saved, the writer drops any that it can't keep up with
+	settings.previewFile = imageFile;
+	settings.previewInterval = 0;
+	settings.checkpointFile.clear();
+	settings.resumeFile.clear();
+	shared_ptr<CommandQueue> commands = make_shared<CommandQueue>();
+	std::thread(CommandQueue::ReadLines, commands).detach();
+	AsyncImageWriter imageWriter;
+	PrintInteractiveHelp();
+
+	bool needsRender = true;
+	bool quit = false;
+	while (!quit && !Renderer::IsStopRequested()) {
+		if (needsRender && !commands->pending) {
+			cout << "Rendering a " << settings.width / previewScale << "px preview" << endl;
+			imageWriter.Write(imageFile, RenderLowResolution(scene, camera, settings, &commands->pending),
+				PostProcessSettings(camera));
+		}
+		if (needsRender && !commands->pending) {
+			Image image(settings.width, settings.height);
+			Renderer renderer(scene, camera, settings);
+			renderer.SetCancelFlag(&commands->pending);
+			renderer.SetPreviewWriter(&imageWriter);
+			// Only the last pass is left to save, the earlier ones went out as previews
+			if (renderer.Render(image)) {
+				imageWriter.Write(imageFile, std::move(image), PostProcessSettings(camera));
+				needsRender = false;
+				cout << "Finished " << settings.numSamples << " samples per pixel, waiting for commands" << endl;
+			}
+		}
+
+		// Apply every command that came in before starting over, so several edits only restart the render once
+		string line;
+		bool wait = !needsRender;
+		while (!quit && commands->Pop(line, wait)) {
+			if (RunCommand(line, scene, camera, settings, quit)) needsRender = true;
+			wait = false;
+		}
+		if (!needsRender && commands->IsClosed()) quit = true;
+	}
+	return true;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+#include "Renderer.h"
+
+// Keep the scene and its acceleration structures loaded, and re-render it whenever the camera or a material is edited
+// with a command on stdin (see PrintInteractiveHelp). Every edit restarts the render with a quick low resolution
+// frame, then refines the full resolution image pass by pass, saving it to imageFile as it improves
+// Returns false if the scene couldn't be loaded
+bool RunInteractive(const std::string& sceneFile, const std::string& imageFile, RenderSettings settings);
+// List the commands that RunInteractive understands
+void PrintInteractiveHelp();
@@ -4,8 +4,31 @@
 #include <string>
 #include <memory>
 #include <iostream>
+#include <cstdint>
 #include "SceneObject.h"
 
+// A single randomly-chosen point on a light. Returned by value so that concurrent render threads can each
+// sample the same light without overwriting each other's results
+struct LightSample {
+	rvec4 loc = rvec4(0, 0, 0, 1);
+	rvec4 nor = rvec4(0, 0, 0, 0);
+	double pdf = 1.0;
+};
+
+// Blender model of light attenuation: A = (dist / (dist + L * r)) * (dist^2 / (dist^2 + Q * r^2)). Dividing the falloff
+// distance out of both terms leaves 1 / ((1 + L / dist * r) * (1 + Q / dist^2 * r^2)), so it only needs a single division
+// linearScale is L / dist, and quadScale is Q / dist^2
+inline double GetBlenderAttenuation(double linearScale, double quadScale, double r) {
+	return 1.0 / ((1.0 + linearScale * r) * (1.0 + quadScale * r * r));
+}
+
+// Which subclass of Light a light is, so that compiled light tables can dispatch on it without virtual calls
+enum class LightType : uint8_t {
+	POINT,
+	EMISSIVE
+};
+
+// Description of a light as it was read from the scene file. Rendering uses the scene's compiled LightTable instead
 class Light {
 public:
 	Light() = default;
@@ -13,29 +36,38 @@ public:
 		name(_name),
 		L(_L),
 		Q(_Q),
-		distance(_falloffDistance),
-		sqrdDist(std::pow(distance, 2.0)) {}
+		distance(_falloffDistance) {}
 	
-	// If this is an area/emissive light, store a random point on the light's surface, and return the pdf
-	virtual double RandomizeLocation() = 0;
-	// Get the light's loc, or the most recently chosen random position on an area light
-	virtual glm::dvec4 GetLocation() = 0;
-	// Find this light's color contribution, given the most recently-sampled loc on the light and a point in the world
-	virtual glm::dvec3 SampleLight(glm::dvec4 hitLocation) = 0;
 	// If this light is attached to a sceneobject (i.e. emissive lights), return it. Else, return nullptr
-	virtual std::shared_ptr<SceneObject> GetObject() = 0;
-	virtual glm::dvec3 GetColor() = 0;
+	virtual SceneObject* GetObject() const = 0;
+	virtual glm::dvec3 GetColor() const = 0;
+	// Rough estimate of the total light this light gives off, used to decide how often to sample it
+	virtual double GetEmittedPower() const = 0;
+	// How much this light is likely to contribute at a typical distance from it, relative to other lights
+	double GetSelectionWeight(double typicalDistance) const {
+		return GetEmittedPower() * GetDistanceAttenuation(typicalDistance);
+	}
+	virtual LightType GetType() const = 0;
+	// Attenuation parameters (see GetDistanceAttenuation)
+	double GetLinear() const { return L; }
+	double GetQuadratic() const { return Q; }
+	double GetFalloffDistance() const { return distance; }
+	// Attenuation parameters with the falloff distance divided out (see GetBlenderAttenuation)
+	double GetLinearScale() const { return L / distance; }
+	double GetQuadraticScale() const { return Q / (distance * distance); }
 	std::string name;
 
 protected:
-	// Use the blender model of light attenuation
-	double GetDistanceAttenuation(double r) {
-		double linear = distance / (distance + L * r);
-		double quad = sqrdDist / (sqrdDist + Q * std::pow(r, 2.0));
-		return linear * quad;
+	// Brightness of a linear color, as perceived by the eye (Rec. 709 weights)
+	static double Luminance(const glm::dvec3& color) {
+		return 0.2126 * color.r + 0.7152 * color.g + 0.0722 * color.b;
 	}
 
-	// Use the blender model of light attenuation: A = (dist / (dist + L * r)) * (dist^2 / (dist^2 + Q * r^2))
+	double GetDistanceAttenuation(double r) const {
+		return GetBlenderAttenuation(GetLinearScale(), GetQuadraticScale(), r);
+	}
+
+	// Use the blender model of light attenuation (see GetBlenderAttenuation)
 	// https://docs.blender.org/manual/en/2.79/render/blender_render/lighting/lights/attenuation.html
 	// Linear attenuation factor
 	double L = 0.5;
@@ -44,9 +76,6 @@ protected:
 	// Falloff distance factor
 	double distance = 100;
 
-	// Store the squared values of some parameters to avoid unecessary calculations later
-	double sqrdDist = 0;
-
 	// L=0, Q=0 - No attenuation
 	// L=0, Q=1 - physics
 };
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+#include "LightTable.h"
+#include "PointLight.h"
+
+using namespace std;
+using namespace glm;
+
+void LightTable::Build(const vector<unique_ptr<Light> >& lights) {
+	size_t count = lights.size();
+	types.resize(count);
+	colors.resize(count);
+	attenuations.resize(count);
+	locations.assign(count, rvec4(0, 0, 0, 1));
+	objects.assign(count, nullptr);
+	for (size_t lightIdx = 0; lightIdx < count; lightIdx++) {
+		const Light& light = *lights[lightIdx];
+		types[lightIdx] = light.GetType();
+		colors[lightIdx] = light.GetColor();
+		attenuations[lightIdx] = { light.GetLinearScale(), light.GetQuadraticScale() };
+		if (light.GetType() == LightType::POINT) {
+			locations[lightIdx] = static_cast<const PointLight&>(light).GetLocation();
+		}
+		objects[lightIdx] = light.GetObject();
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include "SceneObject.h"
+#include "Light.h"
+
+// Every light in the scene compiled into one array per property, indexed by light ID (the light's index in the scene's
+// list of lights). Shading switches on each light's type instead of making virtual calls, and the values it reads for
+// one light sit next to the same values of the other lights
+class LightTable {
+public:
+	LightTable() = default;
+
+	// Copy the properties of every light. Emissive lights take their color from their object's material, so the
+	// materials have to be final
+	void Build(const std::vector<std::unique_ptr<Light> >& lights);
+
+	int Size() const { return (int)types.size(); }
+	LightType GetType(int lightIdx) const { return types[lightIdx]; }
+	// Object that an emissive light belongs to (nullptr for point lights)
+	const SceneObject* GetObject(int lightIdx) const { return objects[lightIdx]; }
+	const glm::dvec3& GetColor(int lightIdx) const { return colors[lightIdx]; }
+
+	// Choose a location on the light (a random point on the surface for emissive lights), along with its pdf
+	// refLoc is the point being lit, and u is a uniformly distributed point in [0, 1)^2 from the sampler
+	LightSample RandomizeLocation(int lightIdx, const rvec4& refLoc, const glm::dvec2& u) const {
+		LightSample sample;
+		switch (types[lightIdx]) {
+		case LightType::POINT:
+			// Not randomly sampling location, so pdf is just 1
+			sample.loc = locations[lightIdx];
+			break;
+		case LightType::EMISSIVE:
+			sample.loc = objects[lightIdx]->GetRandomPointOnSurface(refLoc, u, sample.pdf, sample.nor);
+			break;
+		}
+		return sample;
+	}
+
+	// Find the light's color contribution at hitLocation, from a location chosen by RandomizeLocation
+	glm::dvec3 SampleLight(int lightIdx, const LightSample& sample, const rvec4& hitLocation) const {
+		switch (types[lightIdx]) {
+		case LightType::POINT: {
+			double distance = glm::length(hitLocation - sample.loc);
+			return colors[lightIdx] * GetDistanceAttenuation(lightIdx, distance);
+		}
+		case LightType::EMISSIVE: {
+			rvec4 hitVector = hitLocation - sample.loc;
+			double distance = glm::length(hitVector);
+			hitVector = glm::normalize(hitVector);
+			// The surface emits evenly in all directions, attenuated by the angle btwn the surface normal and ray
+			double orientationAttenuation = std::max(0.0, (double)glm::dot(hitVector, sample.nor));
+			return colors[lightIdx] * orientationAttenuation * GetDistanceAttenuation(lightIdx, distance);
+		}
+		}
+		return glm::dvec3(0);
+	}
+
+	// Probability density of RandomizeLocation choosing the given point on the light from refLoc, per unit area. 0 for
+	// point lights, which rays can never hit
+	double GetLocationPdf(int lightIdx, const rvec4& refLoc, const rvec4& loc) const {
+		return (types[lightIdx] == LightType::EMISSIVE) ? objects[lightIdx]->GetSurfacePdf(refLoc, loc) : 0.0;
+	}
+
+private:
+	double GetDistanceAttenuation(int lightIdx, double r) const {
+		const Attenuation& a = attenuations[lightIdx];
+		return GetBlenderAttenuation(a.linearScale, a.quadScale, r);
+	}
+
+	// Attenuation factors of one light, precomputed from its parameters when the table is built
+	struct Attenuation {
+		// L / falloff distance
+		double linearScale;
+		// Q / falloff distance^2
+		double quadScale;
+	};
+
+	std::vector<LightType> types;
+	std::vector<glm::dvec3> colors;
+	std::vector<Attenuation> attenuations;
+	// Position of each point light (unused for emissive lights)
+	std::vector<rvec4> locations;
+	// Object of each emissive light (nullptr for point lights). Owned by the scene
+	std::vector<SceneObject*> objects;
+};
@@ -2,9 +2,6 @@
 
 #include <glm/glm.hpp>
 #include <memory>
-#include "HitResult.h"
-#include "Ray3D.h"
-#include "Light.h"
 
 struct Material {
 	glm::dvec3 kd;
@@ -34,24 +31,4 @@ struct Material {
 		specularExp(_specularExp),
 		roughness(_roughness)
 	{}
-
-	glm::dvec3 ShadeBlinnPhong(const Ray3D& ray, const HitResult& hit, const std::shared_ptr<Light> light) const {
-		// Diffuse component
-		glm::dvec4 lightVec = glm::normalize(light->GetLocation() - hit.loc);
-		glm::dvec3 cd = kd * std::max(0.0, glm::dot(lightVec, hit.nor));
-
-		// Specular component
-		glm::dvec4 eyeVec = -1.0 * ray.dir;
-		glm::dvec4 halfVec = glm::normalize(eyeVec + lightVec); // Since it's normalized, it doesn't matter that it's not / 2
-		glm::dvec3 cs = ks * std::pow(std::max(0.0, glm::dot(halfVec, hit.nor)), specularExp);
-
-		return light->SampleLight(hit.loc) * (cd + cs);
-	}
-	
-	glm::dvec3 ShadeDiffuse(const Ray3D& ray, const HitResult& hit, const std::shared_ptr<Light> light) const {
-		glm::dvec4 lightVec = glm::normalize(light->GetLocation() - hit.loc);
-		glm::dvec3 cd = kd * std::max(0.0, glm::dot(lightVec, hit.nor));
-
-		return light->SampleLight(hit.loc) * cd;
-	}
 };
\ No newline at end of file
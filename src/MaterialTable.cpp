@@ -0,0 +1,12 @@
+#pragma once
+#include "MaterialTable.h"
+#include "Microfacet.h"
+
+void MaterialTable::Set(int materialId, const Material& material) {
+	diffuse[materialId] = material.kd;
+	specular[materialId] = material.ks;
+	emission[materialId] = material.ke;
+	reflectance[materialId] = material.reflectance;
+	roughness[materialId] = material.roughness;
+	specularTypes[materialId] = GGX::IsMirror(material.roughness) ? SpecularType::MIRROR : SpecularType::GLOSSY;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include "SceneObject.h"
+#include "Material.h"
+
+// What the specular part of a material does with the rays that its reflectance sends off, decided once per material
+// instead of on every bounce
+enum class SpecularType : uint8_t {
+	// Reflect in exactly one direction
+	MIRROR,
+	// GGX microfacet reflection
+	GLOSSY
+};
+
+// Every material in the scene compiled into one array per property, indexed by material ID (see
+// SceneObject::materialId). Shading a hit only reads the properties it needs, from arrays that stay small and contiguous
+// however the materials were allocated
+class MaterialTable {
+public:
+	MaterialTable() = default;
+
+	// Replace the table with one entry per material, in order
+	template<typename MaterialList>
+	void Build(const MaterialList& materials) {
+		size_t count = materials.size();
+		diffuse.resize(count);
+		specular.resize(count);
+		emission.resize(count);
+		reflectance.resize(count);
+		roughness.resize(count);
+		specularTypes.resize(count);
+		size_t materialId = 0;
+		for (const Material& material : materials) {
+			Set((int)materialId++, material);
+		}
+	}
+
+	int Size() const { return (int)diffuse.size(); }
+	const glm::dvec3& GetDiffuse(int materialId) const { return diffuse[materialId]; }
+	const glm::dvec3& GetSpecular(int materialId) const { return specular[materialId]; }
+	const glm::dvec3& GetEmission(int materialId) const { return emission[materialId]; }
+	double GetReflectance(int materialId) const { return reflectance[materialId]; }
+	double GetRoughness(int materialId) const { return roughness[materialId]; }
+	SpecularType GetSpecularType(int materialId) const { return specularTypes[materialId]; }
+
+private:
+	void Set(int materialId, const Material& material);
+
+	std::vector<glm::dvec3> diffuse;
+	std::vector<glm::dvec3> specular;
+	std::vector<glm::dvec3> emission;
+	std::vector<double> reflectance;
+	std::vector<double> roughness;
+	std::vector<SpecularType> specularTypes;
+};
@@ -0,0 +1,89 @@
+#pragma once
+#include <iostream>
+#include <algorithm>
+#include "Merge.h"
+#include "AccumulationBuffer.h"
+#include "Image.h"
+#include "ImageWriter.h"
+#include "Renderer.h"
+
+using namespace std;
+using namespace glm;
+
+bool MergeShards(const std::string& imageFile, const std::vector<std::string>& checkpointFiles,
+	const std::string& mergedCheckpointFile) {
+	if (checkpointFiles.empty()) {
+		cerr << "ERROR: no checkpoints to merge" << endl;
+		return false;
+	}
+	AccumulationBuffer merged;
+	CheckpointInfo mergedInfo;
+	// File that each shard index came from, so the same shard is never added twice
+	vector<string> shardFiles;
+	for (size_t i = 0; i < checkpointFiles.size(); i++) {
+		AccumulationBuffer shard;
+		CheckpointInfo info;
+		if (!shard.LoadCheckpoint(checkpointFiles[i], info)) return false;
+		if (i == 0) {
+			merged = std::move(shard);
+			mergedInfo = info;
+			shardFiles.assign(info.shardCount, string());
+		}
+		else {
+			// Shards of other renders have samples from other sequences, and would be averaged with correlated samples
+			if (!info.IsSameRender(mergedInfo)) {
+				cerr << "ERROR: " << checkpointFiles[i] << " was rendered with " << Renderer::DescribeCheckpoint(info);
+				cerr << ", but " << checkpointFiles[0] << " was rendered with " << Renderer::DescribeCheckpoint(mergedInfo) << endl;
+				return false;
+			}
+			if (!shardFiles[info.shardIndex].empty()) {
+				cerr << "ERROR: " << checkpointFiles[i] << " and " << shardFiles[info.shardIndex] << " are both shard ";
+				cerr << info.shardIndex << " of " << info.shardCount << endl;
+				return false;
+			}
+			if (!merged.Merge(shard)) {
+				cerr << "ERROR: " << checkpointFiles[i] << " is " << shard.GetWidth() << "x" << shard.GetHeight();
+				cerr << ", but " << checkpointFiles[0] << " is " << merged.GetWidth() << "x" << merged.GetHeight() << endl;
+				return false;
+			}
+		}
+		shardFiles[info.shardIndex] = checkpointFiles[i];
+	}
+	int numMissing = (int)std::count(shardFiles.begin(), shardFiles.end(), string());
+
+	// A pixel with no samples means that no shard rendered it (i.e. a missing tile shard)
+	int minSamples = merged.GetMinSampleCount();
+	double totalPixels = (double)merged.GetWidth() * merged.GetHeight();
+	cout << "Merged " << checkpointFiles.size() << " checkpoints: " << (merged.GetTotalSampleCount() / totalPixels);
+	cout << " samples per pixel on average (min " << minSamples << ", max " << merged.GetMaxSampleCount() << ")" << endl;
+	if (minSamples == 0) {
+		cerr << "WARNING: some pixels have no samples, a shard may be missing" << endl;
+	}
+
+	if (numMissing > 0) {
+		cerr << "WARNING: " << numMissing << " of the " << mergedInfo.shardCount << " shards are missing" << endl;
+	}
+
+	bool success = true;
+	if (!mergedCheckpointFile.empty() && numMissing > 0) {
+		// Resuming it would render some of the missing samples again with the wrong indices
+		cerr << "ERROR: the merged checkpoint can only be saved once every shard is merged" << endl;
+		success = false;
+	}
+	else if (!mergedCheckpointFile.empty()) {
+		// Every shard's samples are in it, so it's the same as an unsharded render
+		CheckpointInfo info = mergedInfo;
+		info.shardMode = 0;
+		info.shardIndex = 0;
+		info.shardCount = 1;
+		success = merged.SaveCheckpoint(mergedCheckpointFile, info);
+		if (success) cout << "Saved merged checkpoint to " << mergedCheckpointFile << endl;
+	}
+	Image image(merged.GetWidth(), merged.GetHeight());
+	for (int row = 0; row < merged.GetHeight(); row++) {
+		for (int col = 0; col < merged.GetWidth(); col++) {
+			image.setPixel(col, row, vec3(merged.GetMean(row, col)));
+		}
+	}
+	return WriteImage(imageFile, image, PostProcessSettings()) && success;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Combine the checkpoints saved by the shards of a distributed render (see RenderSettings::shardCount) into one image,
+// adding up every shard's samples. The merged samples can also be saved as a checkpoint, to keep rendering it with
+// --resume (empty = don't save one), but only once every shard is merged. Returns false if a checkpoint couldn't be read,
+// the checkpoints come from renders with different sizes or sample settings, or the same shard is given twice
+bool MergeShards(const std::string& imageFile, const std::vector<std::string>& checkpointFiles,
+	const std::string& mergedCheckpointFile);
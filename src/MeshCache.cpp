@@ -0,0 +1,224 @@
+#pragma once
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+#include <sys/stat.h>
+
+#include "MeshCache.h"
+
+using namespace std;
+
+namespace {
+	// Arrays stored in a cache file, in order
+	enum ArrayIndex {
+		NORMALS,
+		TRIANGLE_INDICES,
+		// TriangleList::numArrays component arrays of the triangles' intersection data
+		TRIANGLE_DATA,
+		BVH_NODES = TRIANGLE_DATA + TriangleList::numArrays,
+		BVH_PRIMITIVES,
+		NUM_ARRAYS
+	};
+
+	// Start of every cache file. Followed by the arrays, at the given offsets from the start of the file
+	struct CacheHeader {
+		char magic[8];
+		uint32_t version;
+		// sizeof(Real) of the renderer that wrote the cache
+		uint32_t realSize;
+		// BVHBuildMethod of the BVH
+		uint32_t bvhMethod;
+		// Keeps the 64 bit fields below aligned
+		uint32_t reserved;
+		uint64_t sourceSize;
+		int64_t sourceModifiedTime;
+		uint64_t sourceHash;
+		uint64_t arrayOffsets[NUM_ARRAYS];
+		// Number of elements in each array
+		uint64_t arrayCounts[NUM_ARRAYS];
+	};
+	const char cacheMagic[8] = { 'R', 'T', 'M', 'E', 'S', 'H', '\0', '\0' };
+	// Every array starts on a multiple of this, so its elements are aligned when used straight out of the mapping
+	constexpr uint64_t arrayAlignment = 16;
+
+	static_assert(std::is_trivially_copyable<rvec3>::value, "Mesh cache arrays are stored as raw bytes");
+	static_assert(std::is_trivially_copyable<TriangleIndices>::value, "Mesh cache arrays are stored as raw bytes");
+	static_assert(std::is_trivially_copyable<BVHNode>::value, "Mesh cache arrays are stored as raw bytes");
+
+	uint64_t AlignOffset(uint64_t offset) {
+		return (offset + arrayAlignment - 1) / arrayAlignment * arrayAlignment;
+	}
+
+	// Get a view of one of the file's arrays, or return false if it doesn't fit within the file
+	template<class T>
+	bool GetArray(const MappedFile& file, const CacheHeader& header, int arrayIdx, ArrayView<T>& outArray) {
+		uint64_t offset = header.arrayOffsets[arrayIdx];
+		uint64_t count = header.arrayCounts[arrayIdx];
+		if (offset % arrayAlignment != 0 || offset > file.GetSize() || count > (file.GetSize() - offset) / sizeof(T)) {
+			return false;
+		}
+		outArray = ArrayView<T>((const T*)(file.GetData() + offset), (size_t)count);
+		return true;
+	}
+
+	template<class T>
+	void WriteArray(ofstream& file, uint64_t offset, ArrayView<T> array) {
+		// Pad up to the array's offset
+		static const char zeros[arrayAlignment] = {};
+		file.write(zeros, (streamsize)(offset - (uint64_t)file.tellp()));
+		if (!array.empty()) file.write((const char*)array.data(), (streamsize)(array.size() * sizeof(T)));
+	}
+}
+
+string MeshCache::GetCacheFileName(const string& meshFile) {
+	// Float and double builds store different arrays, so give them separate caches rather than overwriting each other's
+#ifdef SINGLE_PRECISION
+	return meshFile + ".float.meshcache";
+#else
+	return meshFile + ".meshcache";
+#endif
+}
+
+shared_ptr<const MappedFile> MeshCache::Read(const string& meshFile, BVHBuildMethod bvhMethod,
+	ArrayView<rvec3>& normals, ArrayView<TriangleIndices>& triIndices, TriangleList& triangles, BVH& bvh) {
+	shared_ptr<MappedFile> cache = make_shared<MappedFile>();
+	if (!cache->Open(GetCacheFileName(meshFile))) return nullptr;
+	if (cache->GetSize() < sizeof(CacheHeader)) return nullptr;
+	CacheHeader header;
+	memcpy(&header, cache->GetData(), sizeof(CacheHeader));
+	if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != version ||
+		header.realSize != sizeof(Real) || header.bvhMethod != (uint32_t)bvhMethod) {
+		return nullptr;
+	}
+
+	// Matching size and time means the source hasn't been touched since the cache was written. If only the time has
+	// changed (e.g. the file was copied or checked out again), the contents may still be the same, so compare hashes
+	SourceInfo source;
+	if (!GetSourceInfo(meshFile, false, source) || source.size != header.sourceSize) return nullptr;
+	if (source.modifiedTime != header.sourceModifiedTime) {
+		if (!GetSourceInfo(meshFile, true, source) || source.hash != header.sourceHash) return nullptr;
+	}
+
+	ArrayView<rvec3> cachedNormals;
+	ArrayView<TriangleIndices> cachedTris;
+	ArrayView<Real> triangleData[TriangleList::numArrays];
+	ArrayView<BVHNode> cachedNodes;
+	ArrayView<int> cachedPrims;
+	if (!GetArray(*cache, header, NORMALS, cachedNormals) ||
+		!GetArray(*cache, header, TRIANGLE_INDICES, cachedTris) ||
+		!GetArray(*cache, header, BVH_NODES, cachedNodes) ||
+		!GetArray(*cache, header, BVH_PRIMITIVES, cachedPrims)) {
+		return nullptr;
+	}
+	for (int i = 0; i < TriangleList::numArrays; i++) {
+		if (!GetArray(*cache, header, TRIANGLE_DATA + i, triangleData[i]) || triangleData[i].size() != cachedTris.size()) {
+			return nullptr;
+		}
+	}
+
+	// Make sure that a damaged cache can't send indices out of bounds during rendering
+	size_t numTris = cachedTris.size();
+	if (cachedPrims.size() != numTris) return nullptr;
+	for (const TriangleIndices& indices : cachedTris) {
+		for (int v = 0; v < 3; v++) {
+			if (indices.nor[v] >= cachedNormals.size()) return nullptr;
+		}
+	}
+	for (int prim : cachedPrims) {
+		if (prim < 0 || (size_t)prim >= numTris) return nullptr;
+	}
+	if (!BVH::IsValidTree(cachedNodes, numTris)) return nullptr;
+
+	normals = cachedNormals;
+	triIndices = cachedTris;
+	triangles.Load(triangleData);
+	bvh.Load(cachedNodes, cachedPrims);
+	return cache;
+}
+
+bool MeshCache::Write(const string& meshFile, BVHBuildMethod bvhMethod, ArrayView<rvec3> normals,
+	ArrayView<TriangleIndices> triIndices, const TriangleList& triangles, const BVH& bvh) {
+	SourceInfo source;
+	if (!GetSourceInfo(meshFile, true, source)) return false;
+
+	CacheHeader header = {};
+	memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+	header.version = version;
+	header.realSize = sizeof(Real);
+	header.bvhMethod = (uint32_t)bvhMethod;
+	header.sourceSize = source.size;
+	header.sourceModifiedTime = source.modifiedTime;
+	header.sourceHash = source.hash;
+	header.arrayCounts[NORMALS] = normals.size();
+	header.arrayCounts[TRIANGLE_INDICES] = triIndices.size();
+	for (int i = 0; i < TriangleList::numArrays; i++) {
+		header.arrayCounts[TRIANGLE_DATA + i] = triangles.GetArray(i).size();
+	}
+	header.arrayCounts[BVH_NODES] = bvh.GetNodes().size();
+	header.arrayCounts[BVH_PRIMITIVES] = bvh.GetPrimitiveIndices().size();
+
+	// Lay the arrays out one after the other
+	const size_t elementSizes[NUM_ARRAYS] = { sizeof(rvec3), sizeof(TriangleIndices),
+		sizeof(Real), sizeof(Real), sizeof(Real), sizeof(Real), sizeof(Real), sizeof(Real), sizeof(Real), sizeof(Real),
+		sizeof(Real), sizeof(BVHNode), sizeof(int) };
+	static_assert(TriangleList::numArrays == 9, "elementSizes lists one entry per triangle component array");
+	uint64_t offset = sizeof(CacheHeader);
+	for (int i = 0; i < NUM_ARRAYS; i++) {
+		header.arrayOffsets[i] = AlignOffset(offset);
+		offset = header.arrayOffsets[i] + header.arrayCounts[i] * elementSizes[i];
+	}
+
+	// Write to a temporary file and move it into place once it's complete, so that a render that's interrupted (or
+	// another one reading the cache at the same time) never sees half of a file
+	string cacheFile = GetCacheFileName(meshFile);
+	string tempFile = cacheFile + ".tmp";
+	{
+		ofstream file(tempFile, ios::binary | ios::trunc);
+		if (!file) return false;
+		file.write((const char*)&header, sizeof(CacheHeader));
+		WriteArray(file, header.arrayOffsets[NORMALS], normals);
+		WriteArray(file, header.arrayOffsets[TRIANGLE_INDICES], triIndices);
+		for (int i = 0; i < TriangleList::numArrays; i++) {
+			WriteArray(file, header.arrayOffsets[TRIANGLE_DATA + i], triangles.GetArray(i));
+		}
+		WriteArray(file, header.arrayOffsets[BVH_NODES], bvh.GetNodes());
+		WriteArray(file, header.arrayOffsets[BVH_PRIMITIVES], bvh.GetPrimitiveIndices());
+		if (!file) {
+			file.close();
+			std::remove(tempFile.c_str());
+			return false;
+		}
+	}
+	// rename() won't replace an existing file on Windows
+	std::remove(cacheFile.c_str());
+	if (std::rename(tempFile.c_str(), cacheFile.c_str()) != 0) {
+		std::remove(tempFile.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool MeshCache::GetSourceInfo(const string& meshFile, bool computeHash, SourceInfo& outInfo) {
+	struct stat st;
+	if (stat(meshFile.c_str(), &st) != 0) return false;
+	outInfo.size = (uint64_t)st.st_size;
+	outInfo.modifiedTime = (int64_t)st.st_mtime;
+	outInfo.hash = 0;
+	if (computeHash) {
+		MappedFile source;
+		if (!source.Open(meshFile)) return false;
+		outInfo.hash = HashBytes(source.GetData(), source.GetSize());
+	}
+	return true;
+}
+
+uint64_t MeshCache::HashBytes(const uint8_t* data, size_t size) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "Real.h"
+#include "ArrayView.h"
+#include "MappedFile.h"
+#include "Triangle.h"
+#include "BVH.h"
+
+// Binary cache of a parsed and preprocessed mesh file, saved next to it (bunny.obj -> bunny.obj.meshcache, or
+// bunny.obj.float.meshcache in single-precision builds)
+// Holds the arrays exactly as they're used for rendering: the normals, the triangles' indices and intersection data in
+// BVH leaf order, and the BVH nodes. Loading a cached mesh maps the file and points the mesh at it, with no parsing,
+// no BVH build and no copies, and every process rendering the same mesh shares the same read-only pages
+// Caches record the size, modification time, and a hash of the file they were built from, and are ignored once it changes
+// They also record how their BVH was built, since that decides the order of the triangles (and so which triangle an
+// emissive mesh's light samples land on), and are only used by renders that asked for the same method
+class MeshCache {
+public:
+	static std::string GetCacheFileName(const std::string& meshFile);
+
+	// Map the cache for meshFile and point the arrays at it. The returned file has to be kept alive for as long as they're
+	// used. Returns null (and leaves the arrays alone) if there is no cache, it's out of date or unreadable, or its BVH
+	// wasn't built with bvhMethod
+	static std::shared_ptr<const MappedFile> Read(const std::string& meshFile, BVHBuildMethod bvhMethod,
+		ArrayView<rvec3>& normals, ArrayView<TriangleIndices>& triIndices, TriangleList& triangles, BVH& bvh);
+	// Save the cache for meshFile, with a BVH built by bvhMethod. triIndices and triangles must already be in the BVH's
+	// leaf order
+	static bool Write(const std::string& meshFile, BVHBuildMethod bvhMethod, ArrayView<rvec3> normals,
+		ArrayView<TriangleIndices> triIndices, const TriangleList& triangles, const BVH& bvh);
+
+private:
+	// Identifies the contents of the source file
+	struct SourceInfo {
+		uint64_t size = 0;
+		int64_t modifiedTime = 0;
+		uint64_t hash = 0;
+	};
+	// Read the source file's size and modification time, and hash its contents if computeHash is set
+	static bool GetSourceInfo(const std::string& meshFile, bool computeHash, SourceInfo& outInfo);
+	// 64 bit FNV-1a hash
+	static uint64_t HashBytes(const uint8_t* data, size_t size);
+
+	// Bump this whenever the layout of the cache or of any of the structs it stores changes
+	static constexpr uint32_t version = 3;
+};
@@ -0,0 +1,182 @@
+#pragma once
+#include <chrono>
+#include "MeshGeometry.h"
+#include "MeshCache.h"
+
+using namespace std;
+using namespace glm;
+
+shared_ptr<const MeshGeometry> MeshGeometry::Get(const std::string& filename, const BVHBuildSettings& bvhSettings) {
+	static mutex registryLock;
+	static unordered_map<string, weak_ptr<MeshGeometry> > registry;
+
+	shared_ptr<MeshGeometry> geometry;
+	{
+		lock_guard<mutex> lock(registryLock);
+		geometry = registry[filename].lock();
+		if (!geometry) {
+			geometry = make_shared<MeshGeometry>();
+			registry[filename] = geometry;
+		}
+	}
+	// Load outside of the registry lock, so different files can load on different threads at the same time. Threads that
+	// asked for the same file wait here until the first one has finished loading it
+	// Files that fail to load are kept as empty meshes too, so every instance of them doesn't report the same error
+	std::call_once(geometry->loadOnce, [&]() { geometry->Load(filename, bvhSettings); });
+	return geometry;
+}
+
+rvec4 MeshGeometry::BaryInterpNorm(int triIdx, Real u, Real v) const {
+	const TriangleIndices& indices = triIndices[triIdx];
+	// u, v = barycentric coords corresponding to vert1, vert2
+	rvec3 interp = normals[indices.nor[0]] * (1 - u - v) +
+		normals[indices.nor[1]] * u +
+		normals[indices.nor[2]] * v;
+	return rvec4(normalize(interp), 0);
+}
+
+shared_ptr<const MeshGeometry> MeshGeometry::Transformed(const rmat4& modelMtx) const {
+	shared_ptr<MeshGeometry> result = make_shared<MeshGeometry>();
+	// Normals use the inverse transpose, and have to be renormalized after non-uniform scales
+	rmat4 invTranspMtx = transpose(inverse(modelMtx));
+	result->normalStorage.reserve(normals.size());
+	for (const rvec3& normal : normals) {
+		result->normalStorage.push_back(normalize(rvec3(invTranspMtx * rvec4(normal, 0))));
+	}
+	result->triIndexStorage.assign(triIndices.begin(), triIndices.end());
+
+	// Keep the triangles in the same (leaf) order, so the BVH's leaves still refer to the same ranges
+	vector<AABB> triBounds;
+	triBounds.reserve(triangles.Size());
+	result->triangles.Reserve(triangles.Size());
+	for (int triIdx = 0; triIdx < (int)triangles.Size(); triIdx++) {
+		rvec3 p0 = rvec3(modelMtx * rvec4(triangles.GetVertex0(triIdx), 1));
+		rvec3 p1 = p0 + rvec3(modelMtx * rvec4(triangles.GetEdge1(triIdx), 0));
+		rvec3 p2 = p0 + rvec3(modelMtx * rvec4(triangles.GetEdge2(triIdx), 0));
+		result->triangles.Add(p0, p1, p2);
+		triBounds.push_back(result->triangles.GetBounds(triIdx));
+	}
+	result->bvh.Load(bvh.GetNodes(), bvh.GetPrimitiveIndices());
+	result->bvh.Refit(triBounds);
+	result->normals = result->normalStorage;
+	result->triIndices = result->triIndexStorage;
+	return result;
+}
+
+bool MeshGeometry::Load(const std::string& filename, const BVHBuildSettings& bvhSettings) {
+	meshCache = MeshCache::Read(filename, bvhSettings.method, normals, triIndices, triangles, bvh);
+	if (!meshCache) {
+		if (!ParseObjFile(filename, bvhSettings)) return false;
+		// Fast builds are cheap enough to redo every time, and caching them would replace the SAH cache that full renders use
+		if (bvhSettings.method != BVHBuildMethod::SAH) return true;
+		// Switch over to the cache that was just written, so this render shares one copy of the mesh with later ones
+		if (MeshCache::Write(filename, bvhSettings.method, normals, triIndices, triangles, bvh)) {
+			meshCache = MeshCache::Read(filename, bvhSettings.method, normals, triIndices, triangles, bvh);
+		}
+		else {
+			cerr << "WARNING: unable to write mesh cache " << MeshCache::GetCacheFileName(filename) << endl;
+		}
+		if (meshCache) {
+			normalStorage = vector<rvec3>();
+			triIndexStorage = vector<TriangleIndices>();
+		}
+	}
+	return true;
+}
+
+bool MeshGeometry::ParseObjFile(const std::string& filename, const BVHBuildSettings& bvhSettings) {
+	//LOAD GEOMETRY
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	string errStr;
+	bool rc = tinyobj::LoadObj(&attrib, &shapes, &materials, &errStr, filename.c_str());
+	if (!rc) {
+		cerr << errStr << endl;
+		return false;
+	}
+
+	// OBJ files are already indexed, so copy the position and normal lists as they are
+	// Positions are only needed to build the triangles, the intersection data replaces them afterwards
+	vector<rvec3> vertices;
+	vertices.reserve(attrib.vertices.size() / 3);
+	for (size_t i = 0; i + 2 < attrib.vertices.size(); i += 3) {
+		vertices.push_back(rvec3(attrib.vertices[i + 0], attrib.vertices[i + 1], attrib.vertices[i + 2]));
+	}
+	normalStorage.clear();
+	normalStorage.reserve(attrib.normals.size() / 3);
+	for (size_t i = 0; i + 2 < attrib.normals.size(); i += 3) {
+		normalStorage.push_back(rvec3(attrib.normals[i + 0], attrib.normals[i + 1], attrib.normals[i + 2]));
+	}
+	// Release tinyobj's copy of the buffers before the rest of the mesh is built on top of it
+	attrib = tinyobj::attrib_t();
+
+	size_t numFaces = 0;
+	for (const tinyobj::shape_t& shape : shapes) {
+		numFaces += shape.mesh.num_face_vertices.size();
+	}
+	vector<TriangleIndices> unsortedIndices;
+	unsortedIndices.reserve(numFaces);
+
+	// Loop over shapes
+	for (size_t s = 0; s < shapes.size(); s++) {
+		// Loop over faces (LoadObj triangulates by default, so every face should have 3 vertices)
+		size_t index_offset = 0;
+		for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
+			size_t fv = shapes[s].mesh.num_face_vertices[f];
+			if (fv == 3) {
+				TriangleIndices indices;
+				bool hasNormals = true;
+				for (size_t v = 0; v < 3; v++) {
+					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+					indices.vert[v] = (uint32_t)idx.vertex_index;
+					indices.nor[v] = (uint32_t)idx.normal_index;
+					hasNormals &= (idx.normal_index >= 0);
+				}
+				// Faces without a normal on every corner (i.e. "f 1//1 2 3") use the flat face normal instead
+				if (!hasNormals) {
+					rvec3 faceNor = normalize(cross(
+						vertices[indices.vert[1]] - vertices[indices.vert[0]],
+						vertices[indices.vert[2]] - vertices[indices.vert[0]]));
+					normalStorage.push_back(faceNor);
+					indices.nor[0] = indices.nor[1] = indices.nor[2] = (uint32_t)(normalStorage.size() - 1);
+				}
+				unsortedIndices.push_back(indices);
+			}
+			index_offset += fv;
+		}
+		// Each shape's face lists aren't needed once its triangles have been copied
+		shapes[s] = tinyobj::shape_t();
+	}
+
+	// Build the acceleration structure over the triangles' bounds
+	{
+		vector<AABB> triBounds;
+		triBounds.reserve(unsortedIndices.size());
+		for (const TriangleIndices& indices : unsortedIndices) {
+			AABB bounds;
+			for (int v = 0; v < 3; v++) {
+				bounds.Expand(vertices[indices.vert[v]]);
+			}
+			triBounds.push_back(bounds);
+		}
+		auto buildStart = chrono::steady_clock::now();
+		bvh.Build(triBounds, 4, bvhSettings);
+		bvhBuildSeconds = chrono::duration<double>(chrono::steady_clock::now() - buildStart).count();
+	}
+
+	// Store the triangles in BVH leaf order, so that each leaf's triangles sit next to each other in memory
+	triIndexStorage.clear();
+	triIndexStorage.reserve(unsortedIndices.size());
+	triangles = TriangleList();
+	triangles.Reserve(unsortedIndices.size());
+	for (int triIdx : bvh.GetPrimitiveIndices()) {
+		const TriangleIndices& indices = unsortedIndices[triIdx];
+		triangles.Add(vertices[indices.vert[0]], vertices[indices.vert[1]], vertices[indices.vert[2]]);
+		triIndexStorage.push_back(indices);
+	}
+	bvh.AdoptPrimitiveOrder();
+	normals = normalStorage;
+	triIndices = triIndexStorage;
+	return true;
+}
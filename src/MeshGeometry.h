@@ -0,0 +1,68 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <iostream>
+
+#include "tiny_obj_loader.h"
+
+#include "Real.h"
+#include "Triangle.h"
+#include "BVH.h"
+#include "ArrayView.h"
+#include "MappedFile.h"
+
+// Triangles, normals and BVH of one mesh file, in the mesh's local space. Geometry is read-only once it's loaded, so any
+// number of TriangleMesh instances (each with its own transform and material) can share it
+class MeshGeometry {
+public:
+	// Geometry of the given OBJ file, shared with every other mesh that asked for the same file name. Each file is only
+	// loaded once, while any instance of it is alive. Its parsed triangles and BVH are also cached in a binary file next
+	// to it and used straight out of that file (memory-mapped), so every render of the mesh shares one read-only copy
+	// Safe to call from several threads at once. A file's BVH is built with the settings of whichever call loaded it
+	// Only SAH hierarchies are cached. Morton-built ones are rebuilt by every render, so a mesh's triangle order only
+	// depends on the build method, never on whether a cache file exists
+	static std::shared_ptr<const MeshGeometry> Get(const std::string& filename,
+		const BVHBuildSettings& bvhSettings = BVHBuildSettings());
+
+	MeshGeometry() = default;
+	MeshGeometry(const MeshGeometry&) = delete;
+	MeshGeometry& operator=(const MeshGeometry&) = delete;
+
+	const TriangleList& GetTriangles() const { return triangles; }
+	const BVH& GetBVH() const { return bvh; }
+	// Time it took to build the BVH, 0 if it came out of the mesh cache
+	double GetBVHBuildSeconds() const { return bvhBuildSeconds; }
+	// Interpolate the vertex normals of a triangle using the barycentric coords from an intersection
+	rvec4 BaryInterpNorm(int triIdx, Real u, Real v) const;
+	// Copy of this geometry with the given local->world matrix baked into the triangles and normals, for meshes that
+	// don't share their geometry. The copy isn't cached, and its BVH keeps this one's structure with refit bounds
+	std::shared_ptr<const MeshGeometry> Transformed(const rmat4& modelMtx) const;
+
+private:
+	// Load from the mesh cache if it's up to date, otherwise parse the OBJ file and cache it
+	bool Load(const std::string& filename, const BVHBuildSettings& bvhSettings);
+	// Parse an OBJ file into the normal and index buffers, build the BVH, and fill in the triangles in leaf order
+	bool ParseObjFile(const std::string& filename, const BVHBuildSettings& bvhSettings);
+
+	// Vertex normals, shared between the triangles that use them
+	ArrayView<rvec3> normals;
+	// Per-triangle indices into the normal buffer, in the same order as triangles
+	ArrayView<TriangleIndices> triIndices;
+	// Precomputed intersection data for every triangle, stored in BVH leaf order
+	TriangleList triangles;
+	// Hierarchy over the triangles
+	BVH bvh;
+	double bvhBuildSeconds = 0;
+	// Mapped cache file that the arrays above point into. Empty if the mesh was parsed and couldn't be cached, in which
+	// case they point into the storage below instead
+	std::shared_ptr<const MappedFile> meshCache;
+	std::vector<rvec3> normalStorage;
+	std::vector<TriangleIndices> triIndexStorage;
+	// Used by Get to load each file exactly once
+	std::once_flag loadOnce;
+};
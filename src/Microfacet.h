@@ -0,0 +1,86 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/ext/scalar_constants.hpp>
+#include <cmath>
+#include <algorithm>
+
+// Below this alpha (roughness squared), reflections are treated as a perfect mirror (the distribution is too spiky to
+// sample or evaluate reliably)
+constexpr double ggxMinAlpha = 1e-4;
+
+// GGX (Trowbridge-Reitz) microfacet distribution, used for glossy reflections
+// Directions are in a local shading frame where the surface normal is +z, and both point away from the surface
+class GGX {
+public:
+	// Roughness is squared first, so that it changes the look of the surface evenly from 0 to 1
+	GGX(double roughness) : alpha(std::max(roughness * roughness, ggxMinAlpha)) {}
+
+	static bool IsMirror(double roughness) { return roughness * roughness < ggxMinAlpha; }
+
+	// Density of microfacet normals around h
+	double D(const glm::dvec3& h) const {
+		double cos2 = h.z * h.z;
+		double tmp = cos2 * (alpha * alpha - 1) + 1;
+		return alpha * alpha / (glm::pi<double>() * tmp * tmp);
+	}
+	// Fraction of the microfacets facing w that aren't hidden by other microfacets (Smith)
+	double G1(const glm::dvec3& w) const { return 1 / (1 + Lambda(w)); }
+	// Fraction of the microfacets that are visible from both directions (height-correlated Smith)
+	double G(const glm::dvec3& wo, const glm::dvec3& wi) const { return 1 / (1 + Lambda(wo) + Lambda(wi)); }
+
+	// Reflected fraction of light from wi to wo, without the Fresnel/specular color term
+	double Evaluate(const glm::dvec3& wo, const glm::dvec3& wi) const {
+		if (wo.z <= 0 || wi.z <= 0) return 0;
+		glm::dvec3 h = glm::normalize(wo + wi);
+		return D(h) * G(wo, wi) / (4 * wo.z * wi.z);
+	}
+	// Solid angle pdf of Sample reflecting wo into wi
+	double Pdf(const glm::dvec3& wo, const glm::dvec3& wi) const {
+		if (wo.z <= 0 || wi.z <= 0) return 0;
+		glm::dvec3 h = glm::normalize(wo + wi);
+		return G1(wo) * D(h) / (4 * wo.z);
+	}
+
+	// Choose a reflected direction, by picking a microfacet normal that is visible from wo
+	// ("Sampling the GGX Distribution of Visible Normals", Heitz 2018). u is a uniform point in [0, 1)^2
+	// Evaluate * wi.z / Pdf for the result is G(wo, wi) / G1(wo), so the weight of the sample never blows up
+	glm::dvec3 Sample(const glm::dvec3& wo, const glm::dvec2& u) const {
+		// Stretch the view direction, so that the distribution becomes a hemisphere
+		glm::dvec3 vh = glm::normalize(glm::dvec3(alpha * wo.x, alpha * wo.y, wo.z));
+		double lenSqr = vh.x * vh.x + vh.y * vh.y;
+		glm::dvec3 t1 = (lenSqr > 0) ? glm::dvec3(-vh.y, vh.x, 0) / std::sqrt(lenSqr) : glm::dvec3(1, 0, 0);
+		glm::dvec3 t2 = glm::cross(vh, t1);
+		// Uniform point on the projected disk, squashed onto the half of it that can be seen from wo
+		double r = std::sqrt(u.x);
+		double phi = 2 * glm::pi<double>() * u.y;
+		double p1 = r * std::cos(phi);
+		double p2 = r * std::sin(phi);
+		double s = 0.5 * (1 + vh.z);
+		p2 = (1 - s) * std::sqrt(1 - p1 * p1) + s * p2;
+		glm::dvec3 nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.0, 1 - p1 * p1 - p2 * p2)) * vh;
+		// Unstretch the normal, then reflect around it
+		glm::dvec3 h = glm::normalize(glm::dvec3(alpha * nh.x, alpha * nh.y, std::max(0.0, nh.z)));
+		return glm::reflect(-wo, h);
+	}
+
+	// Build an orthonormal frame around a unit normal, for converting directions to/from the local shading frame
+	// ("Building an Orthonormal Basis, Revisited", Duff et al. 2017)
+	static void CreateFrame(const glm::dvec3& n, glm::dvec3& outTangent, glm::dvec3& outBitangent) {
+		double sign = std::copysign(1.0, n.z);
+		double a = -1 / (sign + n.z);
+		double b = n.x * n.y * a;
+		outTangent = glm::dvec3(1 + sign * n.x * n.x * a, sign * b, -sign * n.x);
+		outBitangent = glm::dvec3(b, sign + n.y * n.y * a, -n.y);
+	}
+
+private:
+	double Lambda(const glm::dvec3& w) const {
+		double cos2 = w.z * w.z;
+		if (cos2 >= 1) return 0;
+		double tan2 = (1 - cos2) / std::max(cos2, 1e-12);
+		return 0.5 * (-1 + std::sqrt(1 + alpha * alpha * tan2));
+	}
+
+	double alpha;
+};
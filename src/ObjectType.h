@@ -0,0 +1,23 @@
+#pragma once
+
+// Which subclass of SceneObject an object is, so code that isn't virtual (i.e. statistics) can tell them apart
+enum class ObjectType {
+	SPHERE,
+	BOX,
+	PLANE,
+	SQUARE,
+	TRIANGLE_MESH,
+	// Number of object types, not a real type
+	COUNT
+};
+
+inline const char* GetObjectTypeName(ObjectType type) {
+	switch (type) {
+	case ObjectType::SPHERE: return "Sphere";
+	case ObjectType::BOX: return "Box";
+	case ObjectType::PLANE: return "Plane";
+	case ObjectType::SQUARE: return "Square";
+	case ObjectType::TRIANGLE_MESH: return "TriangleMesh";
+	default: return "Unknown";
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include "PFM.h"
+
+using namespace std;
+using namespace glm;
+
+// PFM stores a negative scale for little-endian data
+static bool IsLittleEndian() {
+	uint16_t val = 1;
+	unsigned char firstByte;
+	std::memcpy(&firstByte, &val, 1);
+	return firstByte == 1;
+}
+
+static void SwapBytes(float& val) {
+	unsigned char bytes[4];
+	std::memcpy(bytes, &val, 4);
+	std::swap(bytes[0], bytes[3]);
+	std::swap(bytes[1], bytes[2]);
+	std::memcpy(&val, bytes, 4);
+}
+
+bool WritePFM(const std::string& filename, int width, int height, const vector<dvec3>& pixels) {
+	ofstream file(filename, ios::binary);
+	if (!file.good()) {
+		cerr << "ERROR: Unable to open " << filename << " for writing" << endl;
+		return false;
+	}
+	file << CreatePFMHeader(width, height);
+
+	// PFM rows go from the bottom of the image to the top, same as Image
+	vector<float> row(3 * width);
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			const dvec3& color = pixels[y * width + x];
+			row[3 * x + 0] = (float)color.r;
+			row[3 * x + 1] = (float)color.g;
+			row[3 * x + 2] = (float)color.b;
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+	}
+	return file.good();
+}
+
+bool ReadPFM(const std::string& filename, int& width, int& height, vector<dvec3>& pixels) {
+	ifstream file(filename, ios::binary);
+	string header;
+	float scale;
+	if (!(file >> header >> width >> height >> scale) || header != "PF" || width <= 0 || height <= 0) {
+		cerr << "ERROR: " << filename << " is not an RGB PFM file" << endl;
+		return false;
+	}
+	// Skip the single whitespace character between the header and the pixel data
+	file.get();
+	bool swap = (scale < 0) != IsLittleEndian();
+
+	pixels.assign((size_t)width * height, dvec3(0));
+	vector<float> row(3 * width);
+	for (int y = 0; y < height; y++) {
+		if (!file.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(float))) {
+			cerr << "ERROR: " << filename << " ended before all of the pixels were read" << endl;
+			return false;
+		}
+		for (int x = 0; x < width; x++) {
+			if (swap) {
+				SwapBytes(row[3 * x + 0]);
+				SwapBytes(row[3 * x + 1]);
+				SwapBytes(row[3 * x + 2]);
+			}
+			pixels[y * width + x] = dvec3(row[3 * x + 0], row[3 * x + 1], row[3 * x + 2]);
+		}
+	}
+	return true;
+}
+
+std::string CreatePFMHeader(int width, int height) {
+	return "PF\n" + to_string(width) + " " + to_string(height) + "\n" + (IsLittleEndian() ? "-1.0" : "1.0") + "\n";
+}
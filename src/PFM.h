@@ -0,0 +1,13 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// Read/write linear RGB images as Portable Float Maps, so that renders can be compared without tonemapping or 8-bit
+// quantization getting in the way. Pixels are stored row-by-row, with row 0 at the bottom of the image (same as Image)
+bool WritePFM(const std::string& filename, int width, int height, const std::vector<glm::dvec3>& pixels);
+bool ReadPFM(const std::string& filename, int& width, int& height, std::vector<glm::dvec3>& pixels);
+// Header that WritePFM starts the file with. The header is followed by each row's red, green and blue floats, in the
+// machine's byte order (for writing the rows separately)
+std::string CreatePFMHeader(int width, int height);
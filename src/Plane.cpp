@@ -4,23 +4,23 @@
 using namespace std;
 using namespace glm;
 
-bool Plane::IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax) {
+bool Plane::IntersectLocal(Ray3D& ray, HitResult& outHit, Real tMin, Real tMax) {
 	// Just like the sphere, the ray will be transformed into the local space of this plane, so
 	// assume plane is at the origin, parallel with x-z plane, with no transformations applied 
 
 	// Full equation: t = dot(n, (planeLoc - ray.start)) / dot(n, ray.dir)
 	// Since we're in local space, assume n = <0, 1, 0> and planeLoc = <0, 0, 0>
-	double numerator = (-1.0 * ray.start).y;
-	double denom = ray.dir.y;
+	Real numerator = -ray.start.y;
+	Real denom = ray.dir.y;
 
 	// Rare, but make sure we don't have a divide-by-zero before calculating t
 	if (denom != 0) {
-		double newT = numerator / denom;
+		Real newT = numerator / denom;
 		if (newT > tMin && newT < tMax) {
 			// Try updating the HitResult with whichever t value was the smallest in the range
 			if (outHit.UpdateTMin(newT)) {
 				// If the HitResult ended up finding a new minT, update the normal value in the hit result and return true
-				outHit.nor = dvec4(0, 1, 0, 0);
+				outHit.nor = rvec4(0, 1, 0, 0);
 				return true;
 			}
 		}
@@ -33,7 +33,12 @@ bool Plane::IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tM
 	return false;
 }
 
-glm::dvec4 Plane::GetRandomPointOnSurface(double& pdf, dvec4& normal)
+rvec4 Plane::GetRandomPointOnSurface(const rvec4& refPoint, const glm::dvec2& u, double& pdf, rvec4& normal)
 {
 	return transf.translation;
 }
+
+AABB Plane::GetLocalBounds() const {
+	// Planes are infinite, so return an empty box. The scene tests these against every ray instead
+	return AABB();
+}
@@ -10,8 +10,9 @@
 class Plane : public SceneObject {
 public:
 	// Call parent constructor to create transform matrix and apply material
-	Plane(std::string _name, Transform _transf, std::shared_ptr<Material> _mat) : SceneObject(_name, _transf, _mat) {};
+	Plane(std::string _name, Transform _transf, const Material* _mat) : SceneObject(_name, _transf, _mat, ObjectType::PLANE) {};
 
-	bool IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax) override;
-	glm::dvec4 GetRandomPointOnSurface(double& pdf, glm::dvec4& normal) override;
+	bool IntersectLocal(Ray3D& ray, HitResult& outHit, Real tMin, Real tMax) override;
+	rvec4 GetRandomPointOnSurface(const rvec4& refPoint, const glm::dvec2& u, double& pdf, rvec4& normal) override;
+	AABB GetLocalBounds() const override;
 };
\ No newline at end of file
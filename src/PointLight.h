@@ -8,33 +8,32 @@
 // An infinitely small light with position and color
 struct PointLight : public Light {
 	// Call parent constructor
-	PointLight(std::string _name, double _L, double _Q, double _falloffDistance, glm::dvec4 _loc, glm::dvec3 _color) :
+	PointLight(std::string _name, double _L, double _Q, double _falloffDistance, rvec4 _loc, glm::dvec3 _color) :
 		Light(_name, _L, _Q, _falloffDistance), 
 		loc(_loc),
 		color(_color) {}
 
-	glm::dvec3 SampleLight(glm::dvec4 hitLocation) override {
-		double distance = glm::length(hitLocation - loc);
-		return GetColor() * GetDistanceAttenuation(distance);
+	LightType GetType() const override {
+		return LightType::POINT;
 	}
 
-	double RandomizeLocation() override {
-		// Not randomly sampling location, so pdf is just 1
-		return 1.0;
-	}
-
-	glm::dvec4 GetLocation() override {
+	rvec4 GetLocation() const {
 		return loc;
 	}
+
 	// Returns null, since point lights are not attached to a particular object
-	std::shared_ptr<SceneObject> GetObject() override {
+	SceneObject* GetObject() const override {
 		return nullptr;
 	}
 
-	glm::dvec3 GetColor() override {
+	glm::dvec3 GetColor() const override {
 		return color;
 	}
+
+	double GetEmittedPower() const override {
+		return Luminance(color);
+	}
 private:
-	glm::dvec4 loc = glm::dvec4(0, 0, 0, 1);
+	rvec4 loc = rvec4(0, 0, 0, 1);
 	glm::dvec3 color = glm::dvec3(1, 1, 1);
 };
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+#include <algorithm>
+#include <limits>
+#include "PostProcess.h"
+
+using namespace std;
+using namespace glm;
+
+// Smallest tonemapped value that encodes to each 8-bit sRGB code, found once by bisection on the exact conversion
+// Turns the per-channel pow() into a short branchless search, and gives the same codes as converting each pixel
+static vector<double> CreateSRGBThresholds() {
+	auto encode = [](double val) { return (int)(unsigned char)(255 * Camera::ColorLinearToSRGB(dvec3(val)).r); };
+	vector<double> thresholds(256, 0.0);
+	for (int code = 1; code < 256; code++) {
+		if (encode(1.0) < code) {
+			thresholds[code] = std::numeric_limits<double>::infinity();
+			continue;
+		}
+		double lo = 0.0, hi = 1.0;
+		for (int i = 0; i < 64; i++) {
+			double mid = 0.5 * (lo + hi);
+			if (encode(mid) >= code) hi = mid;
+			else lo = mid;
+		}
+		thresholds[code] = hi;
+	}
+	return thresholds;
+}
+
+void ApplyPostProcess(const Image& image, const PostProcessSettings& settings, vector<unsigned char>& outPixels) {
+	static const vector<double> thresholds = CreateSRGBThresholds();
+	int width = image.getWidth();
+	int height = image.getHeight();
+	int rowLength = 3 * width;
+	outPixels.resize((size_t)rowLength * height);
+
+	// Every channel of a row goes through the same steps, so each stage is a simple loop over contiguous values that the
+	// compiler can vectorize
+	vector<double> row(rowLength);
+	for (int y = 0; y < height; y++) {
+		const float* src = image.getData() + (size_t)y * rowLength;
+		for (int i = 0; i < rowLength; i++) {
+			row[i] = src[i] * settings.exposure;
+		}
+		if (settings.tonemapper == Camera::Tonemapper::ACES_APPROX) {
+			// Same curve as Camera::ApplyTonemapping
+			for (int i = 0; i < rowLength; i++) {
+				double c = row[i];
+				row[i] = (c * (2.51 * c + 0.03)) / (c * (2.43 * c + 0.59) + 0.14);
+			}
+		}
+		for (int i = 0; i < rowLength; i++) {
+			row[i] = std::min(std::max(row[i], 0.0), 1.0);
+		}
+
+		// Images are stored bottom row first, but PNG rows go from the top down
+		unsigned char* dst = &outPixels[(size_t)(height - y - 1) * rowLength];
+		for (int i = 0; i < rowLength; i++) {
+			int code = 0;
+			for (int step = 128; step > 0; step /= 2) {
+				code += (row[i] >= thresholds[code + step]) ? step : 0;
+			}
+			dst[i] = (unsigned char)code;
+		}
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+#include "Camera.h"
+#include "Image.h"
+
+// How linear colors are turned into displayable 8-bit colors
+struct PostProcessSettings {
+	PostProcessSettings() = default;
+	PostProcessSettings(const Camera& camera) : exposure(camera.GetExposure()) {}
+
+	double exposure = 1.0;
+	Camera::Tonemapper tonemapper = Camera::Tonemapper::ACES_APPROX;
+};
+
+// Apply exposure, tonemapping and sRGB encoding to every pixel of the image at once, storing 8-bit RGB with the top row
+// first (the order PNG expects). Works on the whole buffer a stage at a time, instead of pixel by pixel while rendering
+void ApplyPostProcess(const Image& image, const PostProcessSettings& settings, std::vector<unsigned char>& outPixels);
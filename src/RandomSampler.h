@@ -0,0 +1,25 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "Sampler.h"
+
+// Independent random numbers for every dimension, each one hashed from its pixel, sample and dimension instead of
+// drawn from a generator, so they don't depend on the order that samples are taken in
+class RandomSampler : public Sampler {
+public:
+	RandomSampler(int _samplesPerPixel, uint32_t _seed) : Sampler(_samplesPerPixel, _seed) {}
+
+	double Get1D() override {
+		double u = HashToUniform();
+		currentDimension++;
+		return u;
+	}
+
+	glm::dvec2 Get2D() override {
+		double x = HashToUniform();
+		currentDimension++;
+		double y = HashToUniform();
+		currentDimension++;
+		return glm::dvec2(x, y);
+	}
+};
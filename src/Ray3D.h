@@ -1,21 +1,22 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include "Real.h"
 
 struct Ray3D {
-	Ray3D(glm::dvec4 _start, glm::dvec4 _dir) : start(_start), dir(_dir), invDir(1.0 / _dir) {
+	Ray3D(rvec4 _start, rvec4 _dir) : start(_start), dir(_dir), invDir(Real(1.0) / _dir) {
 		sign[0] = (invDir.x < 0) ? -1 : 1;
 		sign[1] = (invDir.y < 0) ? -1 : 1;
 		sign[2] = (invDir.z < 0) ? -1 : 1;
 	}
-	glm::dvec4 start;
-	glm::dvec4 dir;
+	rvec4 start;
+	rvec4 dir;
 	// Cache reciprocal of direction for ray-box intersections
-	glm::dvec4 invDir;
+	rvec4 invDir;
 	// Signs of the x, y, and z components of invDir, either -1 or 1 (used in ray-box intersections)
 	int sign[3];
 
-	glm::dvec4 FindLocAtTime(double time) {
+	rvec4 FindLocAtTime(Real time) const {
 		return start + (time * dir);
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include "SIMD.h"
+#include "Ray3D.h"
+
+// A group of packetSize rays stored as structure-of-arrays, so the packet kernels can load each component of all of the
+// rays with a single vector load. Which lanes hold real rays is tracked separately by the caller as a bitmask
+struct RayPacket {
+	// [axis][lane]
+	Real start[3][packetSize];
+	Real dir[3][packetSize];
+	// Cache reciprocal of direction for ray-box intersections
+	Real invDir[3][packetSize];
+
+	RayPacket() = default;
+
+	// Store a ray in the given lane
+	void SetRay(int lane, const rvec4& _start, const rvec4& _dir) {
+		for (int axis = 0; axis < 3; axis++) {
+			start[axis][lane] = _start[axis];
+			dir[axis][lane] = _dir[axis];
+			invDir[axis][lane] = Real(1.0) / _dir[axis];
+		}
+	}
+	// Copy the ray in srcLane into lane (used to fill unused lanes with a valid ray)
+	void CopyLane(int lane, int srcLane) {
+		for (int axis = 0; axis < 3; axis++) {
+			start[axis][lane] = start[axis][srcLane];
+			dir[axis][lane] = dir[axis][srcLane];
+			invDir[axis][lane] = invDir[axis][srcLane];
+		}
+	}
+
+	Ray3D GetRay(int lane) const {
+		return Ray3D(
+			rvec4(start[0][lane], start[1][lane], start[2][lane], 1),
+			rvec4(dir[0][lane], dir[1][lane], dir[2][lane], 0));
+	}
+
+	// Transform the whole packet by a matrix (i.e. world->local space), a whole SIMD vector of rays at a time
+	RayPacket Transform(const rmat4& mtx) const {
+		RayPacket out;
+		SimdReal s[3], d[3];
+		for (int axis = 0; axis < 3; axis++) {
+			s[axis] = SimdReal::Load(start[axis]);
+			d[axis] = SimdReal::Load(dir[axis]);
+		}
+		for (int row = 0; row < 3; row++) {
+			// glm matrices are column-major, so mtx[col][row]. Points have w = 1 (add translation), directions have w = 0
+			SimdReal newStart = SimdReal::Broadcast(mtx[3][row]);
+			SimdReal newDir;
+			for (int col = 0; col < 3; col++) {
+				SimdReal m = SimdReal::Broadcast(mtx[col][row]);
+				newStart = newStart + m * s[col];
+				newDir = newDir + m * d[col];
+			}
+			newStart.Store(out.start[row]);
+			newDir.Store(out.dir[row]);
+			(SimdReal::Broadcast(1) / newDir).Store(out.invDir[row]);
+		}
+		return out;
+	}
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Scalar type used for all geometry: rays, hits, transforms, bounds and mesh data
+// Defaults to double for reference renders. Build with SINGLE_PRECISION defined (`cmake -DFLOAT=ON ..`) to use float,
+// which halves the memory used by meshes/BVHs and doubles the width of the SIMD packet kernels
+// Colors and light transport math stay in double either way
+#ifdef SINGLE_PRECISION
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
+typedef glm::vec<2, Real> rvec2;
+typedef glm::vec<3, Real> rvec3;
+typedef glm::vec<4, Real> rvec4;
+typedef glm::mat<4, 4, Real> rmat4;
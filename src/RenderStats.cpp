@@ -0,0 +1,31 @@
+#pragma once
+#include <iomanip>
+#include "RenderStats.h"
+
+using namespace std;
+
+void RenderStats::PrintDetails(std::ostream& out) const {
+	// Avoid dividing by 0 when nothing was counted
+	auto percent = [](uint64_t part, uint64_t total) { return (total > 0) ? 100.0 * part / total : 0.0; };
+
+	out << "Rays: " << primaryRays << " primary, " << bounceRays << " bounce, " << shadowRays << " shadow" << endl;
+	out << "Object tests: " << objectTests << endl;
+	for (int i = 0; i < (int)ObjectType::COUNT; i++) {
+		if (objectTestsByType[i] == 0) continue;
+		out << "  " << setw(14) << left << GetObjectTypeName((ObjectType)i) << right << objectTestsByType[i];
+		out << " (" << percent(objectTestsByType[i], objectTests) << "%)" << endl;
+	}
+	out << "Triangle tests: " << triangleTests << endl;
+	out << "BVH box tests: " << boxTests << ", rejected " << boxRejects << " (" << percent(boxRejects, boxTests) << "%)" << endl;
+	out << "Russian roulette: terminated " << rouletteTerminations << " of " << rouletteTests << " tests (";
+	out << percent(rouletteTerminations, rouletteTests) << "%)" << endl;
+
+	uint64_t numPaths = 0;
+	for (int i = 0; i <= maxPathLength; i++) numPaths += pathLengths[i];
+	out << "Path lengths (segments):" << endl;
+	for (int i = 1; i <= maxPathLength; i++) {
+		if (pathLengths[i] == 0) continue;
+		out << "  " << setw(2) << i << ((i == maxPathLength) ? "+" : " ") << setw(12) << pathLengths[i];
+		out << " (" << percent(pathLengths[i], numPaths) << "%)" << endl;
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include "ObjectType.h"
+
+// Detailed counters (tests per object type, bounding box rejects, path lengths, russian roulette) cost a few percent on
+// the hot path, so they are only compiled in when RENDER_STATS is defined (`cmake -DSTATS=ON ..`)
+// Wrap every statement that updates them in RENDER_STAT(...)
+#ifdef RENDER_STATS
+#define RENDER_STAT(statement) statement
+#else
+#define RENDER_STAT(statement)
+#endif
+
+// Counts of the work done while rendering, used to report rays/sec and intersection tests per ray
+// Each thread counts into its own copy (so the hot path never touches shared memory), and the renderer adds them
+// together after every tile
+struct RenderStats {
+	// Longest path that gets its own histogram bin, longer paths are counted in the last bin
+	static const int maxPathLength = 16;
+
+	// Camera rays, and rays continuing a path after a bounce
+	uint64_t primaryRays = 0;
+	uint64_t bounceRays = 0;
+	// Rays from a hit point towards a light sample
+	uint64_t shadowRays = 0;
+	// Ray-object tests (one per active lane of a packet), and ray-triangle tests inside of meshes
+	uint64_t objectTests = 0;
+	uint64_t triangleTests = 0;
+
+	// Only counted when RENDER_STATS is defined:
+	// Ray-object tests split up by the type of object
+	uint64_t objectTestsByType[(int)ObjectType::COUNT] = {};
+	// Ray-box tests in the BVHs (one per active lane of a packet), and how many of them missed the box
+	uint64_t boxTests = 0;
+	uint64_t boxRejects = 0;
+	// Number of paths that ended after each number of segments (index 0 is unused)
+	uint64_t pathLengths[maxPathLength + 1] = {};
+	// Russian roulette tests (one per bounce that reaches the test), and how many of them terminated the path
+	uint64_t rouletteTests = 0;
+	uint64_t rouletteTerminations = 0;
+
+	uint64_t GetTotalRays() const { return primaryRays + bounceRays + shadowRays; }
+	uint64_t GetTotalTests() const { return objectTests + triangleTests; }
+
+	void Add(const RenderStats& other) {
+		primaryRays += other.primaryRays;
+		bounceRays += other.bounceRays;
+		shadowRays += other.shadowRays;
+		objectTests += other.objectTests;
+		triangleTests += other.triangleTests;
+		for (int i = 0; i < (int)ObjectType::COUNT; i++) objectTestsByType[i] += other.objectTestsByType[i];
+		boxTests += other.boxTests;
+		boxRejects += other.boxRejects;
+		for (int i = 0; i <= maxPathLength; i++) pathLengths[i] += other.pathLengths[i];
+		rouletteTests += other.rouletteTests;
+		rouletteTerminations += other.rouletteTerminations;
+	}
+
+	// Record a path that ended after the given number of segments
+	void AddPath(int length) {
+		pathLengths[(length < maxPathLength) ? length : maxPathLength]++;
+	}
+
+	// Print the detailed counters (only meaningful when RENDER_STATS is defined)
+	void PrintDetails(std::ostream& out) const;
+
+	// The calling thread's counters
+	static RenderStats& Local() {
+		thread_local RenderStats stats;
+		return stats;
+	}
+
+	// Number of set bits in a packet's lane mask
+	static int CountLanes(int laneMask) {
+		int count = 0;
+		for (; laneMask != 0; laneMask &= laneMask - 1) count++;
+		return count;
+	}
+};
@@ -0,0 +1,449 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <limits>
+#include "Renderer.h"
+
+using namespace std;
+using namespace glm;
+
+std::atomic<bool> Renderer::stopRequested(false);
+
+Renderer::Renderer(const Scene& _scene, const Camera& _camera, const RenderSettings& _settings) :
+	scene(_scene),
+	camera(_camera),
+	settings(_settings),
+	samplesCompleted(0) {
+	settings.shardCount = std::max(1, settings.shardCount);
+	settings.shardIndex = std::min(std::max(0, settings.shardIndex), settings.shardCount - 1);
+	// Sample shards split each pixel's samples evenly, tile shards render every sample of their own pixels
+	shardNumSamples = settings.numSamples;
+	if (settings.shardMode == ShardMode::SAMPLES) {
+		shardFirstSample = (int)((long long)settings.numSamples * settings.shardIndex / settings.shardCount);
+		shardNumSamples = (int)((long long)settings.numSamples * (settings.shardIndex + 1) / settings.shardCount) -
+			shardFirstSample;
+	}
+	for (int row = 0; row < settings.height; row++) {
+		for (int col = 0; col < settings.width; col++) {
+			if (IsInShard(row, col)) shardPixels++;
+		}
+	}
+}
+
+CheckpointInfo Renderer::GetCheckpointInfo() const {
+	CheckpointInfo info;
+	info.seed = settings.seed;
+	info.samplerType = (uint32_t)settings.samplerType;
+	info.numSamples = settings.numSamples;
+	if (settings.shardCount > 1) {
+		info.shardMode = (uint32_t)settings.shardMode;
+		info.shardIndex = settings.shardIndex;
+		info.shardCount = settings.shardCount;
+	}
+	return info;
+}
+
+std::string Renderer::DescribeCheckpoint(const CheckpointInfo& info) {
+	string description = "seed " + to_string(info.seed) + ", " + Sampler::GetTypeName((SamplerType)info.samplerType) +
+		" sampler, " + to_string(info.numSamples) + " samples per pixel";
+	if (info.shardCount > 1) {
+		description += ", " + string((ShardMode)info.shardMode == ShardMode::SAMPLES ? "sample" : "tile") + " shard " +
+			to_string(info.shardIndex) + " of " + to_string(info.shardCount);
+	}
+	return description;
+}
+
+bool Renderer::Render(Image& outputImage) {
+	startTime = chrono::steady_clock::now();
+	stats = RenderStats();
+	accumulation.Reset(settings.width, settings.height);
+	if (!settings.resumeFile.empty()) {
+		CheckpointInfo resumeInfo;
+		CheckpointInfo info = GetCheckpointInfo();
+		if (!accumulation.LoadCheckpoint(settings.resumeFile, resumeInfo)) {
+			cerr << "Starting the render from scratch instead" << endl;
+			accumulation.Reset(settings.width, settings.height);
+		}
+		else if (accumulation.GetWidth() != settings.width || accumulation.GetHeight() != settings.height) {
+			cerr << "ERROR: checkpoint is " << accumulation.GetWidth() << "x" << accumulation.GetHeight();
+			cerr << ", but the image is " << settings.width << "x" << settings.height << ". Starting from scratch instead" << endl;
+			accumulation.Reset(settings.width, settings.height);
+		}
+		else if (!resumeInfo.IsSameRender(info) || resumeInfo.shardIndex != info.shardIndex) {
+			// Its samples would continue from the wrong sample indices, or mix with samples from other sequences
+			cerr << "ERROR: checkpoint was rendered with " << DescribeCheckpoint(resumeInfo) << ", but this render uses ";
+			cerr << DescribeCheckpoint(info) << ". Starting from scratch instead" << endl;
+			accumulation.Reset(settings.width, settings.height);
+		}
+		else {
+			cout << "Resuming from " << settings.resumeFile << " with " << accumulation.GetMinSampleCount();
+			cout << " samples per pixel" << endl;
+		}
+	}
+
+	// Every pass adds up to samplesPerPass samples to each pixel that still needs them. Without adaptive sampling that's
+	// every pixel until they all reach numSamples, so the number of samples left is known up front. With adaptive
+	// sampling, the render keeps going until the whole image's budget is spent (or every pixel converges)
+	numSamplesTotal = 0;
+	if (settings.adaptiveThreshold > 0) {
+		numSamplesTotal = std::max(0LL, (long long)shardNumSamples * shardPixels - accumulation.GetTotalSampleCount());
+	}
+	else {
+		for (int row = 0; row < settings.height; row++) {
+			for (int col = 0; col < settings.width; col++) {
+				if (!IsInShard(row, col)) continue;
+				numSamplesTotal += std::max(0, shardNumSamples - accumulation.GetSampleCount(row, col));
+			}
+		}
+	}
+	vector<Tile> tiles = CreateTiles(0, settings.height);
+	if (settings.shardCount > 1) {
+		cout << "Rendering shard " << settings.shardIndex << " of " << settings.shardCount << ": ";
+		if (settings.shardMode == ShardMode::SAMPLES) {
+			cout << "samples " << shardFirstSample << " to " << (shardFirstSample + shardNumSamples - 1) << " of every pixel";
+		}
+		else {
+			cout << tiles.size() << " of the image's tiles";
+		}
+		cout << endl;
+	}
+	samplesCompleted = 0;
+	prevPercent = 0;
+
+	ThreadPool pool(settings.numThreads);
+	cout << "Rendering " << tiles.size() << " tiles, " << std::max(1, settings.samplesPerPass) << " samples per pass, on ";
+	cout << pool.GetNumThreads() << " threads" << endl;
+	if (!settings.previewFile.empty() && !previewWriter) {
+		ownPreviewWriter = make_unique<AsyncImageWriter>();
+		previewWriter = ownPreviewWriter.get();
+	}
+	bool finished = RenderPasses(pool, tiles);
+
+	renderSeconds = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime).count() / 1000.0;
+	if (settings.adaptiveThreshold > 0) ReportAdaptiveStats();
+	ResolveImage(outputImage);
+	return finished;
+}
+
+bool Renderer::RenderStreaming(const std::function<bool(const Image&)>& writeBand) {
+	startTime = chrono::steady_clock::now();
+	stats = RenderStats();
+	streaming = true;
+	// A band only knows about its own pixels, so it can't share the image's sample budget with the others
+	settings.adaptiveThreshold = 0;
+	numSamplesTotal = (long long)shardNumSamples * shardPixels;
+	samplesCompleted = 0;
+	prevPercent = 0;
+
+	ThreadPool pool(settings.numThreads);
+	// Bands are whole rows of tiles, so every band has the same tiles as a render of the whole image. Use enough rows of
+	// tiles to keep every thread busy through each pass, but no more: the band's samples are all that's kept in memory
+	int tileSize = std::max(1, settings.tileSize);
+	int tilesPerRow = (settings.width + tileSize - 1) / tileSize;
+	int bandRows = tileSize * std::max(1, (4 * pool.GetNumThreads() + tilesPerRow - 1) / tilesPerRow);
+	int numBands = (settings.height + bandRows - 1) / bandRows;
+	cout << "Rendering " << numBands << " bands of " << bandRows << " rows, " << std::max(1, settings.samplesPerPass);
+	cout << " samples per pass, on " << pool.GetNumThreads() << " threads" << endl;
+
+	bool finished = true;
+	// Output files are written from the top of the image down, and row 0 is at the bottom
+	for (int band = numBands - 1; band >= 0 && finished; band--) {
+		int rowStart = band * bandRows;
+		int rowEnd = std::min(rowStart + bandRows, settings.height);
+		accumulation.Reset(settings.width, rowEnd - rowStart, rowStart);
+		finished = RenderPasses(pool, CreateTiles(rowStart, rowEnd));
+		// Stopped bands are still written with the samples they have, the rows below them are left for the writer to fill
+		Image bandImage(settings.width, rowEnd - rowStart);
+		ResolveImage(bandImage);
+		if (!writeBand(bandImage)) {
+			finished = false;
+			break;
+		}
+	}
+	// Free the last band's buffers, nothing else can be read from them
+	accumulation.Reset(0, 0);
+	renderSeconds = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime).count() / 1000.0;
+	return finished;
+}
+
+bool Renderer::RenderPasses(ThreadPool& pool, const std::vector<Tile>& tiles) {
+	auto lastCheckpoint = chrono::steady_clock::now();
+	auto lastPreview = lastCheckpoint;
+	bool finished = !PlanNextPass();
+	for (int pass = 0; !finished; pass++) {
+		for (const Tile& tile : tiles) {
+			pool.Submit([this, tile] {
+				ReportProgress(RenderTile(tile));
+			});
+		}
+		pool.WaitAll();
+		finished = !PlanNextPass();
+
+		// Passes are the only point where every pixel is in a consistent state, so stop/save checkpoints here
+		auto now = chrono::steady_clock::now();
+		double elapsed = chrono::duration_cast<chrono::milliseconds>(now - startTime).count() / 1000.0;
+		double sinceCheckpoint = chrono::duration_cast<chrono::milliseconds>(now - lastCheckpoint).count() / 1000.0;
+		bool outOfTime = settings.timeLimit > 0 && elapsed >= settings.timeLimit;
+		bool stopping = !finished && (outOfTime || IsCancelled());
+		// Checkpoints and previews need the whole image, so streamed renders skip them
+		if (!streaming && !settings.checkpointFile.empty() && (finished || stopping || sinceCheckpoint >= settings.checkpointInterval)) {
+			if (accumulation.SaveCheckpoint(settings.checkpointFile, GetCheckpointInfo())) {
+				cout << "Saved checkpoint with " << accumulation.GetMinSampleCount() << " samples per pixel to ";
+				cout << settings.checkpointFile << endl;
+			}
+			lastCheckpoint = now;
+		}
+		if (stopping) {
+			cout << "Stopping after pass " << (pass + 1) << endl;
+			break;
+		}
+		// The next pass starts as soon as the preview is copied out, writing it happens in the background
+		double sincePreview = chrono::duration_cast<chrono::milliseconds>(now - lastPreview).count() / 1000.0;
+		if (!streaming && previewWriter && !finished && sincePreview >= settings.previewInterval) {
+			Image preview(settings.width, settings.height);
+			ResolveImage(preview);
+			previewWriter->Write(settings.previewFile, std::move(preview), PostProcessSettings(camera));
+			lastPreview = now;
+		}
+	}
+	return finished;
+}
+
+vector<dvec3> Renderer::GetRadiance() const {
+	return accumulation.GetMeans();
+}
+
+void Renderer::ResolveFeatures(Image& outAlbedo, Image& outNormal) const {
+	for (int row = 0; row < settings.height; row++) {
+		for (int col = 0; col < settings.width; col++) {
+			outAlbedo.setPixel(col, row, accumulation.GetMeanAlbedo(row, col));
+			outNormal.setPixel(col, row, accumulation.GetMeanNormal(row, col));
+		}
+	}
+}
+
+vector<float> Renderer::GetVariance() const {
+	vector<float> variance((size_t)settings.width * settings.height);
+	for (int row = 0; row < settings.height; row++) {
+		for (int col = 0; col < settings.width; col++) {
+			variance[(size_t)row * settings.width + col] = (float)accumulation.GetVariance(row, col);
+		}
+	}
+	return variance;
+}
+
+long long Renderer::RenderTile(const Tile& tile) {
+	// Skip the rest of the pass once a stop is requested, the pixels that were skipped are picked up on resume
+	if (IsCancelled()) return 0;
+	long long tileSamples = 0;
+	// Samplers keep per-sample state, so every tile gets its own
+	unique_ptr<Sampler> sampler = Sampler::Create(settings.samplerType, settings.numSamples, settings.seed);
+	if (settings.useWavefront) {
+		tileSamples = TraceTileWavefront(tile, *sampler);
+	}
+	else {
+		for (int row = tile.rowStart; row < tile.rowEnd; row++) {
+			for (int col = tile.colStart; col < tile.colEnd; col++) {
+				int numSamples = GetPassSamples(row, col);
+				if (numSamples <= 0) continue;
+
+				// Iterate multiple times over each pixel for path tracing
+				// Tiles never overlap, so threads can write to the buffer without locking
+				if (settings.usePackets) TracePixelPackets(row, col, numSamples, *sampler);
+				else TracePixel(row, col, numSamples, *sampler);
+				tileSamples += numSamples;
+			}
+		}
+	}
+
+	// Move this thread's counters into the total, so the next tile on this thread starts from 0
+	RenderStats& localStats = RenderStats::Local();
+	{
+		lock_guard<mutex> guard(statsLock);
+		stats.Add(localStats);
+	}
+	localStats = RenderStats();
+	return tileSamples;
+}
+
+int Renderer::GetPassSamples(int row, int col) const {
+	// Pixels can have different sample counts when a previous render was interrupted mid-pass
+	if (!IsInShard(row, col)) return 0;
+	int count = accumulation.GetSampleCount(row, col);
+	int maxSamples = shardNumSamples;
+	if (settings.adaptiveThreshold > 0) {
+		maxSamples = (settings.adaptiveMaxSamples > 0) ? settings.adaptiveMaxSamples : 4 * shardNumSamples;
+		// The variance estimate is unreliable with only a few samples (e.g. every one missed a small light), so don't
+		// let a pixel count as converged too early
+		int minSamples = std::min(std::max(2, settings.adaptiveMinSamples), maxSamples);
+		if (count >= minSamples && accumulation.GetRelativeError(row, col) < settings.adaptiveThreshold) return 0;
+	}
+	return std::max(0, std::min(passSampleLimit, maxSamples - count));
+}
+
+bool Renderer::IsInShard(int row, int col) const {
+	if (settings.shardCount <= 1 || settings.shardMode == ShardMode::SAMPLES) return true;
+	// Tiles are numbered in the same order that CreateTiles makes them, and dealt out to the shards in turn so that each
+	// one gets a similar mix of cheap and expensive parts of the image
+	int tileSize = std::max(1, settings.tileSize);
+	int tilesPerRow = (settings.width + tileSize - 1) / tileSize;
+	long long tileIdx = (long long)(row / tileSize) * tilesPerRow + col / tileSize;
+	return tileIdx % settings.shardCount == settings.shardIndex;
+}
+
+bool Renderer::PlanNextPass() {
+	passSampleLimit = std::max(1, settings.samplesPerPass);
+	long long passSamples = 0;
+	int rowEnd = accumulation.GetFirstRow() + accumulation.GetHeight();
+	for (int row = accumulation.GetFirstRow(); row < rowEnd; row++) {
+		for (int col = 0; col < settings.width; col++) {
+			passSamples += GetPassSamples(row, col);
+		}
+	}
+	if (passSamples == 0) return false;
+
+	if (settings.adaptiveThreshold > 0) {
+		long long budget = (long long)shardNumSamples * shardPixels;
+		long long remaining = budget - accumulation.GetTotalSampleCount();
+		if (remaining <= 0) return false;
+		// Spread what's left of the budget evenly over the pixels that still want samples, rather than letting the
+		// last pass go over by a full pass worth of samples
+		if (passSamples > remaining) {
+			passSampleLimit = (int)std::max(1LL, passSampleLimit * remaining / passSamples);
+		}
+	}
+	return true;
+}
+
+void Renderer::ReportAdaptiveStats() const {
+	int numConverged = 0;
+	// Other shards' pixels are always empty, so leave them out of the min
+	int minSamples = std::numeric_limits<int>::max();
+	for (int row = 0; row < settings.height; row++) {
+		for (int col = 0; col < settings.width; col++) {
+			if (!IsInShard(row, col)) continue;
+			if (accumulation.GetRelativeError(row, col) < settings.adaptiveThreshold) numConverged++;
+			minSamples = std::min(minSamples, accumulation.GetSampleCount(row, col));
+		}
+	}
+	double numPixels = (double)std::max(1LL, shardPixels);
+	cout << "Adaptive sampling: " << (100.0 * numConverged / numPixels) << "% of pixels converged, ";
+	cout << (accumulation.GetTotalSampleCount() / numPixels) << " samples per pixel on average (min ";
+	cout << ((shardPixels > 0) ? minSamples : 0) << ", max " << accumulation.GetMaxSampleCount() << ")" << endl;
+}
+
+void Renderer::ResolveImage(Image& outputImage) const {
+	// Exposure, tonemapping and sRGB encoding are left for when the image is saved (see PostProcess.h)
+	// The image has the accumulation buffer's rows, which are only part of the whole image when it's streamed
+	int firstRow = accumulation.GetFirstRow();
+	for (int row = 0; row < accumulation.GetHeight(); row++) {
+		for (int col = 0; col < settings.width; col++) {
+			outputImage.setPixel(col, row, vec3(accumulation.GetMean(firstRow + row, col)));
+		}
+	}
+}
+
+void Renderer::TracePixel(int row, int col, int numSamples, Sampler& sampler) {
+	for (int i = 0; i < numSamples; i++) {
+		// Continue the pixel's sample sequence from where earlier passes (or the resumed checkpoint) left off
+		sampler.StartPixelSample(row, col, GetNextSampleIndex(row, col));
+		// Generate random ray directions within the current pixel (for antialiasing)
+		Ray3D newRay = camera.CreateCameraRay(row, col, sampler.Get2D());
+		// Iterate over every item in the scene to find the intersection/color of the ray
+		// Samples are added one at a time, so the buffer can track how much they vary
+		Scene::Features features;
+		dvec3 color = scene.ComputeRayColor(newRay, sampler, nullptr, &features);
+		accumulation.AddSample(row, col, color, features.albedo, features.normal);
+	}
+}
+
+void Renderer::TracePixelPackets(int row, int col, int numSamples, Sampler& sampler) {
+	for (int first = 0; first < numSamples; first += packetSize) {
+		int count = std::min(packetSize, numSamples - first);
+		int firstSample = GetNextSampleIndex(row, col);
+		// All of the samples in a pixel start at the camera and point in nearly the same direction, so they make a
+		// coherent packet
+		RayPacket packet;
+		for (int lane = 0; lane < count; lane++) {
+			sampler.StartPixelSample(row, col, firstSample + lane);
+			Ray3D cameraRay = camera.CreateCameraRay(row, col, sampler.Get2D());
+			packet.SetRay(lane, cameraRay.start, cameraRay.dir);
+		}
+		// Unused lanes get a copy of a real ray so they don't produce NaNs (they're masked out anyways)
+		for (int lane = count; lane < packetSize; lane++) {
+			packet.CopyLane(lane, 0);
+		}
+
+		HitResult hits[packetSize];
+		scene.FindClosestHitPacket(packet, (1 << count) - 1, hits);
+		// Continue each path on its own from its first hit
+		for (int lane = 0; lane < count; lane++) {
+			Ray3D ray = packet.GetRay(lane);
+			// Pick the sample back up after the 2 dimensions its camera ray used
+			sampler.StartPixelSample(row, col, firstSample + lane, 2);
+			Scene::Features features;
+			dvec3 color = scene.ComputeRayColor(ray, sampler, &hits[lane], &features);
+			accumulation.AddSample(row, col, color, features.albedo, features.normal);
+		}
+	}
+}
+
+long long Renderer::TraceTileWavefront(const Tile& tile, Sampler& sampler) {
+	// Every sample of every pixel in the tile starts out as a camera ray
+	// Reused by every tile on this thread, so only the first tiles have to grow it
+	thread_local vector<WavefrontIntegrator::Path> paths;
+	paths.clear();
+	for (int row = tile.rowStart; row < tile.rowEnd; row++) {
+		for (int col = tile.colStart; col < tile.colEnd; col++) {
+			int numSamples = GetPassSamples(row, col);
+			int firstSample = GetNextSampleIndex(row, col);
+			for (int i = 0; i < numSamples; i++) {
+				sampler.StartPixelSample(row, col, firstSample + i);
+				Ray3D cameraRay = camera.CreateCameraRay(row, col, sampler.Get2D());
+				paths.emplace_back(cameraRay, row, col, firstSample + i, sampler.GetDimension());
+			}
+		}
+	}
+
+	WavefrontIntegrator integrator(scene);
+	integrator.TracePaths(paths, sampler);
+	for (const WavefrontIntegrator::Path& path : paths) {
+		accumulation.AddSample(path.row, path.col, path.state.radiance, path.state.features.albedo,
+			path.state.features.normal);
+	}
+	return (long long)paths.size();
+}
+
+void Renderer::ReportProgress(long long tileSamples) {
+	long long completed = (samplesCompleted += tileSamples);
+	if (numSamplesTotal <= 0) return;
+	int percent = (int)std::floor(100 * (completed / (double)numSamplesTotal));
+
+	lock_guard<mutex> guard(progressLock);
+	if (percent > prevPercent && percent < 100) {
+		prevPercent = percent;
+		double elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - startTime).count() / 1000.0;
+		double estRem = (elapsed / (double)percent) * (100 - percent);
+		cout << setw(2) << percent << "%, est: " << estRem << " s" << endl;
+	}
+}
+
+vector<Tile> Renderer::CreateTiles(int rowStart, int rowEnd) const {
+	vector<Tile> tiles;
+	int tileSize = std::max(1, settings.tileSize);
+	// Go row-by-row so that the image fills in the same order as a scanline loop
+	for (int row = rowStart; row < rowEnd; row += tileSize) {
+		for (int col = 0; col < settings.width; col += tileSize) {
+			// Other shards' tiles are left empty
+			if (!IsInShard(row, col)) continue;
+			Tile tile;
+			tile.rowStart = row;
+			tile.rowEnd = std::min(row + tileSize, rowEnd);
+			tile.colStart = col;
+			tile.colEnd = std::min(col + tileSize, settings.width);
+			tiles.push_back(tile);
+		}
+	}
+	return tiles;
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+#include "Camera.h"
+#include "Scene.h"
+#include "Image.h"
+#include "ImageWriter.h"
+#include "ThreadPool.h"
+#include "AccumulationBuffer.h"
+#include "Sampler.h"
+#include "RenderStats.h"
+#include "WavefrontIntegrator.h"
+
+// Ways of splitting a render between several processes (i.e. on different machines), see RenderSettings::shardCount
+enum class ShardMode {
+	// Each shard renders every shardCount-th tile, with all of its samples
+	TILES,
+	// Each shard renders every pixel, with its own range of the pixel's sample indices
+	SAMPLES
+};
+
+// Options that control how an image is rendered, usually read from the command line
+struct RenderSettings {
+	int width = 512;
+	int height = 512;
+	// Total samples per pixel (with adaptive sampling, the average number of samples per pixel)
+	int numSamples = 1;
+	// Samples added to every pixel in each pass over the image. Checkpoints and early stops happen between passes
+	int samplesPerPass = 8;
+	// Number of render threads, <= 0 uses one thread per hardware core
+	int numThreads = 0;
+	// Width/height (in pixels) of the square tiles that are handed out to the render threads
+	int tileSize = 32;
+	// How the random numbers for each sample are chosen
+	SamplerType samplerType = SamplerType::SOBOL;
+	// Changes the scrambling of the sampler's sequences, so renders with different seeds have independent noise
+	uint32_t seed = 0;
+	// Trace each pixel's camera rays together as SIMD packets (only the first hit, bounces are still traced one at a time)
+	bool usePackets = true;
+	// Trace all of a tile's paths breadth-first, one bounce at a time, with every ray and shadow ray traced in packets
+	// (see WavefrontIntegrator). Ignores usePackets
+	bool useWavefront = false;
+	// Lights sampled per diffuse bounce, chosen in proportion to their power (<= 0 = sample every light)
+	// Passed on to the scene with Scene::SetLightSamples
+	int lightSamples = 0;
+	// Bake object transforms into world-space geometry before rendering (see Scene::FlattenTransforms)
+	bool flattenTransforms = false;
+	// Build the meshes' BVHs with the fast Morton builder instead of the SAH, i.e. for quick previews (passed on to
+	// Scene::BuildSceneFromFile)
+	bool fastBVH = false;
+
+	// File that the accumulation buffer is saved to between passes (empty = no checkpoints)
+	std::string checkpointFile;
+	// Minimum number of seconds between checkpoints. One is always saved after the last pass
+	double checkpointInterval = 300;
+	// Stop after the first pass that finishes past this many seconds (<= 0 = no limit)
+	double timeLimit = 0;
+	// Checkpoint to continue from, only rendering the samples that are still missing (empty = start from scratch)
+	std::string resumeFile;
+	// Image that the render so far is saved to between passes, on a background thread (empty = no previews)
+	std::string previewFile;
+	// Minimum number of seconds between previews
+	double previewInterval = 10;
+
+	// Only render part shardIndex (from 0) out of shardCount parts of the image, so each part can be rendered on its own
+	// machine and the checkpoints merged afterwards (see MergeShards). Every shard uses the same seed and the same sample
+	// indices that a single render would, so the merged image matches one render of the whole thing
+	int shardIndex = 0;
+	int shardCount = 1;
+	ShardMode shardMode = ShardMode::TILES;
+
+	// Pixels stop being sampled once their relative noise (standard error / mean luminance) is below this, and the
+	// samples they didn't use are spent on noisier pixels instead (<= 0 = every pixel gets exactly numSamples)
+	double adaptiveThreshold = 0;
+	// Samples every pixel gets before its noise estimate is trusted
+	int adaptiveMinSamples = 16;
+	// Most samples any one pixel can get with adaptive sampling (<= 0 = 4 * numSamples)
+	int adaptiveMaxSamples = 0;
+};
+
+// A rectangular block of pixels, from [rowStart, rowEnd) and [colStart, colEnd)
+struct Tile {
+	int rowStart, rowEnd;
+	int colStart, colEnd;
+};
+
+// Splits the image into tiles, and renders them in parallel on a work-stealing thread pool
+// Samples are accumulated over several passes of the whole image, so an unfinished render can be saved and resumed
+class Renderer {
+public:
+	Renderer(const Scene& _scene, const Camera& _camera, const RenderSettings& _settings);
+
+	// Render passes until every pixel has numSamples samples (or with adaptive sampling, until the sample budget is used
+	// up or every pixel has converged), then store the linear result in the image. Returns false if the render stopped
+	// early
+	bool Render(Image& outputImage);
+	// Linear (pre-exposure, pre-tonemapping) color of every pixel from the last render, stored row by row
+	std::vector<glm::dvec3> GetRadiance() const;
+	// Average albedo and normal of the first surface each pixel's samples hit (see Scene::PathState::features), for
+	// saving as extra images or guiding the denoiser
+	void ResolveFeatures(Image& outAlbedo, Image& outNormal) const;
+	// Variance of each pixel's mean luminance from the last render, row by row (see AccumulationBuffer::GetVariance)
+	std::vector<float> GetVariance() const;
+	// Render the image a band of rows at a time from the top down, for images too large to keep in memory. Each band gets
+	// all of its samples, then its linear colors are passed to writeBand (i.e. ImageStreamWriter::WriteBand) and freed
+	// before the next band starts. Checkpoints, previews and adaptive sampling need the whole image, so they're skipped,
+	// and the per-pixel results (GetRadiance, ResolveFeatures, GetVariance) aren't available afterwards. Returns false if the render stopped early
+	// or writeBand failed, in which case the rows below the last band weren't rendered
+	bool RenderStreaming(const std::function<bool(const Image&)>& writeBand);
+	// Rays and intersection tests traced by every thread during the last render
+	const RenderStats& GetStats() const { return stats; }
+	// Time that the last render spent tracing passes, in seconds (not counting scene loading)
+	double GetRenderSeconds() const { return renderSeconds; }
+
+	// Ask any running render to stop at the end of the current pass (safe to call from a signal handler)
+	static void RequestStop() { stopRequested = true; }
+	static bool IsStopRequested() { return stopRequested; }
+	// Stop this renderer's render, skipping the rest of the current pass, once the flag is set (i.e. when the camera
+	// moved and the image is out of date). The flag has to outlive the renderer
+	void SetCancelFlag(const std::atomic<bool>* flag) { cancelFlag = flag; }
+	// Save previews with this writer instead of one of the renderer's own (i.e. when other images go to the same file)
+	void SetPreviewWriter(AsyncImageWriter* writer) { previewWriter = writer; }
+	// How this render's samples are chosen, saved with its checkpoints so they're only resumed or merged with renders that
+	// continue the same samples
+	CheckpointInfo GetCheckpointInfo() const;
+	// Readable summary of the settings a checkpoint was rendered with (i.e. "seed 0, sobol sampler, 64 samples per pixel")
+	static std::string DescribeCheckpoint(const CheckpointInfo& info);
+
+private:
+	// Add one pass worth of samples to every pixel in the tile that still needs them. Returns the number of samples added
+	long long RenderTile(const Tile& tile);
+	// Render passes over the tiles until the pixels in the accumulation buffer are finished, saving checkpoints and
+	// previews in between. Returns false if the render stopped early
+	bool RenderPasses(ThreadPool& pool, const std::vector<Tile>& tiles);
+	// Number of samples the pixel should get in the next pass (0 once it is done)
+	int GetPassSamples(int row, int col) const;
+	// Whether the pixel is rendered by this shard (always true for sample shards)
+	bool IsInShard(int row, int col) const;
+	// Index of the next sample that the pixel needs from this shard
+	int GetNextSampleIndex(int row, int col) const { return shardFirstSample + accumulation.GetSampleCount(row, col); }
+	// Decide how many samples the next pass can add to each pixel. Returns false once the render is finished
+	bool PlanNextPass();
+	// Print how the samples were spread over the image by adaptive sampling
+	void ReportAdaptiveStats() const;
+	// Copy the average color of every pixel from the accumulation buffer into the image
+	void ResolveImage(Image& outputImage) const;
+	// Add numSamples samples to a pixel in the accumulation buffer, tracing the camera rays one at a time
+	void TracePixel(int row, int col, int numSamples, Sampler& sampler);
+	// Same as TracePixel, but finds the first hit of packetSize camera rays at once
+	void TracePixelPackets(int row, int col, int numSamples, Sampler& sampler);
+	// Add this pass's samples to every pixel in the tile with the wavefront integrator. Returns the number of samples
+	long long TraceTileWavefront(const Tile& tile, Sampler& sampler);
+	// Print a status update (to the nearest 1%) once another tile is done
+	void ReportProgress(long long tileSamples);
+
+	// Every tile of this shard in rows [rowStart, rowEnd), where rowStart is on a tile boundary
+	std::vector<Tile> CreateTiles(int rowStart, int rowEnd) const;
+
+	const Scene& scene;
+	const Camera& camera;
+	RenderSettings settings;
+	AccumulationBuffer accumulation;
+	// Saves the previews. Unless one was given, the renderer makes its own when there's a preview file
+	AsyncImageWriter* previewWriter = nullptr;
+	std::unique_ptr<AsyncImageWriter> ownPreviewWriter;
+	// Most samples any pixel gets in the current pass (lowered for the last adaptive pass, to stay inside the budget)
+	int passSampleLimit = 0;
+	// This shard renders sample indices [shardFirstSample, shardFirstSample + shardNumSamples) of each of its pixels
+	int shardFirstSample = 0;
+	int shardNumSamples = 0;
+	// Number of pixels in this shard
+	long long shardPixels = 0;
+	// Set by RenderStreaming, the accumulation buffer only holds the current band
+	bool streaming = false;
+	static std::atomic<bool> stopRequested;
+	const std::atomic<bool>* cancelFlag = nullptr;
+	bool IsCancelled() const { return stopRequested || (cancelFlag && *cancelFlag); }
+
+	// Used for counting percentage completion (numSamplesTotal counts the samples expected from every pass)
+	std::atomic<long long> samplesCompleted;
+	long long numSamplesTotal = 0;
+	int prevPercent = 0;
+	std::mutex progressLock;
+	std::chrono::time_point<std::chrono::steady_clock> startTime;
+
+	// Sum of every thread's counters, added to after each tile
+	RenderStats stats;
+	std::mutex statsLock;
+	double renderSeconds = 0;
+};
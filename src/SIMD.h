@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include "Real.h"
+
+// SIMD vector of Reals used by the packet intersection kernels
+// Uses AVX when the compiler targets it, SSE/SSE2 on other x86-64 builds, and plain arrays everywhere else
+// Comparisons return masks (all bits set in lanes where the comparison is true) that can be combined with And/Or/Select
+#if defined(__AVX__)
+#define PACKET_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PACKET_SSE2
+#include <emmintrin.h>
+#endif
+
+// Number of rays in a packet, and number of triangles tested at once in a BVH leaf
+// 8 floats fit in an AVX register, everything else uses 4 lanes
+#if defined(PACKET_AVX) && defined(SINGLE_PRECISION)
+constexpr int packetSize = 8;
+#else
+constexpr int packetSize = 4;
+#endif
+// Mask with one bit per lane, used to mark which rays in a packet are active
+constexpr int fullPacketMask = (1 << packetSize) - 1;
+
+struct SimdReal {
+#if defined(PACKET_AVX) && defined(SINGLE_PRECISION)
+	__m256 v;
+	SimdReal() : v(_mm256_setzero_ps()) {}
+	SimdReal(__m256 _v) : v(_v) {}
+	static SimdReal Broadcast(Real val) { return _mm256_set1_ps(val); }
+	static SimdReal Load(const Real* ptr) { return _mm256_loadu_ps(ptr); }
+	void Store(Real* ptr) const { _mm256_storeu_ps(ptr, v); }
+
+	friend SimdReal operator+(const SimdReal& a, const SimdReal& b) { return _mm256_add_ps(a.v, b.v); }
+	friend SimdReal operator-(const SimdReal& a, const SimdReal& b) { return _mm256_sub_ps(a.v, b.v); }
+	friend SimdReal operator*(const SimdReal& a, const SimdReal& b) { return _mm256_mul_ps(a.v, b.v); }
+	friend SimdReal operator/(const SimdReal& a, const SimdReal& b) { return _mm256_div_ps(a.v, b.v); }
+	friend SimdReal Min(const SimdReal& a, const SimdReal& b) { return _mm256_min_ps(a.v, b.v); }
+	friend SimdReal Max(const SimdReal& a, const SimdReal& b) { return _mm256_max_ps(a.v, b.v); }
+	friend SimdReal Sqrt(const SimdReal& a) { return _mm256_sqrt_ps(a.v); }
+	friend SimdReal Abs(const SimdReal& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+
+	friend SimdReal CmpLt(const SimdReal& a, const SimdReal& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+	friend SimdReal CmpLe(const SimdReal& a, const SimdReal& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+	friend SimdReal CmpGt(const SimdReal& a, const SimdReal& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+	friend SimdReal CmpGe(const SimdReal& a, const SimdReal& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+	friend SimdReal And(const SimdReal& a, const SimdReal& b) { return _mm256_and_ps(a.v, b.v); }
+	friend SimdReal Or(const SimdReal& a, const SimdReal& b) { return _mm256_or_ps(a.v, b.v); }
+	// Returns ifTrue in lanes where mask is set, ifFalse elsewhere
+	friend SimdReal Select(const SimdReal& mask, const SimdReal& ifTrue, const SimdReal& ifFalse) {
+		return _mm256_blendv_ps(ifFalse.v, ifTrue.v, mask.v);
+	}
+	// One bit per lane, set where the mask is set
+	friend int MoveMask(const SimdReal& mask) { return _mm256_movemask_ps(mask.v); }
+
+#elif defined(PACKET_AVX)
+	__m256d v;
+	SimdReal() : v(_mm256_setzero_pd()) {}
+	SimdReal(__m256d _v) : v(_v) {}
+	static SimdReal Broadcast(Real val) { return _mm256_set1_pd(val); }
+	static SimdReal Load(const Real* ptr) { return _mm256_loadu_pd(ptr); }
+	void Store(Real* ptr) const { _mm256_storeu_pd(ptr, v); }
+
+	friend SimdReal operator+(const SimdReal& a, const SimdReal& b) { return _mm256_add_pd(a.v, b.v); }
+	friend SimdReal operator-(const SimdReal& a, const SimdReal& b) { return _mm256_sub_pd(a.v, b.v); }
+	friend SimdReal operator*(const SimdReal& a, const SimdReal& b) { return _mm256_mul_pd(a.v, b.v); }
+	friend SimdReal operator/(const SimdReal& a, const SimdReal& b) { return _mm256_div_pd(a.v, b.v); }
+	friend SimdReal Min(const SimdReal& a, const SimdReal& b) { return _mm256_min_pd(a.v, b.v); }
+	friend SimdReal Max(const SimdReal& a, const SimdReal& b) { return _mm256_max_pd(a.v, b.v); }
+	friend SimdReal Sqrt(const SimdReal& a) { return _mm256_sqrt_pd(a.v); }
+	friend SimdReal Abs(const SimdReal& a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v); }
+
+	friend SimdReal CmpLt(const SimdReal& a, const SimdReal& b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+	friend SimdReal CmpLe(const SimdReal& a, const SimdReal& b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ); }
+	friend SimdReal CmpGt(const SimdReal& a, const SimdReal& b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ); }
+	friend SimdReal CmpGe(const SimdReal& a, const SimdReal& b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ); }
+	friend SimdReal And(const SimdReal& a, const SimdReal& b) { return _mm256_and_pd(a.v, b.v); }
+	friend SimdReal Or(const SimdReal& a, const SimdReal& b) { return _mm256_or_pd(a.v, b.v); }
+	// Returns ifTrue in lanes where mask is set, ifFalse elsewhere
+	friend SimdReal Select(const SimdReal& mask, const SimdReal& ifTrue, const SimdReal& ifFalse) {
+		return _mm256_blendv_pd(ifFalse.v, ifTrue.v, mask.v);
+	}
+	// One bit per lane, set where the mask is set
+	friend int MoveMask(const SimdReal& mask) { return _mm256_movemask_pd(mask.v); }
+
+#elif defined(PACKET_SSE2) && defined(SINGLE_PRECISION)
+	__m128 v;
+	SimdReal() : v(_mm_setzero_ps()) {}
+	SimdReal(__m128 _v) : v(_v) {}
+	static SimdReal Broadcast(Real val) { return _mm_set1_ps(val); }
+	static SimdReal Load(const Real* ptr) { return _mm_loadu_ps(ptr); }
+	void Store(Real* ptr) const { _mm_storeu_ps(ptr, v); }
+
+	friend SimdReal operator+(const SimdReal& a, const SimdReal& b) { return _mm_add_ps(a.v, b.v); }
+	friend SimdReal operator-(const SimdReal& a, const SimdReal& b) { return _mm_sub_ps(a.v, b.v); }
+	friend SimdReal operator*(const SimdReal& a, const SimdReal& b) { return _mm_mul_ps(a.v, b.v); }
+	friend SimdReal operator/(const SimdReal& a, const SimdReal& b) { return _mm_div_ps(a.v, b.v); }
+	friend SimdReal Min(const SimdReal& a, const SimdReal& b) { return _mm_min_ps(a.v, b.v); }
+	friend SimdReal Max(const SimdReal& a, const SimdReal& b) { return _mm_max_ps(a.v, b.v); }
+	friend SimdReal Sqrt(const SimdReal& a) { return _mm_sqrt_ps(a.v); }
+	friend SimdReal Abs(const SimdReal& a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+
+	friend SimdReal CmpLt(const SimdReal& a, const SimdReal& b) { return _mm_cmplt_ps(a.v, b.v); }
+	friend SimdReal CmpLe(const SimdReal& a, const SimdReal& b) { return _mm_cmple_ps(a.v, b.v); }
+	friend SimdReal CmpGt(const SimdReal& a, const SimdReal& b) { return _mm_cmpgt_ps(a.v, b.v); }
+	friend SimdReal CmpGe(const SimdReal& a, const SimdReal& b) { return _mm_cmpge_ps(a.v, b.v); }
+	friend SimdReal And(const SimdReal& a, const SimdReal& b) { return _mm_and_ps(a.v, b.v); }
+	friend SimdReal Or(const SimdReal& a, const SimdReal& b) { return _mm_or_ps(a.v, b.v); }
+	// Returns ifTrue in lanes where mask is set, ifFalse elsewhere (SSE2 has no blend, so use and/andnot/or)
+	friend SimdReal Select(const SimdReal& mask, const SimdReal& ifTrue, const SimdReal& ifFalse) {
+		return _mm_or_ps(_mm_and_ps(mask.v, ifTrue.v), _mm_andnot_ps(mask.v, ifFalse.v));
+	}
+	// One bit per lane, set where the mask is set
+	friend int MoveMask(const SimdReal& mask) { return _mm_movemask_ps(mask.v); }
+
+#elif defined(PACKET_SSE2)
+	__m128d lo, hi;
+	SimdReal() : lo(_mm_setzero_pd()), hi(_mm_setzero_pd()) {}
+	SimdReal(__m128d _lo, __m128d _hi) : lo(_lo), hi(_hi) {}
+	static SimdReal Broadcast(Real val) { return SimdReal(_mm_set1_pd(val), _mm_set1_pd(val)); }
+	static SimdReal Load(const Real* ptr) { return SimdReal(_mm_loadu_pd(ptr), _mm_loadu_pd(ptr + 2)); }
+	void Store(Real* ptr) const { _mm_storeu_pd(ptr, lo); _mm_storeu_pd(ptr + 2, hi); }
+
+	friend SimdReal operator+(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_add_pd(a.lo, b.lo), _mm_add_pd(a.hi, b.hi)); }
+	friend SimdReal operator-(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_sub_pd(a.lo, b.lo), _mm_sub_pd(a.hi, b.hi)); }
+	friend SimdReal operator*(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)); }
+	friend SimdReal operator/(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_div_pd(a.lo, b.lo), _mm_div_pd(a.hi, b.hi)); }
+	friend SimdReal Min(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_min_pd(a.lo, b.lo), _mm_min_pd(a.hi, b.hi)); }
+	friend SimdReal Max(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_max_pd(a.lo, b.lo), _mm_max_pd(a.hi, b.hi)); }
+	friend SimdReal Sqrt(const SimdReal& a) { return SimdReal(_mm_sqrt_pd(a.lo), _mm_sqrt_pd(a.hi)); }
+	friend SimdReal Abs(const SimdReal& a) {
+		__m128d signBit = _mm_set1_pd(-0.0);
+		return SimdReal(_mm_andnot_pd(signBit, a.lo), _mm_andnot_pd(signBit, a.hi));
+	}
+
+	friend SimdReal CmpLt(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_cmplt_pd(a.lo, b.lo), _mm_cmplt_pd(a.hi, b.hi)); }
+	friend SimdReal CmpLe(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_cmple_pd(a.lo, b.lo), _mm_cmple_pd(a.hi, b.hi)); }
+	friend SimdReal CmpGt(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_cmpgt_pd(a.lo, b.lo), _mm_cmpgt_pd(a.hi, b.hi)); }
+	friend SimdReal CmpGe(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_cmpge_pd(a.lo, b.lo), _mm_cmpge_pd(a.hi, b.hi)); }
+	friend SimdReal And(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_and_pd(a.lo, b.lo), _mm_and_pd(a.hi, b.hi)); }
+	friend SimdReal Or(const SimdReal& a, const SimdReal& b) { return SimdReal(_mm_or_pd(a.lo, b.lo), _mm_or_pd(a.hi, b.hi)); }
+	// Returns ifTrue in lanes where mask is set, ifFalse elsewhere (SSE2 has no blend, so use and/andnot/or)
+	friend SimdReal Select(const SimdReal& mask, const SimdReal& ifTrue, const SimdReal& ifFalse) {
+		return SimdReal(
+			_mm_or_pd(_mm_and_pd(mask.lo, ifTrue.lo), _mm_andnot_pd(mask.lo, ifFalse.lo)),
+			_mm_or_pd(_mm_and_pd(mask.hi, ifTrue.hi), _mm_andnot_pd(mask.hi, ifFalse.hi)));
+	}
+	// One bit per lane, set where the mask is set
+	friend int MoveMask(const SimdReal& mask) { return _mm_movemask_pd(mask.lo) | (_mm_movemask_pd(mask.hi) << 2); }
+
+#else
+	// Scalar fallback. Masks are stored as Reals with every bit set, so that And/Or/Select behave like the SIMD versions
+	Real v[packetSize];
+	SimdReal() { for (int i = 0; i < packetSize; i++) v[i] = 0; }
+	static SimdReal Broadcast(Real val) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = val; return r; }
+	static SimdReal Load(const Real* ptr) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = ptr[i]; return r; }
+	void Store(Real* ptr) const { for (int i = 0; i < packetSize; i++) ptr[i] = v[i]; }
+
+	friend SimdReal operator+(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = a.v[i] + b.v[i]; return r; }
+	friend SimdReal operator-(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = a.v[i] - b.v[i]; return r; }
+	friend SimdReal operator*(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = a.v[i] * b.v[i]; return r; }
+	friend SimdReal operator/(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = a.v[i] / b.v[i]; return r; }
+	// Same operand order as the SSE min/max instructions (returns b when either value is NaN)
+	friend SimdReal Min(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = (a.v[i] < b.v[i]) ? a.v[i] : b.v[i]; return r; }
+	friend SimdReal Max(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = (a.v[i] > b.v[i]) ? a.v[i] : b.v[i]; return r; }
+	friend SimdReal Sqrt(const SimdReal& a) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = std::sqrt(a.v[i]); return r; }
+	friend SimdReal Abs(const SimdReal& a) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = std::fabs(a.v[i]); return r; }
+
+	friend SimdReal CmpLt(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = MaskBits(a.v[i] < b.v[i]); return r; }
+	friend SimdReal CmpLe(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = MaskBits(a.v[i] <= b.v[i]); return r; }
+	friend SimdReal CmpGt(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = MaskBits(a.v[i] > b.v[i]); return r; }
+	friend SimdReal CmpGe(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = MaskBits(a.v[i] >= b.v[i]); return r; }
+	friend SimdReal And(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = FromBits(ToBits(a.v[i]) & ToBits(b.v[i])); return r; }
+	friend SimdReal Or(const SimdReal& a, const SimdReal& b) { SimdReal r; for (int i = 0; i < packetSize; i++) r.v[i] = FromBits(ToBits(a.v[i]) | ToBits(b.v[i])); return r; }
+	friend SimdReal Select(const SimdReal& mask, const SimdReal& ifTrue, const SimdReal& ifFalse) {
+		SimdReal r;
+		for (int i = 0; i < packetSize; i++) r.v[i] = (ToBits(mask.v[i]) & signBit) ? ifTrue.v[i] : ifFalse.v[i];
+		return r;
+	}
+	friend int MoveMask(const SimdReal& mask) {
+		int bits = 0;
+		for (int i = 0; i < packetSize; i++) bits |= ((ToBits(mask.v[i]) & signBit) ? 1 : 0) << i;
+		return bits;
+	}
+
+private:
+#ifdef SINGLE_PRECISION
+	typedef uint32_t Bits;
+#else
+	typedef uint64_t Bits;
+#endif
+	static constexpr Bits signBit = (Bits)1 << (sizeof(Bits) * 8 - 1);
+	static Bits ToBits(Real val) { Bits bits; std::memcpy(&bits, &val, sizeof(bits)); return bits; }
+	static Real FromBits(Bits bits) { Real val; std::memcpy(&val, &bits, sizeof(val)); return val; }
+	static Real MaskBits(bool set) { return FromBits(set ? ~(Bits)0 : 0); }
+#endif
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include "Sampler.h"
+#include "RandomSampler.h"
+#include "StratifiedSampler.h"
+#include "SobolSampler.h"
+
+using namespace std;
+
+std::unique_ptr<Sampler> Sampler::Create(SamplerType type, int samplesPerPixel, uint32_t seed) {
+	switch (type) {
+	case SamplerType::RANDOM:
+		return unique_ptr<Sampler>(new RandomSampler(samplesPerPixel, seed));
+	case SamplerType::STRATIFIED:
+		return unique_ptr<Sampler>(new StratifiedSampler(samplesPerPixel, seed));
+	case SamplerType::SOBOL:
+	default:
+		return unique_ptr<Sampler>(new SobolSampler(samplesPerPixel, seed));
+	}
+}
+
+bool Sampler::ParseType(const std::string& name, SamplerType& outType) {
+	if (name == "random") outType = SamplerType::RANDOM;
+	else if (name == "stratified") outType = SamplerType::STRATIFIED;
+	else if (name == "sobol") outType = SamplerType::SOBOL;
+	else return false;
+	return true;
+}
+
+std::string Sampler::GetTypeName(SamplerType type) {
+	switch (type) {
+	case SamplerType::RANDOM:
+		return "random";
+	case SamplerType::STRATIFIED:
+		return "stratified";
+	case SamplerType::SOBOL:
+	default:
+		return "sobol";
+	}
+}
+
+uint64_t Sampler::HashDimension(uint64_t extra) const {
+	uint64_t h = MixBits(((uint64_t)(uint32_t)pixelRow << 32) | (uint32_t)pixelCol);
+	h = MixBits(h ^ (((uint64_t)(uint32_t)currentDimension << 32) | seed));
+	return MixBits(h ^ extra);
+}
+
+uint64_t Sampler::MixBits(uint64_t v) {
+	v ^= v >> 33;
+	v *= 0xff51afd7ed558ccdULL;
+	v ^= v >> 33;
+	v *= 0xc4ceb9fe1a85ec53ULL;
+	v ^= v >> 33;
+	return v;
+}
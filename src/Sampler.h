@@ -0,0 +1,70 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Ways of choosing the random numbers for each sample
+enum class SamplerType {
+	// Independent uniform random numbers
+	RANDOM,
+	// Jittered strata, shuffled separately for every dimension of every pixel
+	STRATIFIED,
+	// Owen-scrambled Sobol points (low discrepancy, converges fastest on most scenes)
+	SOBOL
+};
+
+// Source of the random numbers used by every sample of a pixel. Each sample is a point in a many-dimensional unit
+// cube: the camera ray uses the first 2 dimensions, and every bounce consumes a few more. Samplers that know which
+// pixel, sample, and dimension they're on can spread the points more evenly than independent random numbers
+// Samplers hold per-sample state, so each render thread needs its own
+class Sampler {
+public:
+	Sampler(int _samplesPerPixel, uint32_t _seed) : samplesPerPixel(_samplesPerPixel), seed(_seed) {}
+	virtual ~Sampler() = default;
+
+	// Begin sample number sampleIndex of a pixel. Following Get1D/Get2D calls return the sample's dimensions in order,
+	// starting at the given dimension (i.e. to continue a path after its camera ray was generated)
+	virtual void StartPixelSample(int row, int col, int sampleIndex, int dimension = 0) {
+		pixelRow = row;
+		pixelCol = col;
+		currentSample = sampleIndex;
+		currentDimension = dimension;
+	}
+	// Next dimension of the current sample, in [0, 1)
+	virtual double Get1D() = 0;
+	// Next 2 dimensions of the current sample, in [0, 1)^2
+	virtual glm::dvec2 Get2D() = 0;
+	// Dimension that the next Get1D/Get2D call will use (i.e. to save a path's place and continue it later)
+	int GetDimension() const { return currentDimension; }
+
+	// Create a sampler of the given type. samplesPerPixel is the expected number of samples in each pixel (samplers
+	// that stratify over it still work if a pixel gets more), and seed changes the scrambling of the sequences
+	static std::unique_ptr<Sampler> Create(SamplerType type, int samplesPerPixel, uint32_t seed);
+	// Read a sampler type from its name ("random", "stratified" or "sobol"). Returns false if the name is unknown
+	static bool ParseType(const std::string& name, SamplerType& outType);
+	static std::string GetTypeName(SamplerType type);
+
+protected:
+	// Well-mixed hash of the current pixel, dimension and seed (plus an extra value), used to decorrelate dimensions
+	uint64_t HashDimension(uint64_t extra = 0) const;
+	// Uniform random number in [0, 1) hashed from the current pixel, sample, dimension and seed (plus an extra value)
+	// Nothing else goes into it, so every sample gets the same numbers no matter which thread, tile order or shard
+	// renders it, and the same render always gives the same image
+	double HashToUniform(uint64_t extra = 0) const {
+		// Offset the counter, so it never mixes to the small extra values that the other hashes use (MixBits(0) = 0)
+		uint64_t counter = (((uint64_t)(uint32_t)currentSample << 32) | (uint32_t)extra) + 0x9e3779b97f4a7c15ULL;
+		uint64_t h = HashDimension(MixBits(counter));
+		return (uint32_t)(h >> 32) * 2.3283064365386963e-10; // 2^-32
+	}
+	// Mix the bits of a 64 bit value, so that nearby inputs give unrelated outputs (the MurmurHash3 finalizer)
+	static uint64_t MixBits(uint64_t v);
+
+	int samplesPerPixel;
+	uint32_t seed;
+	int pixelRow = 0;
+	int pixelCol = 0;
+	int currentSample = 0;
+	int currentDimension = 0;
+};
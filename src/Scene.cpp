@@ -6,157 +6,473 @@ using namespace std;
 using json = nlohmann::json;
 
 // Main render loop
-glm::dvec3 Scene::ComputeRayColor(Ray3D& ray) {
-	dvec3 outputColor(0.0);
-	// Stores the filtered color of each surface as we bounce off of them (i.e. bounce of a red surface, throughput is now 1, 0, 0)
-	dvec3 throughput(1.0);
-	// This variable is true on the first loop so that initial hits on emissive objects return the proper color
-	bool specularBounce = true;
+glm::dvec3 Scene::ComputeRayColor(Ray3D& ray, Sampler& sampler, const HitResult* primaryHit, Features* outFeatures) const {
+	PathState path;
+	// Reused by every path on this thread, so taking light samples doesn't allocate
+	thread_local vector<ShadowRay> shadowRays;
+	// Number of rays traced along this path so far
+	RENDER_STAT(int pathLength = 0);
 	
 	for (int i = 0; i < maxBounces; i++) {
+		RENDER_STAT(pathLength++);
 		// Find the nearest object
 		HitResult hit; // default tMin = infinity
-		for (auto& object : allObjects) {
-			if (object->Hit(ray, hit, epsilon)) {
-				// If hit was successful (i.e. found a new tMin), store a reference to the object
-				hit.hitObject = object;
-			}
+		if (i == 0) RenderStats::Local().primaryRays++;
+		else RenderStats::Local().bounceRays++;
+		if (i == 0 && primaryHit != nullptr) {
+			hit = *primaryHit;
+		}
+		else {
+			FindClosestHit(ray, hit);
 		}
 
 		// Check if the ray actually hit anything
-		if (hit.hitObject != nullptr) {
-			// Calculate the hit's properties
-			// New world-space position from tMin
-			hit.loc = ray.FindLocAtTime(hit.t);
-			// During intersection checks, hit.nor is filled with local-space normal. Now, convert to world space
-			hit.nor = hit.hitObject->GetInverseTranspose() * hit.nor;
-			// Multiplying by inverse transpose makes the w component nonzero, so reset it here before normalizing
-			hit.nor.w = 0.0;
-			hit.nor = normalize(hit.nor);
-
-			shared_ptr<Material> mat = hit.hitObject->GetMaterial();
-
-			// Emissive Color
-			// Only add this on the first bounce, or if this ray was created from a specular bounce
-			// Necessary since we're using explicit light sampling
-			// (See https://computergraphics.stackexchange.com/questions/5152/progressive-path-tracing-with-explicit-light-sampling/5153#5153)
-			if (specularBounce) {
-				outputColor += throughput * mat->ke;
-			}
+		if (hit.hitObject == nullptr) {
+			// Hit the background, so add the bg color and stop bouncing
+			path.radiance += path.throughput * backgroundColor;
+			break;
+		}
 
-			// find the direction that a diffuse bounce would take (used by both the specular and diffuse reflections)
-			dvec4 diffuseRayDir(GetRandomRayInHemisphere(hit.nor));
-
-			// Randomly choose between specular and diffuse rays, depending on the material's reflectance
-			if ((rand() / (double)RAND_MAX) < mat->reflectance) {
-				// Glossy reflection (glossiness - based on 'roughness' value)
-				throughput = throughput * mat->ks;
-				dvec4 idealReflectDir = glm::reflect(ray.dir, hit.nor);
-				// Interpolate between a perfect specular reflection and a diffuse reflection based on roughness
-				dvec4 specularRayDir = (mat->roughness * diffuseRayDir) + ((1.0 - mat->roughness) * idealReflectDir);
-				// Create a new ray with the reflection direction
-				ray = Ray3D(hit.loc, specularRayDir);
-				// Next ray is a reflection ray
-				specularBounce = true;
-			}
-			else {
-				// Non-specular Lighting = Direct Lighting + Ambient Lighting
-
-				// Direct Lighting
-				// Explicitly sample each light
-				for (auto& light : allLights) {
-					// If this light is an area light, choose a new random location on its surface
-					double pdf = light->RandomizeLocation();
-					if (!IsPointInShadow(hit.loc, light->GetLocation(), light->GetObject())) {
-						outputColor += throughput * mat->ShadeDiffuse(ray, hit, light) / pdf;
-					}
-				}
-
-				// Ambient Lighting = 1/N * sum from 1->N of ( 1/p * (f * L * cos(theta)))
-				// Where f = BRDF = kd/pi (use perfect diffuse shading for this model,
-				//     so albedo = kd https://computergraphics.stackexchange.com/questions/350/albedo-vs-diffuse
-				// L = incoming light, theta = angle btwn incoming (constant) and outgoing (randomized) light rays
-
-				// Next ray hit will be a diffuse bounce
-				ray = Ray3D(hit.loc, diffuseRayDir);
-				specularBounce = false;
-
-				// Attenuate further rays by BRDF / PDF
-				// Constant (lambertian) BRDF. Usually albedo / pi, but the pi cancels out w/pdf
-				const dvec3 BRDF = mat->kd;
-				// Store 1/p to save some operations
-				// Proper PDF is cos(theta) / pi, but both the cos and the pi cancel out with the BRDF / lighting equation
-				constexpr double invPdf = 1.0;
-				throughput *= BRDF * invPdf;
-				// NOTE: normally, throughput would be multiplied by cos(theta), where theta is angle btwn new and old rays
-				// The random ray generation uses a cosine-weighted model, where PDF = cos(theta) / pi
-				// Therefore, when dividing by p the cos(theta) would cancel out with the full eq so we don't mult by it here
+		shadowRays.clear();
+		bool continuePath = ShadeHit(ray, hit, sampler, path, shadowRays);
+
+		// Direct Lighting
+		// All of the shadow rays start at the hit location, so trace them packetSize lights at a time
+		for (size_t first = 0; first < shadowRays.size(); first += packetSize) {
+			int count = (int)std::min((size_t)packetSize, shadowRays.size() - first);
+			const ShadowRay* rays = &shadowRays[first];
+			// A single shadow ray isn't worth the packet setup
+			int shadowMask = (count == 1) ? (IsShadowRayBlocked(rays[0]) ? 1 : 0) : AreShadowRaysBlocked(rays, count);
+			for (int lane = 0; lane < count; lane++) {
+				if (!(shadowMask & (1 << lane))) path.radiance += rays[lane].contribution;
 			}
+		}
+		if (!continuePath) break;
+	}
+	RENDER_STAT(RenderStats::Local().AddPath(pathLength));
+	if (outFeatures) *outFeatures = path.features;
+	return path.radiance;
+}
 
-			// Russian Roulette path termination
-			// Method from https://computergraphics.stackexchange.com/questions/2316/is-russian-roulette-really-the-answer
-			// Use throughput (color contribution modifier) as the terminating condition
-			// Q: Should p be based on throughput or output color? Take a dark scene with white walls - throughput is 1 even
-			// though rays are very dark.
-			// A: No, a ray bouncing off a mirror surface will have an accumulated output color of 0, but it might hit a light later and
-			// have a large contribution. The only way to guarantee a ray won't have much effect is if it's bounced off dark surfaces.
-			double p = std::max(throughput.x, std::max(throughput.y, throughput.z));
-			// the lower the max value of throughput, the more likely execution will go here and break the loop
-			if ((rand() / (double)RAND_MAX) >= p) {
-				// ^Note: >= since rand / rand_max can return 0, which should still break when p = 0
-				break;
+bool Scene::ShadeHit(Ray3D& ray, HitResult& hit, Sampler& sampler, PathState& path, vector<ShadowRay>& shadowRays) const {
+	// Calculate the hit's properties
+	// New world-space position from tMin
+	hit.loc = ray.FindLocAtTime(hit.t);
+	// During intersection checks, hit.nor is filled with local-space normal. Now, convert to world space
+	// (flattened objects already store world-space normals)
+	if (!hit.hitObject->IsWorldSpace()) {
+		hit.nor = hit.hitObject->GetInverseTranspose() * hit.nor;
+		// Multiplying by inverse transpose makes the w component nonzero, so reset it here before normalizing
+		hit.nor.w = 0.0;
+	}
+	hit.nor = normalize(hit.nor);
+
+	const int matId = hit.hitObject->materialId;
+	const double reflectance = materials.GetReflectance(matId);
+	const SpecularType specularType = materials.GetSpecularType(matId);
+
+	// Denoiser features. Perfect mirrors only show what they reflect, so the features of the reflected surface line up
+	// with the color much better than the mirror's own
+	if (!path.hasFeatures && !(reflectance >= 1 && specularType == SpecularType::MIRROR)) {
+		path.features.albedo = glm::mix(materials.GetDiffuse(matId), materials.GetSpecular(matId), reflectance);
+		path.features.normal = dvec3(hit.nor);
+		path.hasFeatures = true;
+	}
+
+	// Emissive Color
+	// Only add this on the first bounce, or if this ray was created from a specular bounce
+	// Necessary since we're using explicit light sampling
+	// (See https://computergraphics.stackexchange.com/questions/5152/progressive-path-tracing-with-explicit-light-sampling/5153#5153)
+	if (path.specularBounce) {
+		path.radiance += path.throughput * materials.GetEmission(matId);
+	}
+	else if (path.glossyPdf > 0 && hit.hitObject->lightIdx >= 0) {
+		// This light could also have been found by sampling it from the glossy surface, so only count the part of the
+		// emission that the glossy reflection is better at finding (the light samples count the rest)
+		int lightIdx = hit.hitObject->lightIdx;
+		rvec4 toHit = hit.loc - ray.start;
+		double distSqr = (double)dot(toHit, toHit);
+		double cosLight = -(double)dot(toHit, hit.nor) / std::sqrt(distSqr);
+		double lightPdf = 0;
+		if (cosLight > 0) {
+			// Convert the light's area pdf to solid angle, to compare it with the glossy reflection's
+			lightPdf = GetLightSelectionPdf(lightIdx) * lights.GetLocationPdf(lightIdx, ray.start, hit.loc) * distSqr / cosLight;
+		}
+		// Lights that can't be sampled (lightPdf = 0) are only ever found this way, so they count in full
+		path.radiance += path.throughput * materials.GetEmission(matId) * ((lightPdf > 0) ? PowerHeuristic(path.glossyPdf, lightPdf) : 1.0);
+	}
+
+	// Random numbers for the direction of the next bounce (used by both the specular and diffuse reflections)
+	glm::dvec2 directionSample = sampler.Get2D();
+
+	// Take light samples, from every light or from lightSamples lights chosen in proportion to their power
+	// sampleLight is called with the index of each chosen light and the chance of it being chosen
+	auto chooseLights = [&](const auto& sampleLight) {
+		if (lightSamples > 0 && lightSamples < lights.Size()) {
+			// Choose lightSamples lights (with replacement). Dividing by the chance of choosing each one, times the
+			// number of picks, keeps the estimate of the sum over every light unbiased
+			for (int i = 0; i < lightSamples; i++) {
+				double selectionPdf;
+				int lightIdx = lightSelection.Sample(sampler.Get1D(), selectionPdf);
+				sampleLight(lightIdx, selectionPdf * lightSamples);
 			}
-			// If the ray makes it here, boost it by p to make up for the rays that have already been terminated by this point
-			throughput *= 1 / p;
 		}
 		else {
-			// Hit the background, so add the bg color and stop bouncing
-			outputColor += throughput * backgroundColor;
-			return outputColor;
+			// Sampling every light once has less noise than picking the same number of lights at random
+			for (int lightIdx = 0; lightIdx < lights.Size(); lightIdx++) {
+				sampleLight(lightIdx, 1.0);
+			}
+		}
+	};
+
+	// Randomly choose between specular and diffuse rays, depending on the material's reflectance
+	path.glossyPdf = 0;
+	if (sampler.Get1D() < reflectance) {
+		const dvec3& ks = materials.GetSpecular(matId);
+		switch (specularType) {
+		case SpecularType::MIRROR:
+			// Perfect mirror, there's only one direction to reflect in so lights can only be found by hitting them
+			path.throughput = path.throughput * ks;
+			ray = Ray3D(hit.loc, glm::reflect(ray.dir, hit.nor));
+			// Next ray is a reflection ray
+			path.specularBounce = true;
+			break;
+		case SpecularType::GLOSSY: {
+			// Glossy reflection off of a GGX microfacet surface, with ks as the specular color
+			// Work in a frame around the side of the normal that faces the incoming ray
+			dvec3 wo = -normalize(dvec3(ray.dir));
+			dvec3 normal = dvec3(hit.nor);
+			if (dot(wo, normal) < 0) normal = -normal;
+			dvec3 tangent, bitangent;
+			GGX::CreateFrame(normal, tangent, bitangent);
+			auto toLocal = [&](const dvec3& dir) { return dvec3(dot(dir, tangent), dot(dir, bitangent), dot(dir, normal)); };
+			dvec3 woLocal = toLocal(wo);
+			GGX ggx(materials.GetRoughness(matId));
+
+			// Direct Lighting
+			// Sample points on the area lights, and weight each one against the chance of the glossy reflection finding
+			// the same point (multiple importance sampling). Point lights have no area to be reflected, so just like a
+			// mirror, glossy surfaces don't pick them up
+			chooseLights([&](int lightIdx, double selectionPdf) {
+				LightSample sample = lights.RandomizeLocation(lightIdx, hit.loc, sampler.Get2D());
+				// Point lights have no area, and area lights can choose points that can't light this one (pdf = 0)
+				double areaPdf = lights.GetLocationPdf(lightIdx, hit.loc, sample.loc);
+				if (areaPdf <= 0 || sample.pdf <= 0) return;
+				dvec3 toLight = dvec3(sample.loc - hit.loc);
+				double distSqr = dot(toLight, toLight);
+				dvec3 wi = toLight / std::sqrt(distSqr);
+				double cosLight = -dot(wi, dvec3(sample.nor));
+				dvec3 wiLocal = toLocal(wi);
+				double brdf = ggx.Evaluate(woLocal, wiLocal);
+				if (cosLight <= 0 || brdf <= 0) return;
+				double lightPdf = selectionPdf * areaPdf * distSqr / cosLight;
+				ShadowRay shadowRay;
+				shadowRay.origin = hit.loc;
+				shadowRay.sample = sample;
+				shadowRay.lightIdx = lightIdx;
+				shadowRay.contribution = path.throughput * ks * lights.GetColor(lightIdx) * (brdf * wiLocal.z / lightPdf) *
+					PowerHeuristic(lightPdf, ggx.Pdf(woLocal, wiLocal));
+				shadowRays.push_back(shadowRay);
+			});
+
+			// Reflect off of a microfacet that's visible from the incoming ray. Some reflections end up below the
+			// surface (where rougher surfaces would shadow themselves), and those paths end here
+			dvec3 wiLocal = ggx.Sample(woLocal, directionSample);
+			if (wiLocal.z <= 0) return false;
+			path.throughput *= ks * (ggx.G(woLocal, wiLocal) / ggx.G1(woLocal));
+			path.glossyPdf = ggx.Pdf(woLocal, wiLocal);
+			dvec3 wi = wiLocal.x * tangent + wiLocal.y * bitangent + wiLocal.z * normal;
+			ray = Ray3D(hit.loc, rvec4(wi, 0));
+			// Emission that the next ray hits is weighted by glossyPdf instead of being counted in full
+			path.specularBounce = false;
+			break;
+		}
 		}
 	}
-	return outputColor;
+	else {
+		// Non-specular Lighting = Direct Lighting + Ambient Lighting
+
+		const dvec3& kd = materials.GetDiffuse(matId);
+
+		// Direct Lighting
+		// Explicitly sample the lights. The caller traces the shadow rays, and only adds the light's contribution if
+		// nothing is in the way
+		chooseLights([&](int lightIdx, double selectionPdf) {
+			ShadowRay shadowRay;
+			shadowRay.origin = hit.loc;
+			// If a light is an area light, choose a new random location on its surface
+			shadowRay.sample = lights.RandomizeLocation(lightIdx, hit.loc, sampler.Get2D());
+			// Area lights that only sample the part of the surface facing the hit can still find a point that doesn't
+			// (due to rounding), and there's no light to add from it
+			if (shadowRay.sample.pdf <= 0) return;
+			shadowRay.lightIdx = lightIdx;
+			// Lambertian shading
+			rvec4 lightVec = glm::normalize(shadowRay.sample.loc - hit.loc);
+			dvec3 cd = kd * std::max(0.0, (double)glm::dot(lightVec, hit.nor));
+			shadowRay.contribution = path.throughput * (lights.SampleLight(lightIdx, shadowRay.sample, hit.loc) * cd) /
+				(shadowRay.sample.pdf * selectionPdf);
+			shadowRays.push_back(shadowRay);
+		});
+
+		// Ambient Lighting = 1/N * sum from 1->N of ( 1/p * (f * L * cos(theta)))
+		// Where f = BRDF = kd/pi (use perfect diffuse shading for this model,
+		//     so albedo = kd https://computergraphics.stackexchange.com/questions/350/albedo-vs-diffuse
+		// L = incoming light, theta = angle btwn incoming (constant) and outgoing (randomized) light rays
+
+		// Next ray hit will be a diffuse bounce
+		ray = Ray3D(hit.loc, rvec4(GetRandomRayInHemisphere(hit.nor, directionSample)));
+		path.specularBounce = false;
+
+		// Attenuate further rays by BRDF / PDF
+		// Constant (lambertian) BRDF. Usually albedo / pi, but the pi cancels out w/pdf
+		const dvec3 BRDF = kd;
+		// Store 1/p to save some operations
+		// Proper PDF is cos(theta) / pi, but both the cos and the pi cancel out with the BRDF / lighting equation
+		constexpr double invPdf = 1.0;
+		path.throughput *= BRDF * invPdf;
+		// NOTE: normally, throughput would be multiplied by cos(theta), where theta is angle btwn new and old rays
+		// The random ray generation uses a cosine-weighted model, where PDF = cos(theta) / pi
+		// Therefore, when dividing by p the cos(theta) would cancel out with the full eq so we don't mult by it here
+	}
+
+	// Russian Roulette path termination
+	// Method from https://computergraphics.stackexchange.com/questions/2316/is-russian-roulette-really-the-answer
+	// Use throughput (color contribution modifier) as the terminating condition
+	// Q: Should p be based on throughput or output color? Take a dark scene with white walls - throughput is 1 even
+	// though rays are very dark.
+	// A: No, a ray bouncing off a mirror surface will have an accumulated output color of 0, but it might hit a light later and
+	// have a large contribution. The only way to guarantee a ray won't have much effect is if it's bounced off dark surfaces.
+	double p = std::max(path.throughput.x, std::max(path.throughput.y, path.throughput.z));
+	RENDER_STAT(RenderStats::Local().rouletteTests++);
+	// the lower the max value of throughput, the more likely execution will go here and break the loop
+	if (sampler.Get1D() >= p) {
+		// ^Note: >= since the sampler can return 0, which should still break when p = 0
+		RENDER_STAT(RenderStats::Local().rouletteTerminations++);
+		return false;
+	}
+	// If the ray makes it here, boost it by p to make up for the rays that have already been terminated by this point
+	path.throughput *= 1 / p;
+	return true;
 }
 
-bool Scene::IsPointInShadow(dvec4& hitLoc, dvec4& lightLoc, std::shared_ptr<SceneObject> lightObj) const {
-	HitResult shadowHit;
+bool Scene::IsShadowRayBlocked(const ShadowRay& ray) const {
+	RenderStats::Local().shadowRays++;
+	const rvec4& hitLoc = ray.origin;
+	const rvec4& lightLoc = ray.sample.loc;
+	const SceneObject* lightObj = lights.GetObject(ray.lightIdx);
 	// Shadow ray is located at the hit position, goes to the light
 	Ray3D shadowRay(hitLoc, glm::normalize(lightLoc - hitLoc));
 	// Maximum distance that shadow rays should travel
-	double lightDist = glm::length(lightLoc - hitLoc);
+	Real lightDist = glm::length(lightLoc - hitLoc);
 
 	// Check to see if there are any objects between the hit location and the light
-	for (auto& object : allObjects) {
-		// First, make sure this object isn't the object that belongs to the light that we're testing
-		// (we don't want to collide with the light source itself)
-		if (object != lightObj) {
-			// Set tMin to epsilon to avoid self-shadowing, and set tMax to the light's distance
-			if (object->Hit(shadowRay, shadowHit, epsilon, lightDist)) {
-				// If I hit anything, immediately return true, no further action required
-				return true;
-			}
+	// First, make sure this object isn't the object that belongs to the light that we're testing
+	// (we don't want to collide with the light source itself)
+	// Set tMin to epsilon to avoid self-shadowing, and set tMax to the light's distance
+	for (SceneObject* object : unboundedObjects) {
+		if (object != lightObj && object->HitAny(shadowRay, epsilon, lightDist)) {
+			// If I hit anything, immediately return true, no further action required
+			return true;
 		}
 	}
+	return objectBVH.TraverseAny(shadowRay, epsilon, lightDist, [&](int objIdx, Real tMin, Real tMax) {
+		SceneObject* object = boundedObjects[objIdx];
+		return object != lightObj && object->HitAny(shadowRay, tMin, tMax);
+	});
 
 	/* NOTE: Another way to accomplish the tMax behavior in Hit() (i.e. don't count intersections past the light location) 
 	could be to initialize shadowHit.t = <light distance>. The Hit function only returns true if the HitResult actually finds
 	a new t value that is smaller than its current t value. This would reduce the complexity of the code a bit (no longer
 	need to check for tMax in intersectLocal). But that's a bit harder to understand at a glance, so I decided to keep 
 	the tMax parameter for the sake of readability */
+}
+
+void Scene::FindClosestHit(Ray3D& ray, HitResult& hit) const {
+	for (SceneObject* object : unboundedObjects) {
+		if (object->Hit(ray, hit, epsilon)) {
+			// If hit was successful (i.e. found a new tMin), store a reference to the object
+			hit.hitObject = object;
+		}
+	}
+	// Only objects whose world-space bounds the ray crosses (in front of the closest hit so far) get transformed and tested
+	objectBVH.TraverseClosest(ray, epsilon, hit.t, [&](int objIdx, Real tMin, Real& tMax) {
+		SceneObject* object = boundedObjects[objIdx];
+		if (object->Hit(ray, hit, tMin, tMax)) {
+			hit.hitObject = object;
+			tMax = hit.t;
+			return true;
+		}
+		return false;
+	});
+}
+
+void Scene::FindClosestHitPacket(const RayPacket& packet, int activeMask, HitResult* hits) const {
+	for (SceneObject* object : unboundedObjects) {
+		int hitMask = object->HitPacket(packet, activeMask, hits, epsilon);
+		for (int lane = 0; lane < packetSize; lane++) {
+			if (hitMask & (1 << lane)) hits[lane].hitObject = object;
+		}
+	}
+	Real tMax[packetSize];
+	for (int lane = 0; lane < packetSize; lane++) tMax[lane] = hits[lane].t;
+	objectBVH.TraversePacket(packet, activeMask, epsilon, tMax, [&](int objIdx, int laneMask) {
+		SceneObject* object = boundedObjects[objIdx];
+		int hitMask = object->HitPacket(packet, laneMask, hits, epsilon);
+		for (int lane = 0; lane < packetSize; lane++) {
+			if (hitMask & (1 << lane)) {
+				hits[lane].hitObject = object;
+				tMax[lane] = hits[lane].t;
+			}
+		}
+	});
+}
+
+int Scene::AreShadowRaysBlocked(const ShadowRay* rays, int count) const {
+	RenderStats::Local().shadowRays += count;
+	RayPacket packet;
+	Real lightDist[packetSize];
+	const SceneObject* lightObjs[packetSize];
+	for (int lane = 0; lane < count; lane++) {
+		packet.SetRay(lane, rays[lane].origin, glm::normalize(rays[lane].sample.loc - rays[lane].origin));
+		lightDist[lane] = glm::length(rays[lane].sample.loc - rays[lane].origin);
+		lightObjs[lane] = lights.GetObject(rays[lane].lightIdx);
+	}
+	// Fill the unused lanes with a copy of a real ray, so they don't produce NaNs (they're masked out anyways)
+	for (int lane = count; lane < packetSize; lane++) {
+		packet.CopyLane(lane, 0);
+		lightDist[lane] = lightDist[0];
+	}
+	int activeMask = (1 << count) - 1;
+
+	// Lanes can't be blocked by the object that belongs to their own light
+	auto lanesToTest = [&](const SceneObject* object, int laneMask) {
+		for (int lane = 0; lane < count; lane++) {
+			if (object == lightObjs[lane]) laneMask &= ~(1 << lane);
+		}
+		return laneMask;
+	};
+
+	int shadowMask = 0;
+	for (SceneObject* object : unboundedObjects) {
+		int laneMask = lanesToTest(object, activeMask & ~shadowMask);
+		if (laneMask != 0) shadowMask |= object->HitAnyPacket(packet, laneMask, epsilon, lightDist);
+	}
+	if (shadowMask == activeMask) return shadowMask;
+	return shadowMask | objectBVH.TraversePacketAny(packet, activeMask & ~shadowMask, epsilon, lightDist,
+		[&](int objIdx, int laneMask) {
+			SceneObject* object = boundedObjects[objIdx];
+			laneMask = lanesToTest(object, laneMask);
+			return (laneMask != 0) ? object->HitAnyPacket(packet, laneMask, epsilon, lightDist) : 0;
+		});
+}
+
+void Scene::BuildAccelerationStructure() {
+	boundedObjects.clear();
+	unboundedObjects.clear();
+	vector<AABB> objectBounds;
+	for (auto& object : allObjects) {
+		AABB bounds = GetPaddedBounds(*object);
+		if (bounds.IsValid()) {
+			objectBounds.push_back(bounds);
+			boundedObjects.push_back(object.get());
+		}
+		else {
+			unboundedObjects.push_back(object.get());
+		}
+	}
+	// Scenes tend to have few, large objects, so keep leaves small to avoid transforming rays into objects they miss
+	auto buildStart = chrono::steady_clock::now();
+	objectBVH.Build(objectBounds, 1);
+	objectBVHSeconds = chrono::duration<double>(chrono::steady_clock::now() - buildStart).count();
+}
+
+AABB Scene::GetPaddedBounds(const SceneObject& object) const {
+	AABB bounds = object.GetWorldBounds();
+	if (bounds.IsValid()) {
+		// Pad the bounds slightly, so flat objects (squares) still have some thickness for the slab test
+		bounds.min -= rvec3(epsilon);
+		bounds.max += rvec3(epsilon);
+	}
+	return bounds;
+}
+
+bool Scene::SetObjectTransform(const std::string& objectName, const Transform& transf) {
+	SceneObject* object = nullptr;
+	for (const unique_ptr<SceneObject>& candidate : allObjects) {
+		if (candidate->name == objectName) {
+			object = candidate.get();
+			break;
+		}
+	}
+	if (!object || !object->SetTransform(transf)) return false;
+	// Objects keep their index in boundedObjects, so the tree's structure still fits and only its boxes are stale
+	vector<AABB> objectBounds;
+	objectBounds.reserve(boundedObjects.size());
+	for (const SceneObject* bounded : boundedObjects) {
+		objectBounds.push_back(GetPaddedBounds(*bounded));
+	}
+	objectBVH.Refit(objectBounds);
+	// Emissive objects may have changed size, and the scene's bounds set the lights' typical distance
+	BuildLightTable();
+	return true;
+}
+
+int Scene::FlattenTransforms() {
+	int numFlattened = 0;
+	for (auto& object : allObjects) {
+		if (object->Flatten()) numFlattened++;
+	}
+	// Flattened meshes have tighter bounds, and nothing else should have moved, but rebuild both to stay consistent
+	BuildAccelerationStructure();
+	BuildLightTable();
+	return numFlattened;
+}
+
+void Scene::BuildLightTable() {
+	// Lights are chosen once for the whole scene, so their falloff can only be judged at a typical distance instead of
+	// the actual distance to each hit. Use the radius of the scene's bounds
+	double typicalDistance = 1.0;
+	if (!objectBVH.IsEmpty()) {
+		const AABB& bounds = objectBVH.GetBounds();
+		typicalDistance = 0.5 * glm::length(dvec3(bounds.max - bounds.min));
+	}
+	vector<double> weights;
+	weights.reserve(allLights.size());
+	for (size_t lightIdx = 0; lightIdx < allLights.size(); lightIdx++) {
+		SceneObject* lightObj = allLights[lightIdx]->GetObject();
+		if (lightObj) {
+			// Meshes are loaded and flattened by now, so their area (and the light's power) is final
+			lightObj->PrepareSurfaceSampling();
+			// Lets hits on emissive objects find their light, to weight the emission against light sampling
+			lightObj->lightIdx = (int)lightIdx;
+		}
+		weights.push_back(allLights[lightIdx]->GetSelectionWeight(typicalDistance));
+	}
+	lightSelection.Build(weights);
+	lights.Build(allLights);
+}
+
+double Scene::GetLightSelectionPdf(int lightIdx) const {
+	if (lightSamples > 0 && lightSamples < lights.Size()) return lightSelection.GetPdf(lightIdx) * lightSamples;
+	return 1.0;
+}
 
-	return false;
+double Scene::PowerHeuristic(double pdf, double otherPdf) {
+	// Veach's power heuristic (beta = 2)
+	double sqr = pdf * pdf;
+	return (sqr > 0) ? sqr / (sqr + otherPdf * otherPdf) : 0.0;
 }
 
 
 
-glm::dvec4 Scene::GetRandomRayInHemisphere(glm::dvec4& normal)
+rvec4 Scene::GetRandomRayInHemisphere(const rvec4& normal, const glm::dvec2& sample) const
 {
 	// Use a cosine-weighted point generation method from https://graphicscompendium.com/raytracing/19-monte-carlo
 	// TODO: cite in readme
 	
 	// Basic idea: generate points uniformly on a disc, then project up onto the hemisphere
-	double u = rand() / (float)RAND_MAX;
-	double v = rand() / (float)RAND_MAX;
+	double u = sample.x;
+	double v = sample.y;
 	double r = sqrt(u);
 	double theta = 2.0 * glm::pi<double>() * v;
 
@@ -165,102 +481,287 @@ glm::dvec4 Scene::GetRandomRayInHemisphere(glm::dvec4& normal)
 
 	// Before rotating, check if the local normal and world normal are parallel
 	dvec3 localUp(0, 1, 0);
-	if (localUp == dvec3(normal)) return dvec4(localDir, 0);
-	if (localUp == -1.0 * dvec3(normal)) return dvec4(-1.0 * localDir, 0);
+	dvec3 worldNormal(normal);
+	if (localUp == worldNormal) return rvec4(localDir, 0);
+	if (localUp == -1.0 * worldNormal) return rvec4(-1.0 * localDir, 0);
 
 	// dot(u, v) = cos(theta) for unit vectors
-	double angle = acos(dot(localUp, dvec3(normal)));
-	dvec3 axis = cross(localUp, dvec3(normal));
+	double angle = acos(dot(localUp, worldNormal));
+	dvec3 axis = cross(localUp, worldNormal);
 
-	return dvec4(rotate(localDir, angle, axis), 0);
+	return rvec4(rotate(localDir, angle, axis), 0);
 }
 
-void Scene::BuildSceneFromFile(std::string filename, Camera& camera) {
+bool Scene::BuildSceneFromFile(std::string filename, Camera& camera, int loadThreads, BVHBuildMethod meshBVHMethod) {
 	std::cout << "Reading scene data from " << filename << " ... ";
 
 	ifstream file(filename);
 	if (!file.good()) {
 		cerr << endl << "ERROR: Unable to find a description for the provided scene file: " << filename << endl;
-		return;
+		return false;
 	}
 
+	// Mesh files are loaded once the whole scene file has been read, so that they can be loaded in parallel
+	vector<PendingMesh> pendingMeshes;
+	// Emissive lights are added after all of the point lights, in the same order as their objects
+	vector<unique_ptr<Light> > emissiveLights;
+	// Top-level key that the parser is currently inside of, and the sections that have been found so far
+	string section;
+	bool foundCamera = false, foundLights = false, foundObjects = false;
 	try {
-		// Read the json object from the file
-		json j;
-		file >> j;
-
-		// Set up the Camera
-		json cam = j.at("Camera");
-		camera.SetPosition(dvec4(ReadVec3(cam.at("Transform").at("Translation")), 1));
-		camera.SetRotationDegrees(ReadVec3(cam.at("Transform").at("Rotation")));
-		camera.SetFOVDegrees(cam.at("Fov").get<double>());
-		camera.Setup();
-
-		// Loop through the lights in the file
-		for (auto& light : j.at("Lights")) {
-			string lightType = light.at("LightType").get<string>();
-			
-			if (lightType == "PointLight") {
-				allLights.push_back(make_shared<PointLight>(
-					light.at("Name").get<string>(),
-					light.at("Linear").get<double>(),
-					light.at("Quadratic").get<double>(),
-					light.at("FalloffDistance").get<double>(),
-					dvec4(ReadVec3(light.at("Translation")), 1),
-					ReadVec3(light.at("Color"))
-					)
-				);
+		// Stream through the file instead of reading it into one big json object. The parser calls back at every event,
+		// and each camera, light and object is built as soon as its own json object is complete. Returning false throws
+		// that json away, so only one object's worth of json is held in memory at a time (what's left over at the end is
+		// only the sections that aren't used, so it's discarded as well)
+		(void)json::parse(file, [&](int depth, json::parse_event_t event, json& parsed) {
+			if (depth == 1 && event == json::parse_event_t::key) {
+				section = parsed.get<string>();
+				foundLights |= (section == "Lights");
+				foundObjects |= (section == "SceneObjects");
 			}
-		}
-
-		// Loop through the sceneobjects in the file
-		for (auto& object : j.at("SceneObjects")) {
-			// Construct Object based on its subclass
-			string objectType = object.at("ObjectType").get<string>();
-			
-			if (objectType == "Sphere") {
-				allObjects.push_back(ReadObject<Sphere>(object));
+			else if (depth == 1 && event == json::parse_event_t::object_end && section == "Camera") {
+				ReadCamera(parsed, camera);
+				foundCamera = true;
+				return false;
 			}
-			else if (objectType == "Plane") {
-				allObjects.push_back(ReadObject<Plane>(object));
+			else if (depth == 2 && event == json::parse_event_t::object_end &&
+				(section == "Lights" || section == "SceneObjects")) {
+				// One element of the lights or objects list
+				if (section == "Lights") ReadLight(parsed);
+				else ReadSceneObject(parsed, pendingMeshes, emissiveLights);
+				return false;
 			}
-			else if (objectType == "Square") {
-				allObjects.push_back(ReadObject<Square>(object));
+			else if (depth == 1 && event == json::parse_event_t::array_end) {
+				// Every element was already thrown away, so there's nothing to keep
+				return false;
 			}
-			else if (objectType == "Box") {
-				allObjects.push_back(ReadObject<Box>(object));
-			}
-			else if (objectType == "TriangleMesh") {
-				shared_ptr<TriangleMesh> newMesh = ReadObject<TriangleMesh>(object);
-				newMesh->LoadMeshFile(object.at("FileName").get<string>());
-				allObjects.push_back(newMesh);
-			}
-			// If object is emissive, also construct a light
-			if (object.at("Material").at("IsEmissive").get<bool>()) {
-				// Get a reference to the object that was just added
-				shared_ptr<SceneObject> topObj = allObjects.back();
-				// Extract the emissive light's properties
-				json lightData = object.at("Material").at("EmissiveProperties");
-				allLights.push_back(make_shared<EmissiveLight>(
-					topObj->name + "_EmissiveLight",
-					lightData.at("Linear").get<double>(),
-					lightData.at("Quadratic").get<double>(),
-					lightData.at("FalloffDistance").get<double>(),
-					topObj)
-				);
-				// Send a warning message if the object doesn't have a way to generate random points on its surface
-				if (!topObj->hasRandomPointMethodDefined) {
-					cerr << endl << "WARNING: emissive color defined for SceneObject \"" << topObj->name;
-					cerr << "\", but no random point generation method defined. Using the object origin instead." << endl;
-				}
-			}
-		}
+			return true;
+		});
 	}
 	catch (json::exception& e) {
 		cerr << endl << "ERROR: " << e.what() << endl;
-		return;
+		return false;
 	}
+	if (!foundCamera || !foundLights || !foundObjects) {
+		cerr << endl << "ERROR: scene file is missing its \"" <<
+			(!foundCamera ? "Camera" : (!foundLights ? "Lights" : "SceneObjects")) << "\" section" << endl;
+		return false;
+	}
+	for (unique_ptr<Light>& light : emissiveLights) {
+		allLights.push_back(std::move(light));
+	}
+
+	LoadMeshes(pendingMeshes, loadThreads, meshBVHMethod);
 	std::cout << "done!" << endl;
+	return CompileScene();
+}
+
+// True if every component is a finite number
+static bool IsFinite(const dvec3& v) {
+	return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+}
+
+// Colors can be any finite amount of light, but not a negative one
+static bool IsValidColor(const dvec3& color) {
+	return IsFinite(color) && color.x >= 0 && color.y >= 0 && color.z >= 0;
+}
+
+bool Scene::ValidateScene() {
+	bool valid = true;
+	for (const unique_ptr<SceneObject>& object : allObjects) {
+		const Transform& transf = object->GetTransform();
+		if (!IsFinite(dvec3(transf.translation)) || !IsFinite(dvec3(transf.rotation)) || !IsFinite(dvec3(transf.scale))) {
+			cerr << "ERROR: SceneObject \"" << object->name << "\" has a transform that isn't a finite number" << endl;
+			valid = false;
+		}
+		Material& material = allMaterials[object->materialId];
+		if (!IsValidColor(material.kd) || !IsValidColor(material.ks) || !IsValidColor(material.ke)) {
+			cerr << "ERROR: SceneObject \"" << object->name << "\" has a negative or invalid material color" << endl;
+			valid = false;
+		}
+		if (!std::isfinite(material.reflectance) || !std::isfinite(material.roughness) ||
+			!std::isfinite(material.specularExp)) {
+			cerr << "ERROR: SceneObject \"" << object->name << "\" has a material value that isn't a finite number" << endl;
+			valid = false;
+			continue;
+		}
+		// Shading treats these as fractions, so values outside of [0, 1] are most likely typos
+		if (material.reflectance < 0 || material.reflectance > 1 || material.roughness < 0 || material.roughness > 1) {
+			cerr << "WARNING: clamping the reflectance and roughness of SceneObject \"" << object->name;
+			cerr << "\" into [0, 1]" << endl;
+			material.reflectance = std::min(std::max(material.reflectance, 0.0), 1.0);
+			material.roughness = std::min(std::max(material.roughness, 0.0), 1.0);
+		}
+	}
+	for (const unique_ptr<Light>& light : allLights) {
+		double L = light->GetLinear(), Q = light->GetQuadratic(), distance = light->GetFalloffDistance();
+		// The attenuation divides by the falloff distance, and negative factors can make it negative or infinite
+		if (!std::isfinite(L) || !std::isfinite(Q) || !std::isfinite(distance) || L < 0 || Q < 0 || distance <= 0) {
+			cerr << "ERROR: light \"" << light->name << "\" needs a positive falloff distance, and linear and quadratic";
+			cerr << " factors that are >= 0" << endl;
+			valid = false;
+		}
+		// Emissive lights get their color from their object's material, which was checked above
+		if (light->GetType() == LightType::POINT && !IsValidColor(light->GetColor())) {
+			cerr << "ERROR: light \"" << light->name << "\" has a negative or invalid color" << endl;
+			valid = false;
+		}
+	}
+	return valid;
+}
+
+bool Scene::CompileScene() {
+	if (!ValidateScene()) return false;
+
+	// Objects that rays can't hit would only cost time to test, and any light that they have can't shine anywhere either
+	// A zero scale also makes the object's matrix impossible to invert
+	set<const SceneObject*> droppedObjects;
+	for (const unique_ptr<SceneObject>& object : allObjects) {
+		const rvec3& scale = object->GetTransform().scale;
+		const char* reason = nullptr;
+		if (!object->HasGeometry()) reason = "it has no geometry";
+		else if (scale.x == 0 || scale.y == 0 || scale.z == 0) reason = "it has a scale of 0";
+		if (reason) {
+			cerr << "WARNING: dropping SceneObject \"" << object->name << "\", " << reason << endl;
+			droppedObjects.insert(object.get());
+		}
+	}
+	size_t numLights = allLights.size();
+	allLights.erase(std::remove_if(allLights.begin(), allLights.end(), [&](const unique_ptr<Light>& light) {
+		if (droppedObjects.count(light->GetObject())) return true;
+		// Black lights still cost a shadow ray for every sample (or a share of them when lights are picked by power)
+		if (light->GetColor() == dvec3(0)) {
+			cerr << "WARNING: dropping light \"" << light->name << "\", it doesn't give off any light" << endl;
+			return true;
+		}
+		return false;
+	}), allLights.end());
+	size_t numObjects = allObjects.size();
+	allObjects.erase(std::remove_if(allObjects.begin(), allObjects.end(), [&](const unique_ptr<SceneObject>& object) {
+		return droppedObjects.count(object.get()) > 0;
+	}), allObjects.end());
+
+	BuildAccelerationStructure();
+	BuildLightTable();
+	CompileMaterials();
+
+	// Summary of what will actually be rendered
+	size_t numTriangles = 0, numPointLights = 0;
+	for (const unique_ptr<SceneObject>& object : allObjects) {
+		if (object->GetType() == ObjectType::TRIANGLE_MESH) {
+			numTriangles += static_cast<const TriangleMesh&>(*object).GetGeometry()->GetTriangles().Size();
+		}
+	}
+	for (const unique_ptr<Light>& light : allLights) {
+		if (light->GetType() == LightType::POINT) numPointLights++;
+	}
+	cout << "Scene: " << allObjects.size() << " objects (" << boundedObjects.size() << " in the BVH, ";
+	cout << numTriangles << " mesh triangles), " << allLights.size() << " lights (" << numPointLights << " point, ";
+	cout << allLights.size() - numPointLights << " emissive)";
+	if (numObjects != allObjects.size() || numLights != allLights.size()) {
+		cout << ", dropped " << numObjects - allObjects.size() << " objects and " << numLights - allLights.size();
+		cout << " lights";
+	}
+	cout << endl;
+	return true;
+}
+
+void Scene::ReadCamera(const json& j, Camera& camera) {
+	camera.SetPosition(rvec4(ReadVec3(j.at("Transform").at("Translation")), 1));
+	camera.SetRotationDegrees(rvec3(ReadVec3(j.at("Transform").at("Rotation"))));
+	camera.SetFOVDegrees(j.at("Fov").get<double>());
+	camera.Setup();
+}
+
+void Scene::ReadLight(const json& j) {
+	string lightType = j.at("LightType").get<string>();
+	
+	if (lightType == "PointLight") {
+		allLights.push_back(make_unique<PointLight>(
+			j.at("Name").get<string>(),
+			j.at("Linear").get<double>(),
+			j.at("Quadratic").get<double>(),
+			j.at("FalloffDistance").get<double>(),
+			rvec4(ReadVec3(j.at("Translation")), 1),
+			ReadVec3(j.at("Color"))
+			)
+		);
+	}
+}
+
+void Scene::ReadSceneObject(const json& j, vector<PendingMesh>& pendingMeshes, vector<unique_ptr<Light> >& emissiveLights) {
+	// Construct Object based on its subclass
+	string objectType = j.at("ObjectType").get<string>();
+	
+	if (objectType == "Sphere") {
+		allObjects.push_back(ReadObject<Sphere>(j));
+	}
+	else if (objectType == "Plane") {
+		allObjects.push_back(ReadObject<Plane>(j));
+	}
+	else if (objectType == "Square") {
+		allObjects.push_back(ReadObject<Square>(j));
+	}
+	else if (objectType == "Box") {
+		allObjects.push_back(ReadObject<Box>(j));
+	}
+	else if (objectType == "TriangleMesh") {
+		unique_ptr<TriangleMesh> newMesh = ReadObject<TriangleMesh>(j);
+		pendingMeshes.push_back({ newMesh.get(), j.at("FileName").get<string>() });
+		allObjects.push_back(std::move(newMesh));
+	}
+	// If object is emissive, also construct a light
+	if (j.at("Material").at("IsEmissive").get<bool>()) {
+		// Get a reference to the object that was just added
+		SceneObject* topObj = allObjects.back().get();
+		// Extract the emissive light's properties
+		const json& lightData = j.at("Material").at("EmissiveProperties");
+		emissiveLights.push_back(make_unique<EmissiveLight>(
+			topObj->name + "_EmissiveLight",
+			lightData.at("Linear").get<double>(),
+			lightData.at("Quadratic").get<double>(),
+			lightData.at("FalloffDistance").get<double>(),
+			topObj)
+		);
+		// Send a warning message if the object doesn't have a way to generate random points on its surface
+		if (!topObj->hasRandomPointMethodDefined) {
+			cerr << endl << "WARNING: emissive color defined for SceneObject \"" << topObj->name;
+			cerr << "\", but no random point generation method defined. Using the object origin instead." << endl;
+		}
+	}
+}
+
+void Scene::LoadMeshes(const vector<PendingMesh>& pendingMeshes, int numThreads, BVHBuildMethod bvhMethod) {
+	BVHBuildSettings bvhSettings;
+	bvhSettings.method = bvhMethod;
+	set<string> fileNames;
+	for (const PendingMesh& pending : pendingMeshes) {
+		fileNames.insert(pending.fileName);
+	}
+	// Not worth starting threads for a single file, let its BVH build use them instead
+	if (fileNames.size() <= 1 || numThreads == 1) {
+		bvhSettings.numThreads = (fileNames.size() == 1) ? numThreads : 1;
+		for (const PendingMesh& pending : pendingMeshes) {
+			pending.mesh->LoadMeshFile(pending.fileName, bvhSettings);
+		}
+	}
+	else {
+		// Each mesh only touches its own object, and MeshGeometry makes sure that every file is only loaded once
+		int poolThreads = (numThreads > 0) ? numThreads : (int)std::thread::hardware_concurrency();
+		ThreadPool pool(std::max(1, std::min(poolThreads, (int)fileNames.size())));
+		for (const PendingMesh& pending : pendingMeshes) {
+			pool.Submit([&pending, &bvhSettings]() { pending.mesh->LoadMeshFile(pending.fileName, bvhSettings); });
+		}
+		pool.WaitAll();
+	}
+
+	// Instances share their geometry, so only count each file's build once
+	set<const MeshGeometry*> geometries;
+	for (const PendingMesh& pending : pendingMeshes) {
+		if (geometries.insert(pending.mesh->GetGeometry()).second && pending.mesh->GetGeometry()) {
+			meshBVHSeconds += pending.mesh->GetGeometry()->GetBVHBuildSeconds();
+		}
+	}
 }
 
 glm::dvec3 Scene::ReadVec3(const json& j) {
@@ -273,19 +774,38 @@ glm::dvec3 Scene::ReadVec3(const json& j) {
 
 Transform Scene::ReadTransform(const json& j) {
 	return Transform(
-		dvec4(ReadVec3(j.at("Translation")), 1),
-		ReadVec3(j.at("Rotation")),
-		ReadVec3(j.at("Scale"))
+		rvec4(ReadVec3(j.at("Translation")), 1),
+		rvec3(ReadVec3(j.at("Rotation"))),
+		rvec3(ReadVec3(j.at("Scale")))
 	);
 }
 
-shared_ptr<Material> Scene::ReadMaterial(const json& j) {
+void Scene::CompileMaterials() {
+	materials.Build(allMaterials);
+}
+
+const SceneObject* Scene::FindObject(const std::string& objectName) const {
+	for (const unique_ptr<SceneObject>& object : allObjects) {
+		if (object->name == objectName) return object.get();
+	}
+	return nullptr;
+}
+
+Material* Scene::FindMaterial(const std::string& objectName) {
+	for (const unique_ptr<SceneObject>& object : allObjects) {
+		// Objects only see their material as const, so return the scene's own copy
+		if (object->name == objectName) return &allMaterials[object->materialId];
+	}
+	return nullptr;
+}
+
+const Material* Scene::ReadMaterial(const json& j) {
 	dvec3 ke(0, 0, 0);
 	// The emissive color is not included for non-emissive objects, so check before reading emissive color
 	if (j.at("IsEmissive").get<bool>()) {
 		ke = Camera::ColorSRGBToLinear(ReadVec3(j.at("EmissiveProperties").at("EmissiveColor")));
 	}
-	return make_shared<Material>(
+	allMaterials.emplace_back(
 		Camera::ColorSRGBToLinear(ReadVec3(j.at("DiffuseColor"))),
 		Camera::ColorSRGBToLinear(ReadVec3(j.at("SpecularColor"))),
 		ke,
@@ -293,4 +813,5 @@ shared_ptr<Material> Scene::ReadMaterial(const json& j) {
 		j.at("SpecularExp"),
 		j.at("Roughness")
 	);
+	return &allMaterials.back();
 }
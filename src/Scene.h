@@ -5,12 +5,18 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <deque>
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <cstdlib>
 
 #include "nlohmann/json.hpp"
+#include "Sampler.h"
 #include "Camera.h"
 #include "SceneObject.h"
 #include "Sphere.h"
@@ -24,48 +30,195 @@
 #include "Light.h"
 #include "PointLight.h"
 #include "EmissiveLight.h"
+#include "BVH.h"
+#include "AliasTable.h"
+#include "LightTable.h"
+#include "MaterialTable.h"
+#include "Microfacet.h"
+#include "ThreadPool.h"
 
 class Scene {
 public:
+	// Surface properties seen by a path, saved alongside its color so the image can be denoised (see Denoiser.h)
+	struct Features {
+		// Fraction of the light that the surface reflects, diffuse and specular combined
+		glm::dvec3 albedo = glm::dvec3(0);
+		// World-space normal
+		glm::dvec3 normal = glm::dvec3(0);
+	};
+
+	// Everything about a path that's carried from one bounce to the next
+	struct PathState {
+		// Color gathered along the path so far
+		glm::dvec3 radiance = glm::dvec3(0);
+		// Stores the filtered color of each surface as we bounce off of them (i.e. bounce of a red surface, throughput is now 1, 0, 0)
+		glm::dvec3 throughput = glm::dvec3(1);
+		// This variable is true on the first loop so that initial hits on emissive objects return the proper color
+		bool specularBounce = true;
+		// Solid angle pdf of the glossy reflection that created the current ray (0 if it wasn't a glossy reflection)
+		// Emission that the ray hits is weighted against the chance of light sampling finding it instead
+		double glossyPdf = 0;
+		// Features of the first surface that the path hit, or the first one seen through perfect mirrors (paths that
+		// miss everything keep all zeros)
+		Features features;
+		bool hasFeatures = false;
+	};
+
+	// A ray from a hit point to a sample on a light. The light's contribution is only added to the path if nothing
+	// blocks the ray
+	struct ShadowRay {
+		rvec4 origin;
+		LightSample sample;
+		int lightIdx = 0;
+		glm::dvec3 contribution = glm::dvec3(0);
+		// Path that the ray belongs to (only used by the wavefront integrator)
+		int pathIdx = 0;
+	};
+
 	Scene(glm::dvec3 _bgColor) : backgroundColor(_bgColor) {}
 	
 	// Iterate over all objects/lights in the scene to find the color of the given ray, returns dvec3 with rgb values from 0 to 1
-	glm::dvec3 ComputeRayColor(Ray3D& ray);
-	void BuildSceneFromFile(std::string filename, Camera& camera);
+	// Every random decision along the path draws its numbers from the sampler, which must already be started on the
+	// ray's pixel sample. If primaryHit is provided, it is used as the result of the first intersection instead of tracing the ray again
+	// (i.e. when the camera rays were already traced together as a packet). The path's features are stored in outFeatures
+	// if it's provided
+	glm::dvec3 ComputeRayColor(Ray3D& ray, Sampler& sampler, const HitResult* primaryHit = nullptr,
+		Features* outFeatures = nullptr) const;
+	// Find the closest object hit by each active lane of the packet. hits must have packetSize entries
+	void FindClosestHitPacket(const RayPacket& packet, int activeMask, HitResult* hits) const;
+	// Read the camera, lights, and objects from a json scene file. Returns false if the file is missing or invalid
+	// The file is streamed, so memory use grows with the scene rather than with the size of the json. Mesh files are
+	// loaded afterwards on loadThreads threads (<= 0 = one per core), and their BVHs are built with meshBVHMethod
+	bool BuildSceneFromFile(std::string filename, Camera& camera, int loadThreads = 1,
+		BVHBuildMethod meshBVHMethod = BVHBuildMethod::SAH);
+	// Time spent building BVHs: the meshes' (not counting ones that came out of the mesh cache) plus the latest build of
+	// the top-level BVH
+	double GetBVHBuildSeconds() const { return meshBVHSeconds + objectBVHSeconds; }
+	// Number of lights that each diffuse bounce sends shadow rays to. Lights are picked at random in proportion to their
+	// power, so the cost per bounce stays the same however many lights there are (<= 0 = sample every light)
+	void SetLightSamples(int count) { lightSamples = count; }
+	// Bake the transforms of every object that supports it into its geometry (see SceneObject::Flatten), so that rays
+	// and normals don't have to be transformed on every hit. Returns the number of objects that were flattened
+	int FlattenTransforms();
+	// Object with the given name (nullptr if there's no such object)
+	const SceneObject* FindObject(const std::string& objectName) const;
+	// Move the object with the given name between renders. Only the bounds of the top-level BVH are refit around the
+	// object's new position, since moving objects doesn't change which ones the tree holds (mesh BVHs are in local space,
+	// so instances don't need anything rebuilt). Returns false if there's no such object, or it was flattened
+	bool SetObjectTransform(const std::string& objectName, const Transform& transf);
+	// Material of the object with the given name, for editing it between renders (nullptr if there's no such object)
+	// Only the shading values can be changed this way, emission is baked into the lights when the scene is loaded
+	Material* FindMaterial(const std::string& objectName);
+	// Copy every material into the table that shading reads from. Edits made through FindMaterial only show up in the
+	// render after this is called
+	void CompileMaterials();
 
 private:
-	// This is a vector of shared_ptrs since the hitResult object needs to be able to point to them
-	std::vector<std::shared_ptr<SceneObject> > allObjects;
-	std::vector<std::shared_ptr<Light> > allLights;
+	// Traces the same paths as ComputeRayColor, one bounce of many paths at a time
+	friend class WavefrontIntegrator;
+
+	// The scene owns every object, light and material. Everything else (hits, lights, the object lists below) refers to
+	// them by raw pointer or index, so tracing rays never touches a reference count
+	std::vector<std::unique_ptr<SceneObject> > allObjects;
+	std::vector<std::unique_ptr<Light> > allLights;
+	// A deque, so that materials keep their address as more are added
+	std::deque<Material> allMaterials;
+	// Picks lights in proportion to their estimated contribution, when only some of them are sampled per bounce
+	AliasTable lightSelection;
+	// Compiled copies of allLights and allMaterials that shading reads from, indexed by light index and material ID
+	LightTable lights;
+	MaterialTable materials;
+	int lightSamples = 0;
+
+	// Top-level acceleration structure over the world-space bounds of every finite object
+	// Objects are referred to by their index in boundedObjects
+	BVH objectBVH;
+	std::vector<SceneObject*> boundedObjects;
+	// Objects without finite bounds (planes), tested against every ray
+	std::vector<SceneObject*> unboundedObjects;
+	double meshBVHSeconds = 0;
+	double objectBVHSeconds = 0;
 
 	glm::dvec3 backgroundColor = glm::dvec3(0, 0, 0);
 
 	// "Fudge Factor" to avoid self-intersection on shadow/reflection ray hits
-	const double epsilon = 0.00001; // 1e-5
+	// Floats only have ~7 significant digits, so single-precision builds need a larger offset
+#ifdef SINGLE_PRECISION
+	const Real epsilon = Real(0.0001); // 1e-4
+#else
+	const Real epsilon = 0.00001; // 1e-5
+#endif
 	// Maximum number of times ComputeRayColor can loop before forcibly returning
 	const int  maxBounces = 10;
 	
-	// Run an intersection check on the ray to a given light, but return false immediately if a hit is found
-	bool IsPointInShadow(glm::dvec4& hitLoc, glm::dvec4& lightLoc, std::shared_ptr<SceneObject> lightObj = nullptr) const;
-	// Find a random unit vector from center->surface of a hemisphere with the given normal
-	glm::dvec4 GetRandomRayInHemisphere(glm::dvec4& normal);
+	// Check the scene that was just read and get it ready to render: drop objects that can never be hit and lights that
+	// give off no light, build the top-level BVH and the light and material tables, and print a summary of the result
+	// Returns false if the scene has values that would break the render (i.e. negative colors or falloff distances)
+	bool CompileScene();
+	// Print an error for every value in the scene that can't be rendered, and clamp the material fractions into [0, 1]
+	// Returns false if there were any errors
+	bool ValidateScene();
+	// Sort allObjects into bounded/unbounded lists, and build the top-level BVH over the bounded ones
+	void BuildAccelerationStructure();
+	// Bounds of a bounded object as the top-level BVH stores them
+	AABB GetPaddedBounds(const SceneObject& object) const;
+	// Weight every light by its power and falloff over the size of the scene, for choosing which ones to sample, and
+	// compile the lights into the light table
+	void BuildLightTable();
+	// Chance of a light sample picking this light, times the number of lights sampled (1 when every light is sampled)
+	double GetLightSelectionPdf(int lightIdx) const;
+	// Multiple importance sampling weight of a sample from a strategy with the given pdf, against another strategy
+	static double PowerHeuristic(double pdf, double otherPdf);
+	// Find the closest object hit by the ray, store it in hit.hitObject (stays nullptr if nothing was hit)
+	void FindClosestHit(Ray3D& ray, HitResult& hit) const;
+
+	// Any-hit check on the ray to its light (skipping the light's own object), returns true as soon as something blocks it
+	bool IsShadowRayBlocked(const ShadowRay& ray) const;
+	// Shadow test for up to packetSize shadow rays at once, traced as a packet. Each lane skips the object that belongs
+	// to its own light. Returns the mask of rays that are blocked
+	int AreShadowRaysBlocked(const ShadowRay* rays, int count) const;
+	// Shade the closest hit of a path: add its emission, take a sample of every light or of lightSamples chosen lights
+	// (appended to shadowRays, for the caller to trace), and choose the next bounce. Updates the ray and path for the next bounce, returns false if
+	// russian roulette ended the path
+	bool ShadeHit(Ray3D& ray, HitResult& hit, Sampler& sampler, PathState& path, std::vector<ShadowRay>& shadowRays) const;
+	// Find a random unit vector from center->surface of a hemisphere with the given normal, from a sample in [0, 1)^2
+	rvec4 GetRandomRayInHemisphere(const rvec4& normal, const glm::dvec2& sample) const;
+
+	// A mesh object whose file is loaded after the rest of the scene has been read
+	struct PendingMesh {
+		TriangleMesh* mesh;
+		std::string fileName;
+	};
+	// Set up the camera from a json camera object
+	void ReadCamera(const nlohmann::json& j, Camera& camera);
+	// Construct a light from a json light object, and add it to allLights
+	void ReadLight(const nlohmann::json& j);
+	// Construct an object from a json scene object and add it to allObjects. Meshes are added to pendingMeshes instead of
+	// loading their file, and emissive objects also add a light to emissiveLights
+	void ReadSceneObject(const nlohmann::json& j, std::vector<PendingMesh>& pendingMeshes,
+		std::vector<std::unique_ptr<Light> >& emissiveLights);
+	// Load the files of the pending meshes, in parallel if there are several (<= 0 threads = one per core). A single
+	// file builds its BVH on all of the threads instead
+	void LoadMeshes(const std::vector<PendingMesh>& pendingMeshes, int numThreads, BVHBuildMethod bvhMethod);
 
 	// Reads the next 3 values from the stream and places them into a dvec3
 	glm::dvec3 ReadVec3(const nlohmann::json& j);
 	// Reads location, rotation, and scale vectors from a json transform object
 	Transform ReadTransform(const nlohmann::json& j);
-	// Reads diffuse, specular, and emissive colors from a json material object
-	std::shared_ptr<Material> ReadMaterial(const nlohmann::json& j);
-	// Reads the parameters for SceneObject construction, then adds it to the allobjects list
-	template<class ObjectType> std::shared_ptr<ObjectType> ReadObject(const nlohmann::json& j);
+	// Reads diffuse, specular, and emissive colors from a json material object, and adds it to the material list
+	const Material* ReadMaterial(const nlohmann::json& j);
+	// Reads the parameters for SceneObject construction, the caller adds it to the allobjects list
+	template<class ObjectType> std::unique_ptr<ObjectType> ReadObject(const nlohmann::json& j);
 };
 
 template<class ObjectType>
-inline std::shared_ptr<ObjectType> Scene::ReadObject(const nlohmann::json& j) {
-	shared_ptr<ObjectType> temp = std::make_shared<ObjectType>(
+inline std::unique_ptr<ObjectType> Scene::ReadObject(const nlohmann::json& j) {
+	std::unique_ptr<ObjectType> temp = std::make_unique<ObjectType>(
 		j.at("Name").get<std::string>(), 
 		ReadTransform(j.at("Transform")),
 		ReadMaterial(j.at("Material"))
 		);
+	// Every object reads its own material, so it's the one that was just added
+	temp->materialId = (int)allMaterials.size() - 1;
 	return temp;
 }
\ No newline at end of file
@@ -4,23 +4,38 @@
 using namespace std;
 using namespace glm;
 
-SceneObject::SceneObject(std::string _name, Transform _transf, shared_ptr<Material> _mat) {
+SceneObject::SceneObject(std::string _name, Transform _transf, const Material* _mat, ObjectType _type) :
+	type(_type) {
 	// Since all objects in this project are static and independent, the MatrixStack class is not required
 	// (We can just calculate the transformations once, no need for hierarchies or dynamic transf calculations)
 	
-	// The transformation matrix to convert this object from local->world space
-	modelMtx = glm::dmat4(1.0f);
-	modelMtx *= translate(glm::dmat4(1.0f), dvec3(_transf.translation));
-	modelMtx *= eulerAngleXYZ(_transf.rotation.x, _transf.rotation.y, _transf.rotation.z);
-	modelMtx *= scale(glm::dmat4(1.0f), _transf.scale);
-	invMtx = inverse(modelMtx);
-	invTranspMtx = transpose(invMtx);
 	mat = _mat;
 	name = _name;
 	transf = _transf;
+	ComputeMatrices();
+}
+
+bool SceneObject::SetTransform(const Transform& _transf) {
+	if (worldSpace) return false;
+	transf = _transf;
+	ComputeMatrices();
+	UpdateTransformedData();
+	return true;
+}
+
+void SceneObject::ComputeMatrices() {
+	// The transformation matrix to convert this object from local->world space
+	modelMtx = rmat4(1.0f);
+	modelMtx *= translate(rmat4(1.0f), rvec3(transf.translation));
+	modelMtx *= eulerAngleXYZ(transf.rotation.x, transf.rotation.y, transf.rotation.z);
+	modelMtx *= scale(rmat4(1.0f), transf.scale);
+	invMtx = inverse(modelMtx);
+	invTranspMtx = transpose(invMtx);
 }
 
-bool SceneObject::Hit(Ray3D& ray, HitResult& outHit, double tMin, double tMax) {
+bool SceneObject::Hit(Ray3D& ray, HitResult& outHit, Real tMin, Real tMax) {
+	CountTests(1);
+	if (worldSpace) return IntersectLocal(ray, outHit, tMin, tMax);
 	// Apply transformations to the ray to change it to local space
 	Ray3D localRay(invMtx * ray.start, invMtx * ray.dir);
 
@@ -29,7 +44,77 @@ bool SceneObject::Hit(Ray3D& ray, HitResult& outHit, double tMin, double tMax) {
 	return IntersectLocal(localRay, outHit, tMin, tMax);
 }
 
-int SceneObject::SelectSmallestInRange(double vals[2], double min, double max) {
+AABB SceneObject::GetWorldBounds() const {
+	AABB localBounds = GetLocalBounds();
+	if (!localBounds.IsValid()) return localBounds;
+
+	// Transform all 8 corners of the local box, since rotations can move any corner to the outside
+	AABB worldBounds;
+	for (int i = 0; i < 8; i++) {
+		rvec4 corner(
+			(i & 1) ? localBounds.max.x : localBounds.min.x,
+			(i & 2) ? localBounds.max.y : localBounds.min.y,
+			(i & 4) ? localBounds.max.z : localBounds.min.z,
+			1);
+		worldBounds.Expand(rvec3(modelMtx * corner));
+	}
+	return worldBounds;
+}
+
+bool SceneObject::HitAny(Ray3D& ray, Real tMin, Real tMax) {
+	CountTests(1);
+	if (worldSpace) return IntersectLocalAny(ray, tMin, tMax);
+	Ray3D localRay(invMtx * ray.start, invMtx * ray.dir);
+	return IntersectLocalAny(localRay, tMin, tMax);
+}
+
+bool SceneObject::IntersectLocalAny(Ray3D& ray, Real tMin, Real tMax) {
+	// junkHit = temporary variable required for storing the output from the intersection, discarded once hit is done
+	HitResult junkHit;
+	return IntersectLocal(ray, junkHit, tMin, tMax);
+}
+
+int SceneObject::HitPacket(const RayPacket& packet, int activeMask, HitResult* outHits, Real tMin) {
+	// Same as Hit, but transforms all lanes to local space together
+	CountTests(RenderStats::CountLanes(activeMask));
+	if (worldSpace) return IntersectLocalPacket(packet, activeMask, outHits, tMin);
+	return IntersectLocalPacket(packet.Transform(invMtx), activeMask, outHits, tMin);
+}
+
+int SceneObject::HitAnyPacket(const RayPacket& packet, int activeMask, Real tMin, const Real (&tMax)[packetSize]) {
+	CountTests(RenderStats::CountLanes(activeMask));
+	if (worldSpace) return IntersectLocalAnyPacket(packet, activeMask, tMin, tMax);
+	return IntersectLocalAnyPacket(packet.Transform(invMtx), activeMask, tMin, tMax);
+}
+
+int SceneObject::IntersectLocalPacket(const RayPacket& packet, int activeMask, HitResult* outHits, Real tMin) {
+	int hitMask = 0;
+	for (int lane = 0; lane < packetSize; lane++) {
+		if (!(activeMask & (1 << lane))) continue;
+		Ray3D ray = packet.GetRay(lane);
+		if (IntersectLocal(ray, outHits[lane], tMin, std::numeric_limits<Real>::max())) hitMask |= 1 << lane;
+	}
+	return hitMask;
+}
+
+int SceneObject::IntersectLocalAnyPacket(const RayPacket& packet, int activeMask, Real tMin, const Real (&tMax)[packetSize]) {
+	// Starting each junk hit at tMax means that only hits closer than tMax can update it
+	HitResult junkHits[packetSize];
+	for (int lane = 0; lane < packetSize; lane++) {
+		junkHits[lane].t = tMax[lane];
+	}
+	return IntersectLocalPacket(packet, activeMask, junkHits, tMin);
+}
+
+void SceneObject::UseWorldSpace() {
+	// transf is kept as it was read from the scene file, only the matrices stop doing anything
+	modelMtx = rmat4(1.0);
+	invMtx = rmat4(1.0);
+	invTranspMtx = rmat4(1.0);
+	worldSpace = true;
+}
+
+int SceneObject::SelectSmallestInRange(Real vals[2], Real min, Real max) {
 	bool aValid = (vals[0] > min && vals[0] < max);
 	bool bValid = (vals[1] > min && vals[1] < max);
 	if (aValid || bValid) {
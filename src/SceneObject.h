@@ -5,42 +5,111 @@
 #include <glm/gtx/euler_angles.hpp>
 #include <string>
 #include <memory>
+#include <limits>
 #include <iostream>
 #include "Ray3D.h"
 #include "Transform.h"
 #include "HitResult.h"
 #include "Material.h"
+#include "AABB.h"
+#include "RayPacket.h"
+#include "RenderStats.h"
+#include "ObjectType.h"
 
 class SceneObject {
 public:
-	// Assign material and calculate the transformation matrix
-	SceneObject(std::string _name, Transform _transf, std::shared_ptr<Material> _mat);
+	// Assign material and calculate the transformation matrix. Subclasses pass in their own type
+	SceneObject(std::string _name, Transform _transf, const Material* _mat, ObjectType _type);
 
-	std::shared_ptr<Material> GetMaterial() { return mat; }
-	glm::dvec4 GetLocation() { return transf.translation; }
-	glm::dmat4 GetInverseTranspose() { return invTranspMtx; }
+	const Material* GetMaterial() const { return mat; }
+	rvec4 GetLocation() { return transf.translation; }
+	const rmat4& GetInverseTranspose() const { return invTranspMtx; }
+	ObjectType GetType() const { return type; }
+	const Transform& GetTransform() const { return transf; }
+	// Move the object to a new transform, i.e. between frames. Flattened objects have their old transform baked into
+	// their geometry, so they can't be moved (returns false)
+	bool SetTransform(const Transform& _transf);
 
 	// By default, hits go from 0 to inf unless override is specified
-	bool Hit(Ray3D& ray, HitResult& outHit, double tMin = 0, double tMax = std::numeric_limits<double>::max());
+	bool Hit(Ray3D& ray, HitResult& outHit, Real tMin = 0, Real tMax = std::numeric_limits<Real>::max());
+
+	// Shadow-ray version of Hit: returns true if anything on this object is between tMin and tMax, without finding the closest hit
+	bool HitAny(Ray3D& ray, Real tMin = 0, Real tMax = std::numeric_limits<Real>::max());
+
+	// Packet version of Hit: tests the active lanes of the packet against this object, and updates outHits[lane] for each
+	// lane that found a closer hit (outHits has packetSize entries). Returns the mask of lanes that were updated
+	int HitPacket(const RayPacket& packet, int activeMask, HitResult* outHits, Real tMin = 0);
+	// Packet version of HitAny: returns the mask of active lanes that hit something between tMin and tMax[lane]
+	int HitAnyPacket(const RayPacket& packet, int activeMask, Real tMin, const Real (&tMax)[packetSize]);
 
 	// Check intersection in local space, return true if found an intersection that is closer than the hit's t value
-	virtual bool IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax) = 0;
+	virtual bool IntersectLocal(Ray3D& ray, HitResult& outHit, Real tMin, Real tMax) = 0;
+	// Any-hit version of IntersectLocal. By default just runs the closest-hit test, objects with many primitives can stop early
+	virtual bool IntersectLocalAny(Ray3D& ray, Real tMin, Real tMax);
+	// Packet versions of IntersectLocal/IntersectLocalAny (the packet is already in local space)
+	// By default each lane runs the scalar test, objects with a closed-form intersection can test all lanes at once
+	virtual int IntersectLocalPacket(const RayPacket& packet, int activeMask, HitResult* outHits, Real tMin);
+	virtual int IntersectLocalAnyPacket(const RayPacket& packet, int activeMask, Real tMin, const Real (&tMax)[packetSize]);
 	// Returns the world-space location of a random point on the object's surface, and return the pdf by reference
-	virtual glm::dvec4 GetRandomPointOnSurface(double& pdf, glm::dvec4& normal) = 0;
+	// u is a uniformly distributed point in [0, 1)^2 (from the sampler) that gets mapped onto the surface
+	// refPoint is the world-space point that will be lit by the sample, so objects can favor the parts of their surface
+	// that face it. The pdf is always per unit area, no matter how the point was chosen
+	virtual rvec4 GetRandomPointOnSurface(const rvec4& refPoint, const glm::dvec2& u, double& pdf, rvec4& normal) = 0;
+	// Probability density of GetRandomPointOnSurface choosing the given world-space point (for the same refPoint), per
+	// unit area. 0 for objects that don't sample their surface (they're lit like a point light at their origin)
+	virtual double GetSurfacePdf(const rvec4& refPoint, const rvec4& point) const { return 0; }
+	// World-space surface area, used to estimate how much light an emissive object gives off
+	virtual double GetSurfaceArea() const { return 0; }
+	// Build whatever GetRandomPointOnSurface needs once the object's geometry is final (loaded and flattened). Only
+	// called for emissive objects, so the others don't pay for it
+	virtual void PrepareSurfaceSampling() {}
+	// False if the object has nothing that a ray could hit (i.e. a mesh whose file didn't load)
+	virtual bool HasGeometry() const { return true; }
+	// Bounds of the object in local space. Objects with infinite extent (i.e. planes) return an empty (invalid) box
+	virtual AABB GetLocalBounds() const = 0;
+	// Bounds of the local box after transforming it to world space, or an invalid box for infinite objects
+	AABB GetWorldBounds() const;
+	// Bake the transform into the object's own geometry, so that rays and normals don't have to be transformed to hit it
+	// Returns false if the object can't be flattened (it keeps its transform and still works as before)
+	virtual bool Flatten() { return false; }
+	// True once the object is flattened: its local space is world space, and hit normals are already world-space
+	bool IsWorldSpace() const { return worldSpace; }
 
 	std::string name;
 	bool hasRandomPointMethodDefined = false;
+	// Index of the light that samples this object's emission, in the scene's list of lights (-1 if it isn't emissive)
+	int lightIdx = -1;
+	// Index of the object's material in the scene's material table
+	int materialId = -1;
 protected:
+	ObjectType type;
+	// Count a test of this object against numRays rays
+	void CountTests(int numRays) const {
+		RenderStats& stats = RenderStats::Local();
+		stats.objectTests += numRays;
+		RENDER_STAT(stats.objectTestsByType[(int)type] += numRays);
+	}
 	// Checks 2 numbers against a given range, returns index of smaller # in the range, or -1 if neither are in the range
-	int SelectSmallestInRange(double vals[2], double min, double max);
+	int SelectSmallestInRange(Real vals[2], Real min, Real max);
+	// Called by Flatten once the object's geometry is in world space. Replaces the transform matrices with the identity
+	void UseWorldSpace();
+	// Recompute anything that the subclass derives from the transform. Called by SetTransform, subclasses call it from
+	// their own constructor as well (the base constructor can't reach the override yet)
+	virtual void UpdateTransformedData() {}
+	// Set by UseWorldSpace, skips the ray and normal transforms
+	bool worldSpace = false;
 	// Matrix for converting points from local->world space
-	glm::dmat4 modelMtx;
+	rmat4 modelMtx;
 	// Matrix for converting rays from world->local space (inverse of model matrix)
-	glm::dmat4 invMtx;
+	rmat4 invMtx;
 	// Matrix for converting normals from local->world space
-	glm::dmat4 invTranspMtx;
+	rmat4 invTranspMtx;
 	// Transformations applied to this object
 	Transform transf;
-	// Material properties - Store the material as a shared_ptr since other classes reference it frequently
-	std::shared_ptr<Material> mat;
+	// Material properties, owned by the scene
+	const Material* mat = nullptr;
+
+private:
+	// Calculate the model, inverse and normal matrices from transf
+	void ComputeMatrices();
 };
\ No newline at end of file
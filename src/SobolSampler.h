@@ -0,0 +1,70 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include "Sampler.h"
+
+// Low-discrepancy samples from the first 2 dimensions of the Sobol sequence, which are stratified in every power of 2
+// sized block of samples. Higher dimensions reuse the same 2, with the sample order shuffled and the points
+// Owen-scrambled differently for every dimension and pixel, so dimensions (and neighboring pixels) aren't correlated
+// Uses the hash-based scrambling from Burley, "Practical Hash-based Owen Scrambling" (https://jcgt.org/published/0009/04/01/)
+// Converges fastest when the number of samples per pixel is a power of 2
+class SobolSampler : public Sampler {
+public:
+	SobolSampler(int _samplesPerPixel, uint32_t _seed) : Sampler(_samplesPerPixel, _seed) {}
+
+	double Get1D() override {
+		uint64_t hash = HashDimension();
+		currentDimension++;
+		uint32_t index = NestedUniformScramble((uint32_t)currentSample, (uint32_t)hash);
+		// The first Sobol dimension is the van der Corput sequence, i.e. the reversed bits of the index
+		return ToUnitDouble(NestedUniformScramble(ReverseBits(index), (uint32_t)(hash >> 32)));
+	}
+
+	glm::dvec2 Get2D() override {
+		uint64_t hash = HashDimension();
+		uint64_t hash2 = MixBits(hash);
+		currentDimension += 2;
+		uint32_t index = NestedUniformScramble((uint32_t)currentSample, (uint32_t)hash);
+		return glm::dvec2(
+			ToUnitDouble(NestedUniformScramble(ReverseBits(index), (uint32_t)(hash >> 32))),
+			ToUnitDouble(NestedUniformScramble(SobolDimension1(index), (uint32_t)hash2)));
+	}
+
+private:
+	// Second dimension of the Sobol sequence. Its generator matrix is Pascal's triangle mod 2, so every set bit of the
+	// index flips a column that is the previous column xor'ed with itself shifted right by 1
+	static uint32_t SobolDimension1(uint32_t index) {
+		uint32_t result = 0;
+		for (uint32_t column = 1u << 31; index != 0; index >>= 1, column ^= column >> 1) {
+			if (index & 1) result ^= column;
+		}
+		return result;
+	}
+
+	// Randomly permute the bits of x so that each bit only depends on the bits above it (an Owen scramble)
+	static uint32_t NestedUniformScramble(uint32_t x, uint32_t hash) {
+		return ReverseBits(LaineKarrasPermutation(ReverseBits(x), hash));
+	}
+
+	// Hash where each bit only depends on the bits below it. Constants are from Burley's paper
+	static uint32_t LaineKarrasPermutation(uint32_t x, uint32_t hash) {
+		x ^= x * 0x3d20adea;
+		x += hash;
+		x *= (hash >> 16) | 1;
+		x ^= x * 0x05526c56;
+		x ^= x * 0x53a22864;
+		return x;
+	}
+
+	static uint32_t ReverseBits(uint32_t x) {
+		x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+		x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+		x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+		x = ((x >> 8) & 0x00ff00ff) | ((x & 0x00ff00ff) << 8);
+		return (x >> 16) | (x << 16);
+	}
+
+	// Map a 32 bit fixed point value to [0, 1)
+	static double ToUnitDouble(uint32_t x) { return x * 2.3283064365386963e-10; } // 2^-32
+};
@@ -1,22 +1,52 @@
 #pragma once
 #include "Sphere.h"
+#include "Microfacet.h"
 
 using namespace std;
 using namespace glm;
 
-bool Sphere::IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax) {
+Sphere::Sphere(std::string _name, Transform _transf, const Material* _mat) :
+	SceneObject(_name, _transf, _mat, ObjectType::SPHERE) {
+	hasRandomPointMethodDefined = true;
+	UpdateTransformedData();
+}
+
+void Sphere::UpdateTransformedData() {
+	dvec3 absScale = abs(dvec3(transf.scale));
+	double maxScale = std::max(absScale.x, std::max(absScale.y, absScale.z));
+	double minScale = std::min(absScale.x, std::min(absScale.y, absScale.z));
+	isRound = (maxScale - minScale <= 1e-6 * maxScale);
+	center = modelMtx * rvec4(0, 0, 0, 1);
+	radius = absScale.x;
+	// Determinant of the upper 3x3 (the translation doesn't change any volumes)
+	absDeterminant = std::abs(dot(cross(dvec3(modelMtx[0]), dvec3(modelMtx[1])), dvec3(modelMtx[2])));
+	if (isRound) {
+		area = 4 * pi<double>() * radius * radius;
+	}
+	else {
+		// Ellipsoids don't have an exact closed-form area, Knud Thomsen's approximation is within about 1%
+		constexpr double p = 1.6075;
+		double ab = std::pow(absScale.x * absScale.y, p);
+		double ac = std::pow(absScale.x * absScale.z, p);
+		double bc = std::pow(absScale.y * absScale.z, p);
+		area = 4 * pi<double>() * std::pow((ab + ac + bc) / 3, 1 / p);
+	}
+}
+
+bool Sphere::IntersectLocal(Ray3D& ray, HitResult& outHit, Real tMin, Real tMax) {
 	// Assume sphere is at origin with radius 1
-	double a = dot(dvec3(ray.dir), dvec3(ray.dir));
-	double b = 2.0 * dot(dvec3(ray.dir), dvec3(ray.start));
-	double c = dot(dvec3(ray.start), dvec3(ray.start)) - 1.0;
+	Real a = dot(rvec3(ray.dir), rvec3(ray.dir));
+	Real b = 2.0 * dot(rvec3(ray.dir), rvec3(ray.start));
+	Real c = dot(rvec3(ray.start), rvec3(ray.start)) - 1.0;
 	// Discriminant^2
-	double d2 = pow(b, 2) - (4 * a * c);
+	Real d2 = b * b - (4 * a * c);
 
 	if (d2 >= 0) {
 		// 1 or 2 solutions exist
-		double tvals[2];
-		tvals[0] = (-1.0 * b + sqrt(d2)) / (2.0 * a);
-		tvals[1] = (-1.0 * b - sqrt(d2)) / (2.0 * a);
+		Real sqrtD = sqrt(d2);
+		Real tvals[2];
+		tvals[0] = (-1.0 * b + sqrtD) / (2.0 * a);
+		tvals[1] = (-1.0 * b - sqrtD) / (2.0 * a);
 		
 		// Choose the smallest t value within the valid range, and check if it's smaller than the value
 		// that's already in outHit. If so, return true
@@ -25,10 +55,10 @@ bool Sphere::IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double t
 			// Try updating the hit result with whichever t value was the smallest in the range
 			if (outHit.UpdateTMin(tvals[chosenIdx])) {
 				// If it ended up finding a new minT, update the normal value in the hit result
-				dvec4 localPos = ray.FindLocAtTime(outHit.t);
+				rvec4 localPos = ray.FindLocAtTime(outHit.t);
 				// Normal of hit is just local position - already normalized b/c radius = 1
 				// BUT outHit.nor is a vector, so set the w value to 0
-				outHit.nor = dvec4(localPos.x, localPos.y, localPos.z, 0);
+				outHit.nor = rvec4(localPos.x, localPos.y, localPos.z, 0);
 				return true;
 			}
 		}
@@ -41,7 +71,157 @@ bool Sphere::IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double t
 	return false;
 }
 
-glm::dvec4 Sphere::GetRandomPointOnSurface(double& pdf, dvec4& normal)
+bool Sphere::IntersectLocalAny(Ray3D& ray, Real tMin, Real tMax) {
+	// Same quadratic as IntersectLocal, but either root being in range is enough, and there's no normal to find
+	Real a = dot(rvec3(ray.dir), rvec3(ray.dir));
+	Real b = 2.0 * dot(rvec3(ray.dir), rvec3(ray.start));
+	Real c = dot(rvec3(ray.start), rvec3(ray.start)) - 1.0;
+	Real d2 = b * b - (4 * a * c);
+	if (d2 < 0) return false;
+	Real sqrtD = sqrt(d2);
+	Real tNear = (-1.0 * b - sqrtD) / (2.0 * a);
+	Real tFar = (-1.0 * b + sqrtD) / (2.0 * a);
+	return (tNear > tMin && tNear < tMax) || (tFar > tMin && tFar < tMax);
+}
+
+int Sphere::IntersectLocalPacket(const RayPacket& packet, int activeMask, HitResult* outHits, Real tMin) {
+	SimdReal tNear, tFar;
+	int surfaceMask = SolvePacket(packet, tNear, tFar);
+
+	// A lane only counts as a hit if it would update its HitResult, i.e. between tMin and the current closest hit
+	Real curT[packetSize];
+	for (int lane = 0; lane < packetSize; lane++) curT[lane] = outHits[lane].t;
+	SimdReal tMinVec = SimdReal::Broadcast(tMin);
+	SimdReal tMaxVec = SimdReal::Load(curT);
+	SimdReal nearValid = And(CmpGt(tNear, tMinVec), CmpLt(tNear, tMaxVec));
+	SimdReal farValid = And(CmpGt(tFar, tMinVec), CmpLt(tFar, tMaxVec));
+	// The near root is always the smaller one, so only fall back to the far root (ray starts inside) if it isn't valid
+	SimdReal tHit = Select(nearValid, tNear, tFar);
+	int hitMask = MoveMask(Or(nearValid, farValid)) & surfaceMask & activeMask;
+
+	Real tVals[packetSize];
+	tHit.Store(tVals);
+	for (int lane = 0; lane < packetSize; lane++) {
+		if (!(hitMask & (1 << lane))) continue;
+		outHits[lane].t = tVals[lane];
+		// Normal of hit is just local position - already normalized b/c radius = 1
+		rvec4 localPos = packet.GetRay(lane).FindLocAtTime(tVals[lane]);
+		outHits[lane].nor = rvec4(localPos.x, localPos.y, localPos.z, 0);
+	}
+	return hitMask;
+}
+
+int Sphere::IntersectLocalAnyPacket(const RayPacket& packet, int activeMask, Real tMin,
+	const Real (&tMax)[packetSize]) {
+	SimdReal tNear, tFar;
+	int surfaceMask = SolvePacket(packet, tNear, tFar);
+	SimdReal tMinVec = SimdReal::Broadcast(tMin);
+	SimdReal tMaxVec = SimdReal::Load(tMax);
+	SimdReal nearValid = And(CmpGt(tNear, tMinVec), CmpLt(tNear, tMaxVec));
+	SimdReal farValid = And(CmpGt(tFar, tMinVec), CmpLt(tFar, tMaxVec));
+	return MoveMask(Or(nearValid, farValid)) & surfaceMask & activeMask;
+}
+
+int Sphere::SolvePacket(const RayPacket& packet, SimdReal& tNear, SimdReal& tFar) const {
+	// Same quadratic as IntersectLocal, solved for every lane at once
+	SimdReal start[3], dir[3];
+	for (int axis = 0; axis < 3; axis++) {
+		start[axis] = SimdReal::Load(packet.start[axis]);
+		dir[axis] = SimdReal::Load(packet.dir[axis]);
+	}
+	SimdReal a = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+	SimdReal b = SimdReal::Broadcast(2.0) * (dir[0] * start[0] + dir[1] * start[1] + dir[2] * start[2]);
+	SimdReal c = start[0] * start[0] + start[1] * start[1] + start[2] * start[2] - SimdReal::Broadcast(1.0);
+	SimdReal d2 = b * b - SimdReal::Broadcast(4.0) * a * c;
+
+	// Lanes with a negative discriminant are masked out below, so clamp it to avoid taking the sqrt of a negative number
+	const SimdReal zero = SimdReal::Broadcast(0.0);
+	SimdReal sqrtD = Sqrt(Max(d2, zero));
+	SimdReal inv2a = SimdReal::Broadcast(1.0) / (SimdReal::Broadcast(2.0) * a);
+	tNear = (zero - b - sqrtD) * inv2a;
+	tFar = (zero - b + sqrtD) * inv2a;
+	return MoveMask(CmpGe(d2, zero));
+}
+
+rvec4 Sphere::GetRandomPointOnSurface(const rvec4& refPoint, const glm::dvec2& u, double& pdf, rvec4& normal)
 {
-	return transf.translation;
+	double conePdf;
+	if (GetConePdf(refPoint, conePdf)) {
+		// Uniformly sample the cone of directions from refPoint that hit the sphere, then find the point that each
+		// direction hits (from pbrt, https://pbr-book.org/3ed-2018/Light_Transport_I_Surface_Reflection/Sampling_Light_Sources)
+		dvec3 toCenter = dvec3(center - refPoint);
+		double dist = length(toCenter);
+		dvec3 axis = toCenter / dist;
+		double sinThetaMaxSqr = (radius * radius) / (dist * dist);
+		// 1 - cos(thetaMax), without the cancellation that small (far away) spheres would have
+		double oneMinusCosMax = sinThetaMaxSqr / (1 + std::sqrt(std::max(0.0, 1 - sinThetaMaxSqr)));
+		double oneMinusCos = u.x * oneMinusCosMax;
+		double cosTheta = 1 - oneMinusCos;
+		double sinThetaSqr = oneMinusCos * (2 - oneMinusCos);
+		// Angle between the axis and the hit point, seen from the center of the sphere
+		double cosAlpha = sinThetaSqr / std::sqrt(sinThetaMaxSqr) +
+			cosTheta * std::sqrt(std::max(0.0, 1 - sinThetaSqr / sinThetaMaxSqr));
+		double sinAlpha = std::sqrt(std::max(0.0, 1 - cosAlpha * cosAlpha));
+		double phi = 2 * pi<double>() * u.y;
+
+		dvec3 tangent, bitangent;
+		GGX::CreateFrame(axis, tangent, bitangent);
+		dvec3 worldNormal = -(sinAlpha * std::cos(phi) * tangent + sinAlpha * std::sin(phi) * bitangent + cosAlpha * axis);
+		normal = rvec4(worldNormal, 0);
+		rvec4 point = center + Real(radius) * normal;
+
+		// Convert the solid angle pdf to area, like every other light sample
+		dvec3 toRef = dvec3(refPoint - point);
+		double distSqr = dot(toRef, toRef);
+		double cosLight = dot(worldNormal, toRef) / std::sqrt(distSqr);
+		pdf = (cosLight > 0) ? conePdf * cosLight / distSqr : 0.0;
+		return point;
+	}
+
+	// Uniform point on the local unit sphere
+	double z = 1 - 2 * u.x;
+	double r = std::sqrt(std::max(0.0, 1 - z * z));
+	double phi = 2 * pi<double>() * u.y;
+	rvec3 localNormal(r * std::cos(phi), r * std::sin(phi), z);
+	pdf = GetUniformPdf(localNormal);
+	normal = invTranspMtx * rvec4(localNormal, 0);
+	normal.w = 0;
+	normal = normalize(normal);
+	return modelMtx * rvec4(localNormal, 1);
+}
+
+double Sphere::GetSurfacePdf(const rvec4& refPoint, const rvec4& point) const {
+	double conePdf;
+	if (GetConePdf(refPoint, conePdf)) {
+		// Only the cap that faces refPoint can be chosen
+		dvec3 worldNormal = normalize(dvec3(point - center));
+		dvec3 toRef = dvec3(refPoint - point);
+		double distSqr = dot(toRef, toRef);
+		double cosLight = dot(worldNormal, toRef) / std::sqrt(distSqr);
+		return (cosLight > 0) ? conePdf * cosLight / distSqr : 0.0;
+	}
+	return GetUniformPdf(normalize(rvec3(invMtx * point)));
+}
+
+bool Sphere::GetConePdf(const rvec4& refPoint, double& outPdf) const {
+	if (!isRound) return false;
+	dvec3 toCenter = dvec3(center - refPoint);
+	double distSqr = dot(toCenter, toCenter);
+	// Points on (or very close to) the surface would see half of all directions, which the cone can't represent well
+	if (distSqr <= radius * radius * 1.0001) return false;
+	double sinThetaMaxSqr = (radius * radius) / distSqr;
+	double oneMinusCosMax = sinThetaMaxSqr / (1 + std::sqrt(std::max(0.0, 1 - sinThetaMaxSqr)));
+	outPdf = 1 / (2 * pi<double>() * oneMinusCosMax);
+	return true;
+}
+
+double Sphere::GetUniformPdf(const rvec3& localNormal) const {
+	// An affine transform scales the area around a point with normal n by |det(M)| * |M^-T * n|
+	double stretch = absDeterminant * length(dvec3(rvec3(invTranspMtx * rvec4(localNormal, 0))));
+	return 1 / (4 * pi<double>() * stretch);
+}
+
+AABB Sphere::GetLocalBounds() const {
+	// Unit sphere at the origin
+	return AABB(rvec3(-1, -1, -1), rvec3(1, 1, 1));
 }
@@ -9,9 +9,40 @@
 
 class Sphere : public SceneObject {
 public:
-	// Call parent constructor to create transform matrix and apply material
-	Sphere(std::string _name, Transform _transf, std::shared_ptr<Material> _mat) : SceneObject(_name, _transf, _mat) {};
+	// Call parent constructor to create transform matrix and apply material, then cache the data used for light sampling
+	Sphere(std::string _name, Transform _transf, const Material* _mat);
 
-	bool IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax) override;
-	glm::dvec4 GetRandomPointOnSurface(double& pdf, glm::dvec4& normal) override;
+	bool IntersectLocal(Ray3D& ray, HitResult& outHit, Real tMin, Real tMax) override;
+	bool IntersectLocalAny(Ray3D& ray, Real tMin, Real tMax) override;
+	int IntersectLocalPacket(const RayPacket& packet, int activeMask, HitResult* outHits, Real tMin) override;
+	int IntersectLocalAnyPacket(const RayPacket& packet, int activeMask, Real tMin,
+		const Real (&tMax)[packetSize]) override;
+	// Round spheres only sample the cap that's visible from refPoint, uniformly by solid angle. Stretched spheres (and
+	// points inside of the sphere) sample the whole surface instead
+	rvec4 GetRandomPointOnSurface(const rvec4& refPoint, const glm::dvec2& u, double& pdf, rvec4& normal) override;
+	double GetSurfacePdf(const rvec4& refPoint, const rvec4& point) const override;
+	double GetSurfaceArea() const override { return area; }
+	AABB GetLocalBounds() const override;
+
+private:
+	// Find the world-space center, radius and area that light sampling uses
+	void UpdateTransformedData() override;
+	// True if refPoint is far enough outside of a round sphere to sample the cone of directions it sees the sphere in
+	// Returns the solid angle pdf of that cone
+	bool GetConePdf(const rvec4& refPoint, double& outPdf) const;
+	// Density of a point on the local unit sphere when points are chosen uniformly over it and moved to world space
+	// (non-uniform scales stretch some parts of the surface more than others)
+	double GetUniformPdf(const rvec3& localNormal) const;
+
+	// Round spheres have the same scale on every axis, so their world-space shape is still a sphere
+	bool isRound = false;
+	rvec4 center;
+	double radius = 1;
+	// Scale from local to world space volume, used to find how much each part of the surface is stretched
+	double absDeterminant = 1;
+	double area = 0;
+
+	// Solve the ray/sphere quadratic for every lane of the packet. Returns the mask of lanes that cross the sphere's
+	// surface at all, with their entry and exit distances in tNear and tFar
+	int SolvePacket(const RayPacket& packet, SimdReal& tNear, SimdReal& tFar) const;
 };
\ No newline at end of file
@@ -4,25 +4,42 @@
 using namespace std;
 using namespace glm;
 
-bool Square::IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax) {
-	// Just like the sphere, the ray will be transformed into the local space of this square, so
-	// assume square is at the origin, parallel with x-z plane, with bounds from -0.5 to 0.5 in x and z
+Square::Square(std::string _name, Transform _transf, const Material* _mat) :
+	SceneObject(_name, _transf, _mat, ObjectType::SQUARE) {
+	hasRandomPointMethodDefined = true;
+	UpdateTransformedData();
+}
+
+void Square::UpdateTransformedData() {
+	// Normal = +y in local space
+	worldNormal = invTranspMtx * surfaceNormal;
+	worldNormal.w = 0.0;
+	worldNormal = normalize(worldNormal);
+	area = length(cross(rvec3(modelMtx * edgeU), rvec3(modelMtx * edgeV)));
+	areaPdf = (area > 0) ? 1.0 / area : 0.0;
+}
+
+bool Square::IntersectLocal(Ray3D& ray, HitResult& outHit, Real tMin, Real tMax) {
+	// The ray is either in the local space of this square (if it hasn't been flattened), or in world space, but the
+	// corner, edges and normal are always in the same space as the ray
 
 	// Full equation: t = dot(n, (planeLoc - ray.start)) / dot(n, ray.dir)
-	// Since we're in local space, assume n = <0, 1, 0> and planeLoc = <0, 0, 0>
-	double numerator = (-1.0 * ray.start).y;
-	double denom = ray.dir.y;
+	Real numerator = dot(surfaceNormal, corner - ray.start);
+	Real denom = dot(surfaceNormal, ray.dir);
 
 	// Rare, but make sure we don't have a divide-by-zero before calculating t
 	if (denom != 0) {
-		double newT = numerator / denom;
+		Real newT = numerator / denom;
 		if (newT > tMin && newT < tMax) {
-			// Check if the hit location is within the bounds of a unit square
-			if (IsInUnitSquare(ray.FindLocAtTime(newT))) {
+			// Check if the hit location is within the bounds of the square, by projecting it onto both edges
+			rvec4 offset = ray.FindLocAtTime(newT) - corner;
+			Real a = dot(offset, edgeU) * invLengthSqrU;
+			Real b = dot(offset, edgeV) * invLengthSqrV;
+			if (a > 0 && a < 1 && b > 0 && b < 1) {
 				// Try updating the HitResult 
 				if (outHit.UpdateTMin(newT)) {
 					// If the HitResult ended up finding a new minT, update the normal value in the hit result and return true
-					outHit.nor = dvec4(0, 1, 0, 0);
+					outHit.nor = surfaceNormal;
 					return true;
 				}
 			}
@@ -36,20 +53,36 @@ bool Square::IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double t
 	return false;
 }
 
-glm::dvec4 Square::GetRandomPointOnSurface(double& pdf, dvec4& normal)
+rvec4 Square::GetRandomPointOnSurface(const rvec4& refPoint, const glm::dvec2& u, double& pdf, rvec4& normal)
 {
-	// Generate random numbers between -0.5 and 0.5
-	double randX = (rand() / (double)RAND_MAX) - 0.5;
-	double randZ = (rand() / (double)RAND_MAX) - 0.5;
 	// PDF = 1/area, since this is a uniform distribution
-	pdf = 1.0 / (transf.scale.x * transf.scale.z);
-	// Normal = +y in local space (TODO: I can cache this)
-	normal = invTranspMtx * dvec4(0, 1, 0, 0);
-	normal.w = 0.0;
-	normal = normalize(normal);
-	return modelMtx * dvec4(randX, 0, randZ, 1);
+	pdf = areaPdf;
+	normal = worldNormal;
+	// modelMtx is the identity once the square is flattened
+	return modelMtx * (corner + Real(u.x) * edgeU + Real(u.y) * edgeV);
+}
+
+AABB Square::GetLocalBounds() const {
+	// Flat in y (in local space), the scene pads world-space bounds so this still has some thickness
+	AABB bounds;
+	bounds.Expand(rvec3(corner));
+	bounds.Expand(rvec3(corner + edgeU));
+	bounds.Expand(rvec3(corner + edgeV));
+	bounds.Expand(rvec3(corner + edgeU + edgeV));
+	return bounds;
+}
+
+bool Square::Flatten() {
+	corner = modelMtx * corner;
+	edgeU = modelMtx * edgeU;
+	edgeV = modelMtx * edgeV;
+	surfaceNormal = worldNormal;
+	UpdateEdgeScales();
+	UseWorldSpace();
+	return true;
 }
 
-bool Square::IsInUnitSquare(const glm::vec4& v) const {
-	return (v.x > -0.5 && v.x < 0.5) && (v.z > -0.5 && v.z < 0.5);
+void Square::UpdateEdgeScales() {
+	invLengthSqrU = Real(1) / dot(edgeU, edgeU);
+	invLengthSqrV = Real(1) / dot(edgeV, edgeV);
 }
@@ -10,15 +10,36 @@
 
 class Square : public SceneObject {
 public:
-	// Call parent constructor to create transform matrix and apply material
-	Square(std::string _name, Transform _transf, std::shared_ptr<Material> _mat) : SceneObject(_name, _transf, _mat) {
-		hasRandomPointMethodDefined = true;
-	};
+	// Call parent constructor to create transform matrix and apply material, then cache the data used for light sampling
+	Square(std::string _name, Transform _transf, const Material* _mat);
 
-	bool IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax) override;
-	glm::dvec4 GetRandomPointOnSurface(double& pdf, glm::dvec4& normal) override;
+	bool IntersectLocal(Ray3D& ray, HitResult& outHit, Real tMin, Real tMax) override;
+	rvec4 GetRandomPointOnSurface(const rvec4& refPoint, const glm::dvec2& u, double& pdf, rvec4& normal) override;
+	// Points are chosen uniformly, so every point has the same density
+	double GetSurfacePdf(const rvec4& refPoint, const rvec4& point) const override { return areaPdf; }
+	double GetSurfaceArea() const override { return area; }
+	AABB GetLocalBounds() const override;
+	// Squares can always move their corner and edges to world space
+	bool Flatten() override;
 
 private:
-	// Check if the given value is between -0.5 and 0.5
-	bool IsInUnitSquare(const glm::vec4& v) const;
+	// Move the normal to world space and measure the area
+	void UpdateTransformedData() override;
+	// Cache the inverse squared lengths of the edges, used to find the hit position along each edge
+	void UpdateEdgeScales();
+
+	// One corner of the square and the two edges that leave it. This starts out as the unit square in local space
+	// (parallel with the x-z plane, from -0.5 to 0.5), Flatten moves it to world space
+	rvec4 corner = rvec4(-0.5, 0, -0.5, 1);
+	rvec4 edgeU = rvec4(1, 0, 0, 0);
+	rvec4 edgeV = rvec4(0, 0, 1, 0);
+	Real invLengthSqrU = 1;
+	Real invLengthSqrV = 1;
+	// Unit normal in the same space as the corner
+	rvec4 surfaceNormal = rvec4(0, 1, 0, 0);
+	// World-space normal and area, so light samples don't have to transform anything
+	rvec4 worldNormal;
+	double area = 1;
+	// 1 / area, the density of every surface sample
+	double areaPdf = 1;
 };
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cmath>
+#include <algorithm>
+#include "Sampler.h"
+
+// Splits every dimension into samplesPerPixel strata (2D dimensions into a grid of about the same size), and gives each
+// sample of a pixel a different, jittered stratum. The order of the strata is shuffled separately for every pixel and
+// dimension, so the dimensions aren't correlated with each other
+class StratifiedSampler : public Sampler {
+public:
+	StratifiedSampler(int _samplesPerPixel, uint32_t _seed) :
+		Sampler(std::max(1, _samplesPerPixel), _seed) {
+		gridWidth = std::max(1, (int)std::sqrt((double)samplesPerPixel));
+		gridHeight = std::max(1, samplesPerPixel / gridWidth);
+	}
+
+	double Get1D() override {
+		int stratum = GetStratum(samplesPerPixel);
+		double jitter = HashToUniform();
+		currentDimension++;
+		return (stratum + jitter) / samplesPerPixel;
+	}
+
+	glm::dvec2 Get2D() override {
+		int stratum = GetStratum(gridWidth * gridHeight);
+		// Both jitters come from the pair's first dimension, with a different extra value
+		double x = (stratum % gridWidth + HashToUniform(0)) / gridWidth;
+		double y = (stratum / gridWidth + HashToUniform(1)) / gridHeight;
+		currentDimension += 2;
+		return glm::dvec2(x, y);
+	}
+
+private:
+	// Stratum of the current sample, out of numStrata. Samples past numStrata start another shuffled set of strata
+	int GetStratum(int numStrata) const {
+		uint32_t round = (uint32_t)(currentSample / numStrata);
+		return (int)PermutationElement((uint32_t)(currentSample % numStrata), (uint32_t)numStrata,
+			(uint32_t)HashDimension(round));
+	}
+
+	// Element i of a random permutation of [0, length), chosen by hash, without storing the permutation
+	// From Kensler, "Correlated Multi-Jittered Sampling" (https://graphics.pixar.com/library/MultiJitteredSampling/)
+	static uint32_t PermutationElement(uint32_t i, uint32_t length, uint32_t hash) {
+		uint32_t w = length - 1;
+		w |= w >> 1;
+		w |= w >> 2;
+		w |= w >> 4;
+		w |= w >> 8;
+		w |= w >> 16;
+		// Permute within the next power of 2, and try again whenever the result lands outside of [0, length)
+		do {
+			i ^= hash;
+			i *= 0xe170893d;
+			i ^= hash >> 16;
+			i ^= (i & w) >> 4;
+			i ^= hash >> 8;
+			i *= 0x0929eb3f;
+			i ^= hash >> 23;
+			i ^= (i & w) >> 1;
+			i *= 1 | hash >> 27;
+			i *= 0x6935fa69;
+			i ^= (i & w) >> 11;
+			i *= 0x74dcb303;
+			i ^= (i & w) >> 2;
+			i *= 0x9e501cc3;
+			i ^= (i & w) >> 2;
+			i *= 0xc860a3df;
+			i &= w;
+			i ^= i >> 5;
+		} while (i >= length);
+		return (i + hash) % length;
+	}
+
+	int gridWidth;
+	int gridHeight;
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include <algorithm>
+#include "ThreadPool.h"
+
+using namespace std;
+
+// Index of the worker that owns the current thread (-1 for threads that don't belong to a pool)
+static thread_local int currentWorkerIdx = -1;
+
+ThreadPool::ThreadPool(int numThreads) :
+	pendingTasks(0),
+	queuedTasks(0),
+	nextQueue(0)
+{
+	if (numThreads <= 0) {
+		numThreads = std::max(1, (int)thread::hardware_concurrency());
+	}
+	for (int i = 0; i < numThreads; i++) {
+		queues.push_back(make_unique<WorkQueue>());
+	}
+	// Only start the threads once all of the queues exist, since workers immediately start looking through them
+	for (int i = 0; i < numThreads; i++) {
+		workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> guard(sleepLock);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::Submit(function<void()> task) {
+	// Keep tasks local to the submitting worker when possible, other workers can still steal them
+	int queueIdx = currentWorkerIdx;
+	if (queueIdx < 0 || queueIdx >= (int)queues.size()) {
+		queueIdx = nextQueue++ % queues.size();
+	}
+	pendingTasks++;
+	{
+		lock_guard<mutex> guard(queues[queueIdx]->lock);
+		queues[queueIdx]->tasks.push_back(move(task));
+	}
+	{
+		// Increment under the sleep lock so that a worker can't check for work and then miss this notification
+		lock_guard<mutex> guard(sleepLock);
+		queuedTasks++;
+	}
+	wakeCondition.notify_one();
+}
+
+void ThreadPool::WaitAll() {
+	unique_lock<mutex> guard(sleepLock);
+	doneCondition.wait(guard, [this] { return pendingTasks == 0; });
+}
+
+int ThreadPool::GetCurrentWorkerIndex() {
+	return currentWorkerIdx;
+}
+
+void ThreadPool::WorkerLoop(int workerIdx) {
+	currentWorkerIdx = workerIdx;
+	function<void()> task;
+	while (true) {
+		if (TryGetTask(workerIdx, task)) {
+			task();
+			// Release anything the task captured before reporting it as done
+			task = nullptr;
+			if (--pendingTasks == 0) {
+				lock_guard<mutex> guard(sleepLock);
+				doneCondition.notify_all();
+			}
+		}
+		else {
+			unique_lock<mutex> guard(sleepLock);
+			wakeCondition.wait(guard, [this] { return stopping || queuedTasks > 0; });
+			if (stopping && queuedTasks == 0) {
+				return;
+			}
+		}
+	}
+}
+
+bool ThreadPool::TryGetTask(int workerIdx, function<void()>& outTask) {
+	int numQueues = (int)queues.size();
+	// Start with this worker's own queue, then look through the others
+	for (int i = 0; i < numQueues; i++) {
+		int queueIdx = (workerIdx + i) % numQueues;
+		WorkQueue& queue = *queues[queueIdx];
+		lock_guard<mutex> guard(queue.lock);
+		if (queue.tasks.empty()) continue;
+
+		if (i == 0) {
+			// Own queue: take the oldest task, so tiles are rendered roughly in submission order
+			outTask = move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		else {
+			// Stealing: take from the opposite end to avoid contending with the owner
+			outTask = move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		queuedTasks--;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+
+// A fixed-size pool of worker threads. Each worker owns a task queue, and workers that run out of work
+// steal tasks from the back of other workers' queues, so uneven tiles don't leave cores idle
+class ThreadPool {
+public:
+	// numThreads <= 0 uses one thread per hardware core
+	ThreadPool(int numThreads = 0);
+	~ThreadPool();
+
+	// Queue a task. Tasks submitted from a worker go to its own queue, others are spread round-robin
+	void Submit(std::function<void()> task);
+	// Block until every submitted task has finished running
+	void WaitAll();
+
+	int GetNumThreads() const { return (int)workers.size(); }
+	// Returns the index of the calling worker thread, or -1 if called from outside of the pool
+	static int GetCurrentWorkerIndex();
+
+private:
+	struct WorkQueue {
+		std::deque<std::function<void()> > tasks;
+		std::mutex lock;
+	};
+
+	void WorkerLoop(int workerIdx);
+	// Pop from the front of this worker's own queue, or steal from the back of another worker's queue
+	bool TryGetTask(int workerIdx, std::function<void()>& outTask);
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<WorkQueue> > queues;
+
+	// Used to put idle workers to sleep until new tasks are submitted
+	std::mutex sleepLock;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+	// Number of tasks that have been submitted but have not finished running
+	std::atomic<int> pendingTasks;
+	// Number of tasks that are sitting in a queue, waiting for a worker to pick them up
+	std::atomic<int> queuedTasks;
+	std::atomic<unsigned int> nextQueue;
+	bool stopping = false;
+};
@@ -1,13 +1,15 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include "Real.h"
 
 struct Transform {
-	glm::dvec4 translation = glm::dvec4(0, 0, 0, 1);
-	glm::dvec3 rotation = glm::dvec3(0, 0, 0);
-	glm::dvec3 scale = glm::dvec3(1, 1, 1);
+	rvec4 translation = rvec4(0, 0, 0, 1);
+	rvec3 rotation = rvec3(0, 0, 0);
+	rvec3 scale = rvec3(1, 1, 1);
 	Transform() = default;
 	// (give rotation in degrees)
-	Transform(glm::dvec4 _transl, glm::dvec3 _rot, glm::dvec3 _scale)
-		: translation(_transl), rotation(glm::pi<double>() * _rot / 180.0), scale(_scale) {}
+	Transform(rvec4 _transl, rvec3 _rot, rvec3 _scale)
+		: translation(_transl), rotation(glm::pi<Real>() * _rot / Real(180.0)), scale(_scale) {}
 };
@@ -4,55 +4,87 @@
 using namespace glm;
 using namespace std;
 
-dvec4 Triangle::BaryInterpNorm(double (&baryCoords)[3]) {
-	dvec4 interp(0, 0, 0, 0);
-	for (int i = 0; i < 3; i++) {
-		interp += norms[i] * baryCoords[i];
+void TriangleList::Add(const rvec3& p0, const rvec3& p1, const rvec3& p2) {
+	// Find vectors for two edges sharing vert0 once, instead of on every intersection test
+	rvec3 edge1 = p1 - p0;
+	rvec3 edge2 = p2 - p0;
+	for (int axis = 0; axis < 3; axis++) {
+		v0Storage[axis].push_back(p0[axis]);
+		e1Storage[axis].push_back(edge1[axis]);
+		e2Storage[axis].push_back(edge2[axis]);
+		// The vectors may have moved as they grew
+		v0[axis] = v0Storage[axis];
+		e1[axis] = e1Storage[axis];
+		e2[axis] = e2Storage[axis];
 	}
-	interp = normalize(interp);
-	return interp;
 }
 
-void Triangle::print() {
-	std::cout << "Triangle(";
-	for (int i = 0; i < 3; i++) {
-		std::cout << " <" << locations[i].x << " , " << locations[i].y << " , " << locations[i].z << "> ";
+void TriangleList::Reserve(size_t count) {
+	for (int axis = 0; axis < 3; axis++) {
+		v0Storage[axis].reserve(count);
+		e1Storage[axis].reserve(count);
+		e2Storage[axis].reserve(count);
 	}
-	std::cout << ")" << std::endl;
 }
 
-void Triangle::SetLocations(dvec4& v0, dvec4& v1, dvec4& v2) {
-	locations[0] = v0;
-	locations[1] = v1;
-	locations[2] = v2;
+ArrayView<Real> TriangleList::GetArray(int arrayIdx) const {
+	if (arrayIdx < 3) return v0[arrayIdx];
+	if (arrayIdx < 6) return e1[arrayIdx - 3];
+	return e2[arrayIdx - 6];
+}
+
+void TriangleList::Load(const ArrayView<Real> (&arrays)[numArrays]) {
+	for (int axis = 0; axis < 3; axis++) {
+		v0[axis] = arrays[axis];
+		e1[axis] = arrays[3 + axis];
+		e2[axis] = arrays[6 + axis];
+		v0Storage[axis] = vector<Real>();
+		e1Storage[axis] = vector<Real>();
+		e2Storage[axis] = vector<Real>();
+	}
 }
 
-void Triangle::SetNorms(dvec4& n0, dvec4& n1, dvec4& n2) {
-	norms[0] = n0;
-	norms[1] = n1;
-	norms[2] = n2;
+AABB TriangleList::GetBounds(int triIdx) const {
+	rvec3 p0 = GetVertex0(triIdx);
+	AABB bounds;
+	bounds.Expand(p0);
+	bounds.Expand(p0 + GetEdge1(triIdx));
+	bounds.Expand(p0 + GetEdge2(triIdx));
+	return bounds;
 }
 
-bool Triangle::IntersectTriangle(Ray3D& ray, double& t, double& u, double& v) {
-	const double EPSILON = 0.000001;
-	dvec3 edge1, edge2, tvec, pvec, qvec;
-	double det, inv_det;
+void TriangleList::print(int triIdx) const {
+	rvec3 locations[3] = { GetVertex0(triIdx), GetVertex0(triIdx) + GetEdge1(triIdx), GetVertex0(triIdx) + GetEdge2(triIdx) };
+	std::cout << "Triangle(";
+	for (int i = 0; i < 3; i++) {
+		std::cout << " <" << locations[i].x << " , " << locations[i].y << " , " << locations[i].z << "> ";
+	}
+	std::cout << ")" << std::endl;
+}
 
-	// Find vectors for two edges sharing vert0
-	edge1 = locations[1] - locations[0];
-	edge2 = locations[2] - locations[0];
+bool TriangleList::IntersectTriangle(int triIdx, const Ray3D& ray, Real& t, Real& u, Real& v) const {
+	RenderStats::Local().triangleTests++;
+	rvec3 tvec, pvec, qvec;
+	Real det, inv_det;
+
+	// Edges sharing vert0 were precomputed when the triangle was added
+	rvec3 vert0 = GetVertex0(triIdx);
+	rvec3 edge1 = GetEdge1(triIdx);
+	rvec3 edge2 = GetEdge2(triIdx);
 
 	// begin calculating determinant - also used to calculate U parameter
-	pvec = cross(dvec3(ray.dir), edge2);
+	pvec = cross(rvec3(ray.dir), edge2);
 
-	// if determinant is near zero, ray lies in plane of triangle
+	// if determinant is zero, ray lies in plane of triangle
+	// (det scales with the size of the triangle and the length of the ray direction, so it can't be compared against a fixed
+	// epsilon without rejecting small triangles, or triangles tested in a scaled-down local space)
 	det = dot(edge1, pvec);
 
 	// calculate distance from vert0 to ray origin
-	tvec = ray.start - locations[0];
-	inv_det = 1.0 / det;
+	tvec = rvec3(ray.start) - vert0;
+	inv_det = Real(1.0) / det;
 
-	if (det > EPSILON) {
+	if (det > 0) {
 		// calculate U parameter and test bounds
 		u = dot(tvec, pvec);
 		if (u < 0.0 || u > det)
@@ -62,12 +94,12 @@ bool Triangle::IntersectTriangle(Ray3D& ray, double& t, double& u, double& v) {
 		qvec = cross(tvec, edge1);
 
 		// calculate V parameter and test bounds
-		v = dot(dvec3(ray.dir), qvec);
+		v = dot(rvec3(ray.dir), qvec);
 		if (v < 0.0 || (u + v) > det)
 			return false;
 
 	}
-	else if (det < (-1.0 * EPSILON)) {
+	else if (det < 0) {
 		// calculate U parameter and test bounds
 		u = dot(tvec, pvec);
 		if (u > 0.0 || u < det)
@@ -77,7 +109,7 @@ bool Triangle::IntersectTriangle(Ray3D& ray, double& t, double& u, double& v) {
 		qvec = cross(tvec, edge1);
 
 		// calculate V parameter and test bounds
-		v = dot(dvec3(ray.dir), qvec);
+		v = dot(rvec3(ray.dir), qvec);
 		if (v > 0.0 || (u + v) < det)
 			return false;
 	}
@@ -90,3 +122,85 @@ bool Triangle::IntersectTriangle(Ray3D& ray, double& t, double& u, double& v) {
 
 	return true;
 }
+
+int TriangleList::IntersectTriangleGroup(int first, int count, const Ray3D& ray, Real tMin, Real tMax,
+	Real (&t)[packetSize], Real (&u)[packetSize], Real (&v)[packetSize]) const {
+	// Same test as IntersectTriangle, but each lane holds a different triangle and the ray is broadcast to all of them
+	// Both sides of each triangle are tested at once by normalizing with det before the bounds checks
+	RenderStats::Local().triangleTests += count;
+	SimdReal vert0[3], edge1[3], edge2[3], dir[3], tvec[3];
+	for (int axis = 0; axis < 3; axis++) {
+		vert0[axis] = LoadGroup(v0[axis], first, count);
+		edge1[axis] = LoadGroup(e1[axis], first, count);
+		edge2[axis] = LoadGroup(e2[axis], first, count);
+		dir[axis] = SimdReal::Broadcast(ray.dir[axis]);
+		tvec[axis] = SimdReal::Broadcast(ray.start[axis]) - vert0[axis];
+	}
+
+	// pvec = cross(dir, edge2)
+	SimdReal pvec[3] = {
+		dir[1] * edge2[2] - dir[2] * edge2[1],
+		dir[2] * edge2[0] - dir[0] * edge2[2],
+		dir[0] * edge2[1] - dir[1] * edge2[0] };
+	SimdReal det = edge1[0] * pvec[0] + edge1[1] * pvec[1] + edge1[2] * pvec[2];
+	SimdReal invDet = SimdReal::Broadcast(1.0) / det;
+
+	// qvec = cross(tvec, edge1)
+	SimdReal qvec[3] = {
+		tvec[1] * edge1[2] - tvec[2] * edge1[1],
+		tvec[2] * edge1[0] - tvec[0] * edge1[2],
+		tvec[0] * edge1[1] - tvec[1] * edge1[0] };
+	SimdReal uVals = (tvec[0] * pvec[0] + tvec[1] * pvec[1] + tvec[2] * pvec[2]) * invDet;
+	SimdReal vVals = (dir[0] * qvec[0] + dir[1] * qvec[1] + dir[2] * qvec[2]) * invDet;
+	SimdReal tVals = (edge2[0] * qvec[0] + edge2[1] * qvec[1] + edge2[2] * qvec[2]) * invDet;
+
+	const SimdReal zero = SimdReal::Broadcast(0.0);
+	// Rays that are parallel to the plane of the triangle miss (see IntersectTriangle for why there's no epsilon)
+	SimdReal hit = CmpGt(Abs(det), zero);
+	hit = And(hit, And(CmpGe(uVals, zero), CmpGe(vVals, zero)));
+	hit = And(hit, CmpLe(uVals + vVals, SimdReal::Broadcast(1.0)));
+	hit = And(hit, And(CmpGt(tVals, SimdReal::Broadcast(tMin)), CmpLt(tVals, SimdReal::Broadcast(tMax))));
+
+	tVals.Store(t);
+	uVals.Store(u);
+	vVals.Store(v);
+	return MoveMask(hit) & ((1 << count) - 1);
+}
+
+int TriangleList::IntersectClosest(int first, int count, const Ray3D& ray, Real tMin, Real tMax,
+	Real& t, Real& u, Real& v) const {
+	int closest = -1;
+	Real groupT[packetSize], groupU[packetSize], groupV[packetSize];
+	for (int group = first; group < first + count; group += packetSize) {
+		int groupCount = std::min(packetSize, first + count - group);
+		int hitMask = IntersectTriangleGroup(group, groupCount, ray, tMin, tMax, groupT, groupU, groupV);
+		for (int lane = 0; hitMask != 0; lane++, hitMask >>= 1) {
+			if ((hitMask & 1) && groupT[lane] < tMax) {
+				// Later triangles only count if they are in front of the closest one so far
+				tMax = groupT[lane];
+				closest = group + lane;
+				t = groupT[lane];
+				u = groupU[lane];
+				v = groupV[lane];
+			}
+		}
+	}
+	return closest;
+}
+
+bool TriangleList::IntersectAny(int first, int count, const Ray3D& ray, Real tMin, Real tMax) const {
+	Real groupT[packetSize], groupU[packetSize], groupV[packetSize];
+	for (int group = first; group < first + count; group += packetSize) {
+		int groupCount = std::min(packetSize, first + count - group);
+		if (IntersectTriangleGroup(group, groupCount, ray, tMin, tMax, groupT, groupU, groupV) != 0) return true;
+	}
+	return false;
+}
+
+SimdReal TriangleList::LoadGroup(const ArrayView<Real>& values, int first, int count) const {
+	if (count == packetSize) return SimdReal::Load(&values[first]);
+	// Partial groups at the end of a leaf can't read past the end of the vector
+	Real padded[packetSize] = {};
+	for (int i = 0; i < count; i++) padded[i] = values[first + i];
+	return SimdReal::Load(padded);
+}
@@ -1,22 +1,74 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
 #include <iostream>
 
 #include "Ray3D.h"
+#include "AABB.h"
+#include "SIMD.h"
+#include "RenderStats.h"
+#include "ArrayView.h"
 
-class Triangle {
+// Indices of a triangle's 3 corners in its mesh's vertex and normal buffers
+struct TriangleIndices {
+	uint32_t vert[3];
+	uint32_t nor[3];
+};
+
+// Contiguous, structure-of-arrays storage for all of the triangles in a mesh
+// Each triangle is stored as its first vertex and the 2 edges that share it, which are exactly the values that the
+// intersection test needs, so nothing is recomputed per ray and neighbouring triangles share cache lines
+class TriangleList {
 public:
-	Triangle() = default;
+	TriangleList() = default;
+	// The component views may point into this list's own storage, which moves along with it but isn't duplicated
+	TriangleList(const TriangleList&) = delete;
+	TriangleList& operator=(const TriangleList&) = delete;
+	TriangleList(TriangleList&&) = default;
+	TriangleList& operator=(TriangleList&&) = default;
+
+	void Add(const rvec3& p0, const rvec3& p1, const rvec3& p2);
+	void Reserve(size_t count);
+	size_t Size() const { return v0[0].size(); }
 
-	glm::dvec4 BaryInterpNorm(double(&baryCoords)[3]);
-	void print();
-	void SetLocations(glm::dvec4& v0, glm::dvec4& v1, glm::dvec4& v2);
-	void SetNorms(glm::dvec4& n0, glm::dvec4& n1, glm::dvec4& n2);
-	// Test the provided ray against this triangle's location vectors. Returns distance and barycentric coords in t, u, v
-	bool IntersectTriangle(Ray3D& ray, double& t, double& u, double& v);
+	// Number of component arrays: x, y, and z of vertex 0, edge 1 and edge 2
+	static constexpr int numArrays = 9;
+	// Component array in the order v0.xyz, e1.xyz, e2.xyz, i.e. to save the list to a file
+	ArrayView<Real> GetArray(int arrayIdx) const;
+	// Use component arrays saved from GetArray without copying them (e.g. straight out of a memory-mapped file)
+	// The arrays have to stay alive for as long as the list is used
+	void Load(const ArrayView<Real> (&arrays)[numArrays]);
+
+	AABB GetBounds(int triIdx) const;
+	rvec3 GetVertex0(int triIdx) const { return rvec3(v0[0][triIdx], v0[1][triIdx], v0[2][triIdx]); }
+	rvec3 GetEdge1(int triIdx) const { return rvec3(e1[0][triIdx], e1[1][triIdx], e1[2][triIdx]); }
+	rvec3 GetEdge2(int triIdx) const { return rvec3(e2[0][triIdx], e2[1][triIdx], e2[2][triIdx]); }
+	void print(int triIdx) const;
+
+	// Test the provided ray against a triangle. Returns distance and barycentric coords in t, u, v
+	bool IntersectTriangle(int triIdx, const Ray3D& ray, Real& t, Real& u, Real& v) const;
+	// Test one ray against up to packetSize consecutive triangles (first, first + 1, ...) at once
+	// Returns a mask of the triangles that were hit between tMin and tMax, with each one's t, u, v stored in its lane
+	int IntersectTriangleGroup(int first, int count, const Ray3D& ray, Real tMin, Real tMax,
+		Real (&t)[packetSize], Real (&u)[packetSize], Real (&v)[packetSize]) const;
+	// Find the closest of the triangles in [first, first + count) that the ray hits between tMin and tMax
+	// Returns the index of the triangle (with its t, u, v), or -1 if none were hit
+	int IntersectClosest(int first, int count, const Ray3D& ray, Real tMin, Real tMax, Real& t, Real& u, Real& v) const;
+	// Returns true if any of the triangles in [first, first + count) is hit between tMin and tMax
+	bool IntersectAny(int first, int count, const Ray3D& ray, Real tMin, Real tMax) const;
 
 private:
-	glm::dvec4 locations[3];
-	glm::dvec4 norms[3];
+	// Load packetSize values starting at first, padding with zeros past the end of the list
+	SimdReal LoadGroup(const ArrayView<Real>& values, int first, int count) const;
+
+	// x, y, and z components stored in separate arrays, either owned by this list or loaded from elsewhere
+	ArrayView<Real> v0[3];
+	ArrayView<Real> e1[3];
+	ArrayView<Real> e2[3];
+	// Arrays filled in by Add (empty if the list was loaded)
+	std::vector<Real> v0Storage[3];
+	std::vector<Real> e1Storage[3];
+	std::vector<Real> e2Storage[3];
 };
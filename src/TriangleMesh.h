@@ -6,29 +6,53 @@
 #include <memory>
 #include <iostream>
 
-#include "tiny_obj_loader.h"
-
 #include "SceneObject.h"
 #include "Ray3D.h"
 #include "HitResult.h"
-#include "Sphere.h"
-#include "Triangle.h"
+#include "MeshGeometry.h"
+#include "AliasTable.h"
 
 class TriangleMesh : public SceneObject {
 public:
 	// Call parent constructor to create transform matrix and apply material
-	TriangleMesh(std::string _name, Transform _transf, std::shared_ptr<Material> _mat) : SceneObject(_name, _transf, _mat) {}
-	void LoadMeshFile(std::string filename);
+	TriangleMesh(std::string _name, Transform _transf, const Material* _mat) : SceneObject(_name, _transf, _mat, ObjectType::TRIANGLE_MESH) {
+		hasRandomPointMethodDefined = true;
+	}
+	// Use the geometry of an OBJ file. Meshes that load the same file share a single copy of its geometry and BVH, and
+	// only differ by their transform and material
+	// The BVH is built with bvhSettings if this is the first instance to load the file
+	void LoadMeshFile(std::string filename, const BVHBuildSettings& bvhSettings = BVHBuildSettings());
+	// Shared geometry of the mesh (nullptr until a file is loaded)
+	const MeshGeometry* GetGeometry() const { return geometry.get(); }
 
-	bool IntersectLocal(Ray3D& ray, HitResult& outHit, double tMin, double tMax) override;
-	glm::dvec4 GetRandomPointOnSurface(double& pdf, glm::dvec4& normal) override;
+	bool IntersectLocal(Ray3D& ray, HitResult& outHit, Real tMin, Real tMax) override;
+	bool IntersectLocalAny(Ray3D& ray, Real tMin, Real tMax) override;
+	int IntersectLocalAnyPacket(const RayPacket& packet, int activeMask, Real tMin,
+		const Real (&tMax)[packetSize]) override;
+	// Chooses a triangle in proportion to its world-space area, then a uniform point on it
+	rvec4 GetRandomPointOnSurface(const rvec4& refPoint, const glm::dvec2& u, double& pdf, rvec4& normal) override;
+	// Points are chosen uniformly over the whole surface, so every point has the same density
+	double GetSurfacePdf(const rvec4& refPoint, const rvec4& point) const override { return areaPdf; }
+	double GetSurfaceArea() const override { return area; }
+	// Measure the world-space area of every triangle. Each instance has its own transform, so this isn't shared
+	void PrepareSurfaceSampling() override;
+	AABB GetLocalBounds() const override;
+	// False until a file with at least one triangle is loaded
+	bool HasGeometry() const override { return geometry && geometry->GetTriangles().Size() > 0; }
+	// Meshes that don't share their geometry with another instance swap it for a world-space copy. Shared geometry
+	// stays in local space, and each instance keeps transforming rays into it
+	bool Flatten() override;
 	
 private:
+	// Local-space geometry, possibly shared with other instances of the same file
+	std::shared_ptr<const MeshGeometry> geometry;
 
-	// List of triangles
-	std::vector<std::shared_ptr<Triangle> > allTriangles;
-	std::unique_ptr<Sphere> boundingSphere;
-
-	// Name of file that is loaded (used for hard-coded bounding sphere for bunny)
+	// Name of file that is loaded
 	std::string objFile;
+
+	// Picks triangles in proportion to their world-space area. Only built for emissive meshes
+	AliasTable triangleTable;
+	double area = 0;
+	// 1 / area (0 if the mesh has no area), the density of every surface sample
+	double areaPdf = 0;
 };
\ No newline at end of file
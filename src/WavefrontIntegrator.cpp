@@ -0,0 +1,96 @@
+#pragma once
+#include <algorithm>
+#include "WavefrontIntegrator.h"
+
+using namespace std;
+using namespace glm;
+
+void WavefrontIntegrator::TracePaths(std::vector<Path>& paths, Sampler& sampler) {
+	rayQueue.resize(paths.size());
+	for (size_t i = 0; i < paths.size(); i++) rayQueue[i] = (int)i;
+	hits.assign(paths.size(), HitResult());
+	hitMaterials.assign(paths.size(), -1);
+
+	for (int bounce = 0; bounce < scene.maxBounces && !rayQueue.empty(); bounce++) {
+		if (bounce == 0) RenderStats::Local().primaryRays += rayQueue.size();
+		else RenderStats::Local().bounceRays += rayQueue.size();
+		IntersectQueue(paths);
+
+		// Paths that missed everything pick up the background color and end here
+		hitQueue.clear();
+		for (int pathIdx : rayQueue) {
+			Path& path = paths[pathIdx];
+			if (hits[pathIdx].hitObject == nullptr) {
+				path.state.radiance += path.state.throughput * scene.backgroundColor;
+				RENDER_STAT(RenderStats::Local().AddPath(bounce + 1));
+			}
+			else {
+				hitMaterials[pathIdx] = hits[pathIdx].hitObject->materialId;
+				hitQueue.push_back(pathIdx);
+			}
+		}
+		// Shade the hits one material at a time, so the same material data (and branches) are used back to back
+		// Ties are broken by path index so that the order doesn't depend on the sort implementation
+		std::sort(hitQueue.begin(), hitQueue.end(), [&](int a, int b) {
+			if (hitMaterials[a] != hitMaterials[b]) return hitMaterials[a] < hitMaterials[b];
+			return a < b;
+		});
+
+		shadowQueue.clear();
+		nextRayQueue.clear();
+		for (int pathIdx : hitQueue) {
+			Path& path = paths[pathIdx];
+			// Pick up the path's sample where it left off on the last bounce
+			sampler.StartPixelSample(path.row, path.col, path.sampleIndex, path.dimension);
+			size_t firstShadowRay = shadowQueue.size();
+			bool continuePath = scene.ShadeHit(path.ray, hits[pathIdx], sampler, path.state, shadowQueue);
+			path.dimension = sampler.GetDimension();
+			for (size_t i = firstShadowRay; i < shadowQueue.size(); i++) shadowQueue[i].pathIdx = pathIdx;
+
+			if (continuePath && bounce + 1 < scene.maxBounces) {
+				nextRayQueue.push_back(pathIdx);
+			}
+			else {
+				RENDER_STAT(RenderStats::Local().AddPath(bounce + 1));
+			}
+		}
+		TraceShadowQueue(paths);
+		rayQueue.swap(nextRayQueue);
+	}
+}
+
+void WavefrontIntegrator::IntersectQueue(std::vector<Path>& paths) {
+	for (size_t first = 0; first < rayQueue.size(); first += packetSize) {
+		int count = (int)std::min((size_t)packetSize, rayQueue.size() - first);
+		RayPacket packet;
+		for (int lane = 0; lane < count; lane++) {
+			const Ray3D& ray = paths[rayQueue[first + lane]].ray;
+			packet.SetRay(lane, ray.start, ray.dir);
+		}
+		// Unused lanes get a copy of a real ray so they don't produce NaNs (they're masked out anyways)
+		for (int lane = count; lane < packetSize; lane++) {
+			packet.CopyLane(lane, 0);
+		}
+
+		HitResult laneHits[packetSize];
+		scene.FindClosestHitPacket(packet, (1 << count) - 1, laneHits);
+		for (int lane = 0; lane < count; lane++) {
+			hits[rayQueue[first + lane]] = laneHits[lane];
+		}
+	}
+}
+
+void WavefrontIntegrator::TraceShadowQueue(std::vector<Path>& paths) {
+	// Shadow rays towards the same light all end up in the same place, so group them into packets by light
+	std::stable_sort(shadowQueue.begin(), shadowQueue.end(), [](const Scene::ShadowRay& a, const Scene::ShadowRay& b) {
+		return a.lightIdx < b.lightIdx;
+	});
+	for (size_t first = 0; first < shadowQueue.size(); first += packetSize) {
+		int count = (int)std::min((size_t)packetSize, shadowQueue.size() - first);
+		const Scene::ShadowRay* rays = &shadowQueue[first];
+		int shadowMask = scene.AreShadowRaysBlocked(rays, count);
+		for (int lane = 0; lane < count; lane++) {
+			if (!(shadowMask & (1 << lane))) paths[rays[lane].pathIdx].state.radiance += rays[lane].contribution;
+		}
+	}
+}
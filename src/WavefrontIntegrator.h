@@ -0,0 +1,57 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "Scene.h"
+#include "Sampler.h"
+#include "HitResult.h"
+#include "Ray3D.h"
+
+// Breadth-first alternative to Scene::ComputeRayColor. Instead of following one path from start to finish, every path
+// of a tile is advanced one bounce at a time: the queued rays are intersected together as packets, the hits are sorted
+// by material and shaded, and the shading emits a queue of shadow rays (traced as a packet per light) and a queue of
+// bounce rays for the next round. The shading is the same as ComputeRayColor's (Scene::ShadeHit), and each path keeps
+// its own place in the sampler's sequence, so both integrators render the same image
+class WavefrontIntegrator {
+public:
+	// A path that is being traced, along with the pixel sample it belongs to
+	struct Path {
+		Path(const Ray3D& _ray, int _row, int _col, int _sampleIndex, int _dimension) :
+			ray(_ray),
+			row(_row),
+			col(_col),
+			sampleIndex(_sampleIndex),
+			dimension(_dimension) {}
+
+		// Next ray to trace (starts as the camera ray)
+		Ray3D ray;
+		Scene::PathState state;
+		int row, col;
+		int sampleIndex;
+		// Next sampler dimension of the path's sample (i.e. 2 after the camera ray used the first 2)
+		int dimension;
+	};
+
+	WavefrontIntegrator(const Scene& _scene) : scene(_scene) {}
+
+	// Trace every path until it ends, leaving its color in path.state.radiance
+	void TracePaths(std::vector<Path>& paths, Sampler& sampler);
+
+private:
+	// Find the closest hit of every path in rayQueue, packetSize rays at a time
+	void IntersectQueue(std::vector<Path>& paths);
+	// Trace the shadow queue, and add the contribution of every unblocked shadow ray to its path
+	void TraceShadowQueue(std::vector<Path>& paths);
+
+	const Scene& scene;
+
+	// Indices of the paths with a ray to trace this round, and the ones that continue to the next round
+	std::vector<int> rayQueue;
+	std::vector<int> nextRayQueue;
+	// Closest hit of each path (indexed by path), and the paths that hit something, sorted by material
+	std::vector<HitResult> hits;
+	std::vector<int> hitQueue;
+	// Material ID of each path's hit (indexed by path)
+	std::vector<int> hitMaterials;
+	std::vector<Scene::ShadowRay> shadowQueue;
+};
@@ -4,10 +4,10 @@
 #include <string>
 #include <limits>
 #include <memory>
-#include <ctime>
 #include <cstdlib>
 #include <chrono>
 #include <iomanip>
+#include <csignal>
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -17,6 +17,7 @@
 #include "tiny_obj_loader.h"
 
 #include "Image.h"
+#include "ImageWriter.h"
 
 #include "Camera.h"
 #include "HitResult.h"
@@ -24,76 +25,425 @@
 #include "Scene.h"
 #include "SceneObject.h"
 #include "Sphere.h"
+#include "Renderer.h"
+#include "PFM.h"
+#include "Benchmark.h"
+#include "Merge.h"
+#include "Interactive.h"
+#include "Denoiser.h"
 
 using namespace std;
 using namespace glm;
 
 double FindSecondsSince(chrono::time_point<chrono::steady_clock> startTime) {
-	auto stopTime = chrono::high_resolution_clock::now();
+	auto stopTime = chrono::steady_clock::now();
 	return chrono::duration_cast<chrono::milliseconds>(stopTime - startTime).count() / 1000.0;
 }
 
+// Finish the current pass and save a checkpoint instead of losing the render (i.e. when a job is preempted)
+void HandleStopSignal(int) {
+	Renderer::RequestStop();
+}
+
+// Extra images and processing for a render, read from the command line along with its RenderSettings
+struct OutputOptions {
+	// Also save the linear colors here, as a PFM image
+	string pfmFile;
+	// PFM image to compare the render to
+	string referenceFile;
+	// Save the first-hit albedo and normal of every pixel here
+	string albedoFile;
+	string normalFile;
+	// Denoise the image before it's saved (or compared)
+	bool denoise = false;
+	// Render the image a band at a time, writing each band to the output files as soon as it's done (see
+	// Renderer::RenderStreaming)
+	bool stream = false;
+};
+
+// Print how far this render's linear colors are from a reference render (i.e. a float build vs a double build)
+void CompareToReference(const string& referenceFile, const RenderSettings& settings, const vector<dvec3>& radiance) {
+	int refWidth, refHeight;
+	vector<dvec3> reference;
+	if (!ReadPFM(referenceFile, refWidth, refHeight, reference)) return;
+	if (refWidth != settings.width || refHeight != settings.height) {
+		cerr << "ERROR: reference image is " << refWidth << "x" << refHeight << ", but this render is ";
+		cerr << settings.width << "x" << settings.height << endl;
+		return;
+	}
+
+	double sumSqrdError = 0, maxError = 0;
+	dvec3 renderSum(0), refSum(0);
+	for (size_t i = 0; i < radiance.size(); i++) {
+		dvec3 diff = abs(radiance[i] - reference[i]);
+		sumSqrdError += dot(diff, diff) / 3.0;
+		maxError = std::max(maxError, std::max(diff.r, std::max(diff.g, diff.b)));
+		renderSum += radiance[i];
+		refSum += reference[i];
+	}
+	double rmse = sqrt(sumSqrdError / radiance.size());
+	double renderMean = (renderSum.r + renderSum.g + renderSum.b) / (3.0 * radiance.size());
+	double refMean = (refSum.r + refSum.g + refSum.b) / (3.0 * radiance.size());
+	cout << "Compared to " << referenceFile << ":" << endl;
+	cout << "  RMSE: " << rmse << ", max error: " << maxError << endl;
+	cout << "  Mean: " << renderMean << " (reference: " << refMean << ", ";
+	cout << 100.0 * (renderMean - refMean) / std::max(refMean, 1e-12) << "%)" << endl;
+}
+
+void PrintUsage() {
+	cout << "Usage: ./my-first-pathtracer <SCENE NAME> <IMAGE SIZE> <NUM SAMPLES> <IMAGE FILENAME> [OPTIONS]" << endl;
+	cout << "       (IMAGE FILENAME can end in .png, or .hdr/.exr/.pfm to save linear colors for compositing)" << endl;
+	cout << "   or: ./my-first-pathtracer --benchmark <JSON FILENAME> [OPTIONS]" << endl;
+	cout << "       (render the benchmark scenes with fixed settings, and save the timings to a JSON file)" << endl;
+	cout << "   or: ./my-first-pathtracer --interactive <SCENE NAME> <IMAGE SIZE> <NUM SAMPLES> <IMAGE FILENAME> [OPTIONS]" << endl;
+	cout << "       (keep the scene loaded, and re-render it as the camera and materials are edited from stdin)" << endl;
+	cout << "   or: ./my-first-pathtracer --merge <IMAGE FILENAME> <CHECKPOINT>... [--checkpoint <FILE>]" << endl;
+	cout << "       (combine the checkpoints of a render split with --shard into one image, and optionally one checkpoint)" << endl;
+	cout << "Options:" << endl;
+	cout << "  --threads <N>      Number of render threads (default: one per core)" << endl;
+	cout << "  --tile-size <N>    Width/height of each render tile in pixels (default: 32)" << endl;
+	cout << "  --no-packets       Trace camera rays one at a time instead of as SIMD packets" << endl;
+	cout << "  --wavefront        Trace every path of a tile one bounce at a time, in packets (breadth-first)" << endl;
+	cout << "  --light-samples <N>" << endl;
+	cout << "                     Shadow rays per diffuse bounce, sent to lights chosen by power (default: every light)" << endl;
+	cout << "  --flatten          Bake object transforms into world-space geometry where possible, so hits skip" << endl;
+	cout << "                     the matrix work (meshes shared between instances keep their transforms)" << endl;
+	cout << "  --fast-bvh         Build the mesh BVHs from Morton codes, which is much faster than the SAH but traces" << endl;
+	cout << "                     slower (i.e. for previews). These BVHs are rebuilt every time instead of cached" << endl;
+	cout << "  --pass-samples <N> Samples added to every pixel per pass over the image (default: 8)" << endl;
+	cout << "  --checkpoint <FILE>" << endl;
+	cout << "                     Save the accumulated samples to FILE between passes, so the render can be resumed" << endl;
+	cout << "  --checkpoint-interval <SECONDS>" << endl;
+	cout << "                     Minimum time between checkpoints (default: 300)" << endl;
+	cout << "  --time-limit <SECONDS>" << endl;
+	cout << "                     Stop after the first pass that ends past the time limit" << endl;
+	cout << "  --resume <FILE>    Continue the render saved in a checkpoint file (and keep checkpointing to it)" << endl;
+	cout << "  --adaptive <THRESHOLD>" << endl;
+	cout << "                     Stop sampling pixels once their relative noise is below THRESHOLD (e.g. 0.01), and" << endl;
+	cout << "                     spend the saved samples on noisier pixels. NUM SAMPLES becomes the average per pixel" << endl;
+	cout << "  --adaptive-min <N> Samples every pixel gets before it can count as converged (default: 16)" << endl;
+	cout << "  --adaptive-max <N> Most samples any pixel can get (default: 4 * NUM SAMPLES)" << endl;
+	cout << "  --sampler <TYPE>   How sample positions are chosen: random, stratified, or sobol (default: sobol)" << endl;
+	cout << "  --seed <N>         Seed for the sampler, renders with different seeds have independent noise, and" << endl;
+	cout << "                     renders with the same seed are identical (default: 0)" << endl;
+	cout << "  --shard <INDEX>/<COUNT>" << endl;
+	cout << "                     Only render part INDEX (from 0) of COUNT parts of the image, i.e. one per machine. Use" << endl;
+	cout << "                     --checkpoint to save the part, then --merge to combine the parts" << endl;
+	cout << "  --shard-mode <MODE>" << endl;
+	cout << "                     How the image is split: tiles (each part gets every COUNT-th tile) or samples (each" << endl;
+	cout << "                     part gets its own range of every pixel's samples, can't be used with --adaptive)" << endl;
+	cout << "                     (default: tiles)" << endl;
+	cout << "  --preview <FILE>   Save the image so far between passes, without pausing the render" << endl;
+	cout << "  --preview-interval <SECONDS>" << endl;
+	cout << "                     Minimum time between previews (default: 10)" << endl;
+	cout << "  --pfm <FILE>       Also save the linear (untonemapped) colors as a PFM image" << endl;
+	cout << "  --albedo <FILE>    Also save the albedo of the first surface each pixel hits (mirrors show the surface" << endl;
+	cout << "                     they reflect)" << endl;
+	cout << "  --normal <FILE>    Also save the world-space normal of the first surface each pixel hits (use .pfm or" << endl;
+	cout << "                     .exr to keep the sign, PNGs map -1..1 to 0..1)" << endl;
+	cout << "  --denoise          Filter the noise out of the image (and the PFM) using the albedo, normals and" << endl;
+	cout << "                     per-pixel noise estimates, so far fewer samples are needed" << endl;
+	cout << "  --compare <FILE>   Print the difference between this render and a PFM reference image" << endl;
+	cout << "                     (i.e. render with --pfm in a double build, then --compare in a float build)" << endl;
+	cout << "  --stream           Render the image a band of rows at a time from the top down, writing each band to the" << endl;
+	cout << "                     image (and the PFM) as soon as it's done, so memory use grows with the width instead of" << endl;
+	cout << "                     the whole image. PNGs are saved uncompressed. Can't be combined with the options that" << endl;
+	cout << "                     need the whole image (checkpoints, previews, shards, adaptive sampling, the albedo and" << endl;
+	cout << "                     normal images, denoising and comparing)" << endl;
+}
+
+// Read the optional flags that come after the required arguments. Returns false if an option isn't recognized
+bool ReadOptions(int argc, char** argv, int firstArg, RenderSettings& settings, OutputOptions& outputs) {
+	for (int i = firstArg; i < argc; i++) {
+		string arg(argv[i]);
+		if (arg == "--threads" && i + 1 < argc) {
+			settings.numThreads = atoi(argv[++i]);
+		}
+		else if (arg == "--tile-size" && i + 1 < argc) {
+			settings.tileSize = atoi(argv[++i]);
+		}
+		else if (arg == "--no-packets") {
+			settings.usePackets = false;
+		}
+		else if (arg == "--wavefront") {
+			settings.useWavefront = true;
+		}
+		else if (arg == "--light-samples" && i + 1 < argc) {
+			settings.lightSamples = atoi(argv[++i]);
+		}
+		else if (arg == "--flatten") {
+			settings.flattenTransforms = true;
+		}
+		else if (arg == "--fast-bvh") {
+			settings.fastBVH = true;
+		}
+		else if (arg == "--pass-samples" && i + 1 < argc) {
+			settings.samplesPerPass = atoi(argv[++i]);
+		}
+		else if (arg == "--checkpoint" && i + 1 < argc) {
+			settings.checkpointFile = argv[++i];
+		}
+		else if (arg == "--checkpoint-interval" && i + 1 < argc) {
+			settings.checkpointInterval = atof(argv[++i]);
+		}
+		else if (arg == "--time-limit" && i + 1 < argc) {
+			settings.timeLimit = atof(argv[++i]);
+		}
+		else if (arg == "--resume" && i + 1 < argc) {
+			settings.resumeFile = argv[++i];
+		}
+		else if (arg == "--adaptive" && i + 1 < argc) {
+			settings.adaptiveThreshold = atof(argv[++i]);
+		}
+		else if (arg == "--adaptive-min" && i + 1 < argc) {
+			settings.adaptiveMinSamples = atoi(argv[++i]);
+		}
+		else if (arg == "--adaptive-max" && i + 1 < argc) {
+			settings.adaptiveMaxSamples = atoi(argv[++i]);
+		}
+		else if (arg == "--sampler" && i + 1 < argc) {
+			string samplerName(argv[++i]);
+			if (!Sampler::ParseType(samplerName, settings.samplerType)) {
+				cerr << "Unknown sampler: " << samplerName << endl;
+				return false;
+			}
+		}
+		else if (arg == "--seed" && i + 1 < argc) {
+			settings.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--shard" && i + 1 < argc) {
+			string shard(argv[++i]);
+			size_t slash = shard.find('/');
+			if (slash == string::npos) {
+				cerr << "Shards are given as <INDEX>/<COUNT>: " << shard << endl;
+				return false;
+			}
+			settings.shardIndex = atoi(shard.substr(0, slash).c_str());
+			settings.shardCount = atoi(shard.substr(slash + 1).c_str());
+			if (settings.shardCount < 1 || settings.shardIndex < 0 || settings.shardIndex >= settings.shardCount) {
+				cerr << "Shard index has to be from 0 to COUNT - 1: " << shard << endl;
+				return false;
+			}
+		}
+		else if (arg == "--shard-mode" && i + 1 < argc) {
+			string mode(argv[++i]);
+			if (mode == "tiles") settings.shardMode = ShardMode::TILES;
+			else if (mode == "samples") settings.shardMode = ShardMode::SAMPLES;
+			else {
+				cerr << "Unknown shard mode: " << mode << endl;
+				return false;
+			}
+		}
+		else if (arg == "--preview" && i + 1 < argc) {
+			settings.previewFile = argv[++i];
+		}
+		else if (arg == "--preview-interval" && i + 1 < argc) {
+			settings.previewInterval = atof(argv[++i]);
+		}
+		else if (arg == "--pfm" && i + 1 < argc) {
+			outputs.pfmFile = argv[++i];
+		}
+		else if (arg == "--compare" && i + 1 < argc) {
+			outputs.referenceFile = argv[++i];
+		}
+		else if (arg == "--albedo" && i + 1 < argc) {
+			outputs.albedoFile = argv[++i];
+		}
+		else if (arg == "--normal" && i + 1 < argc) {
+			outputs.normalFile = argv[++i];
+		}
+		else if (arg == "--denoise") {
+			outputs.denoise = true;
+		}
+		else if (arg == "--stream") {
+			outputs.stream = true;
+		}
+		else {
+			cerr << "Unknown option: " << arg << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
 int main(int argc, char **argv) {
-	auto startTime = chrono::high_resolution_clock::now();
-	if(argc < 4) {
-		cout << "Usage: ./my-first-pathtracer <SCENE NAME> <IMAGE SIZE> <NUM SAMPLES> <IMAGE FILENAME>" << endl;
+	auto startTime = chrono::steady_clock::now();
+	if (argc >= 3 && string(argv[1]) == "--benchmark") {
+		RenderSettings settings;
+		OutputOptions outputs;
+		if (!ReadOptions(argc, argv, 3, settings, outputs)) {
+			PrintUsage();
+			return 0;
+		}
+		return RunBenchmark(argv[2], settings) ? 0 : 1;
+	}
+	if (argc >= 4 && string(argv[1]) == "--merge") {
+		vector<string> checkpointFiles;
+		string mergedCheckpointFile;
+		for (int i = 3; i < argc; i++) {
+			string arg(argv[i]);
+			if (arg == "--checkpoint" && i + 1 < argc) mergedCheckpointFile = argv[++i];
+			else checkpointFiles.push_back(arg);
+		}
+		return MergeShards(argv[2], checkpointFiles, mergedCheckpointFile) ? 0 : 1;
+	}
+	if (argc >= 6 && string(argv[1]) == "--interactive") {
+		RenderSettings settings;
+		settings.height = atoi(argv[3]);
+		settings.width = settings.height;
+		settings.numSamples = atoi(argv[4]);
+		OutputOptions outputs;
+		if (!ReadOptions(argc, argv, 6, settings, outputs)) {
+			PrintUsage();
+			return 0;
+		}
+		signal(SIGINT, HandleStopSignal);
+		signal(SIGTERM, HandleStopSignal);
+		return RunInteractive("../resources/" + string(argv[2]) + ".json", argv[5], settings) ? 0 : 1;
+	}
+	if(argc < 5) {
+		PrintUsage();
 		return 0;
 	}
 	string sceneName(argv[1]);
-	int height = atoi(argv[2]);
-	int width = height;
-	int numSamples = atoi(argv[3]);
+	RenderSettings settings;
+	settings.height = atoi(argv[2]);
+	settings.width = settings.height;
+	settings.numSamples = atoi(argv[3]);
 	string fileName(argv[4]);
-	shared_ptr<Image> outputImage = make_shared<Image>(width, height);
+	OutputOptions outputs;
+
+	if (!ReadOptions(argc, argv, 5, settings, outputs)) {
+		PrintUsage();
+		return 0;
+	}
+	// Resumed renders keep saving to the file they were loaded from, unless another checkpoint file was given
+	if (settings.checkpointFile.empty()) {
+		settings.checkpointFile = settings.resumeFile;
+	}
+	if (outputs.stream && (!settings.checkpointFile.empty() || !settings.previewFile.empty() || settings.shardCount > 1 ||
+		settings.adaptiveThreshold > 0 || !outputs.albedoFile.empty() || !outputs.normalFile.empty() || outputs.denoise ||
+		!outputs.referenceFile.empty())) {
+		cerr << "ERROR: --stream only keeps one band of the image in memory, so it can't be used with --checkpoint, --resume,";
+		cerr << " --preview, --shard, --adaptive, --albedo, --normal, --denoise or --compare" << endl;
+		return 1;
+	}
+	if (settings.shardCount > 1 && settings.checkpointFile.empty()) {
+		cerr << "ERROR: --shard needs --checkpoint <FILE>, the shard's samples are saved there to be merged" << endl;
+		return 1;
+	}
+	if (settings.shardCount > 1 && settings.shardMode == ShardMode::SAMPLES && settings.adaptiveThreshold > 0) {
+		// Each shard would decide on its own when a pixel has converged, so their sample ranges wouldn't line up
+		cerr << "ERROR: sample shards can't be used with adaptive sampling, use --shard-mode tiles instead" << endl;
+		return 1;
+	}
+	cout << "Geometry precision: " << ((sizeof(Real) == sizeof(float)) ? "float" : "double") << endl;
+	// Streamed renders never hold the whole image
+	Image outputImage(outputs.stream ? 0 : settings.width, outputs.stream ? 0 : settings.height);
 
 	// Provide image dimensions to camera for aspect ratio & ray calculations
-	Camera camera (width, height, dvec4(0, 0, -5, 1), dvec3(0, 0, 0), 45, 1.0);
+	Camera camera (settings.width, settings.height, rvec4(0, 0, -5, 1), rvec3(0, 0, 0), 45, 1.0);
 
 	// Build a scene with a black background color
 	Scene scene(dvec3(0, 0, 0));
-	scene.BuildSceneFromFile("../resources/" + sceneName + ".json", camera);
-	
-	srand(time(NULL));
-
-	// Used for counting percentage completion
-	int prevPercent = 0;
-
-	// Iterate over every pixel
-	for (int row = 0; row < height; row++) {
-		for (int col = 0; col < width; col++) {
-			// Iterate multiple times over each pixel for path tracing
-			dvec3 rayColor(0, 0, 0);
-			for (int i = 0; i < numSamples; i++) {
-				// Generate random ray directions within the current pixel (for antialiasing)
-				Ray3D newRay = camera.CreateCameraRay(row, col);
-				// Iterate over every item in the scene to find the intersection/color of the ray
-				rayColor += scene.ComputeRayColor(newRay);
-			}
-			rayColor /= (double)numSamples;
-
-			// Image processing
-			rayColor *= camera.GetExposure();
-			rayColor = Camera::ApplyTonemapping(rayColor, Camera::Tonemapper::ACES_APPROX);
-			rayColor = Camera::ColorLinearToSRGB(rayColor);
-
-			// Store color value
-			outputImage->setPixel(col, row, 255 * rayColor.r, 255 * rayColor.g, 255 * rayColor.b);
-
-			// Print a status update (to the nearest 1%)
-			int percent = std::floor(100 * (row / (float)height));
-			if (percent > prevPercent) {
-				prevPercent = percent;
-				double estRem = (FindSecondsSince(startTime) / (double)percent) * (100 - percent);
-				cout << setw(2) << percent << "%, est: " << estRem << " s" << endl;
-			}
+	BVHBuildMethod bvhMethod = settings.fastBVH ? BVHBuildMethod::MORTON : BVHBuildMethod::SAH;
+	if (!scene.BuildSceneFromFile("../resources/" + sceneName + ".json", camera, settings.numThreads, bvhMethod)) return 1;
+	cout << "Built the BVHs in " << scene.GetBVHBuildSeconds() << " s" << endl;
+	scene.SetLightSamples(settings.lightSamples);
+	if (settings.flattenTransforms) {
+		cout << "Flattened " << scene.FlattenTransforms() << " objects into world space" << endl;
+	}
+
+	// Split the image into tiles and render them on all threads
+	Renderer renderer(scene, camera, settings);
+	signal(SIGINT, HandleStopSignal);
+	signal(SIGTERM, HandleStopSignal);
+	bool finished;
+	ImageStreamWriter imageStream, pfmStream;
+	if (outputs.stream) {
+		// Every band gets the same post processing that the whole image would
+		PostProcessSettings postProcess(camera);
+		if (!imageStream.Open(fileName, settings.width, settings.height, postProcess)) return 1;
+		if (!outputs.pfmFile.empty() && !pfmStream.Open(outputs.pfmFile, settings.width, settings.height, postProcess)) {
+			return 1;
 		}
+		finished = renderer.RenderStreaming([&](const Image& band) {
+			return imageStream.WriteBand(band) && (outputs.pfmFile.empty() || pfmStream.WriteBand(band));
+		});
+	}
+	else {
+		finished = renderer.Render(outputImage);
+	}
+	if (!finished) {
+		cout << "Render stopped before every pixel reached " << settings.numSamples << " samples";
+		if (!settings.checkpointFile.empty()) cout << ", continue it with --resume " << settings.checkpointFile;
+		cout << endl;
 	}
 
+	const RenderStats& stats = renderer.GetStats();
+	cout << "Traced " << stats.GetTotalRays() << " rays (" << stats.GetTotalRays() / std::max(renderer.GetRenderSeconds(), 1e-3) / 1e6;
+	cout << " Mrays/s), " << stats.GetTotalTests() / (double)std::max<uint64_t>(stats.GetTotalRays(), 1) << " tests per ray" << endl;
+#ifdef RENDER_STATS
+	stats.PrintDetails(cout);
+#endif
 	double duration = FindSecondsSince(startTime);
 	cout << "Completed in " << duration << " s" << endl;
+	if (outputs.stream) {
+		// Fills in any rows that the render didn't reach
+		bool written = imageStream.Close();
+		if (!outputs.pfmFile.empty()) written = pfmStream.Close() && written;
+		return written ? 0 : 1;
+	}
 
-	outputImage->writeToFile(fileName);
-	//outputImage->writeToFile(fileName + to_string(duration) + ".png");
+	// The format comes from the file extension (.png, .hdr, .exr or .pfm). Images are saved in the background while the
+	// comparison runs, and the writer finishes them before it's destroyed
+	AsyncImageWriter imageWriter;
+	PostProcessSettings postProcess(camera);
+	if (outputs.denoise || !outputs.albedoFile.empty() || !outputs.normalFile.empty()) {
+		Image albedo(settings.width, settings.height);
+		Image normal(settings.width, settings.height);
+		renderer.ResolveFeatures(albedo, normal);
+		if (outputs.denoise) {
+			auto denoiseStart = chrono::steady_clock::now();
+			DenoiseSettings denoiseSettings;
+			denoiseSettings.numThreads = settings.numThreads;
+			outputImage = Denoise(outputImage, albedo, normal, renderer.GetVariance(), denoiseSettings);
+			cout << "Denoised in " << FindSecondsSince(denoiseStart) << " s" << endl;
+		}
+		// Albedo and normals are data rather than colors, so they're written without any exposure or tonemapping
+		PostProcessSettings featurePostProcess;
+		featurePostProcess.tonemapper = Camera::Tonemapper::SIMPLE_CLAMP;
+		if (!outputs.albedoFile.empty()) {
+			imageWriter.Write(outputs.albedoFile, std::move(albedo), featurePostProcess);
+		}
+		if (!outputs.normalFile.empty()) {
+			if (GetImageFormat(outputs.normalFile) == ImageFormat::PNG) {
+				for (int row = 0; row < settings.height; row++) {
+					for (int col = 0; col < settings.width; col++) {
+						normal.setPixel(col, row, 0.5f * normal.getPixel(col, row) + vec3(0.5f));
+					}
+				}
+			}
+			imageWriter.Write(outputs.normalFile, std::move(normal), featurePostProcess);
+		}
+	}
+	// Denoised renders are compared as they're saved, so the denoiser's error can be measured too
+	vector<dvec3> finalColors;
+	if (outputs.denoise && !outputs.referenceFile.empty()) {
+		finalColors.resize((size_t)settings.width * settings.height);
+		for (int row = 0; row < settings.height; row++) {
+			for (int col = 0; col < settings.width; col++) {
+				finalColors[(size_t)row * settings.width + col] = dvec3(outputImage.getPixel(col, row));
+			}
+		}
+	}
+	if (!outputs.pfmFile.empty()) {
+		imageWriter.Write(outputs.pfmFile, outputImage, postProcess);
+	}
+	imageWriter.Write(fileName, std::move(outputImage), postProcess);
+	if (!outputs.referenceFile.empty()) {
+		CompareToReference(outputs.referenceFile, settings, outputs.denoise ? finalColors : renderer.GetRadiance());
+	}
 
 	return 0;
 }